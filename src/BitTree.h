@@ -1,23 +1,163 @@
-
+#pragma once
 
 #include <cstdint>
 #include <cstring>
+#include <cstddef>
 #include <assert.h>
 #include <vector>
+#include <array>
+#include <tuple>
+#include <utility>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <new>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <immintrin.h>
 #define _PERF_TRYHARD
 
 
-struct ByteNode
+//number of slots of each node kind. Nodes with less than 256 slots store their slots packed,
+//addressed by the rank of the bit in bytemask, and are promoted to a bigger kind when they fill up
+constexpr uint16_t node_capacities[] = { 4, 16, 48, 256 };
+constexpr int node_kind_count = 4;
+constexpr uint8_t node_kind_full = 3;
+
+//nodes are 32 byte aligned so the bytemask is always a single aligned 256 bit load
+struct alignas(32) ByteNode
 {
 	uint64_t bytemask[4];
+	//owners besides the first, set once trees share the node with share_bytetree. A shared node is never written,
+	//see unshare_treenode
+	uint16_t shares;
+	uint8_t kind;
+	//size of a slot. Inner nodes hold pointers, leaves hold values as wide as the value type of their tree
+	uint8_t slot_bytes;
+	//inner nodes only, number of keys in the leaves below. Leaves count their bitmask instead, see node_population
+	uint32_t population;
 	union
 	{
+		//only the first node_capacities[kind] entries exist in memory
 		uint64_t vals[256];
+		uint32_t vals32[256];
+		uint16_t vals16[256];
 		ByteNode* childs[256];
 	};
 };
 
+constexpr size_t node_header_bytes = offsetof(ByteNode, vals);
+
+//leaves can hold 2, 4 or 8 byte values, or none at all for trees that only record which indices exist. Inner nodes always use 8
+constexpr int node_width_count = 4;
+
+__inline int node_width_index(uint8_t slot_bytes)
+{
+	return slot_bytes == 0 ? 0 : (slot_bytes == 2 ? 1 : (slot_bytes == 4 ? 2 : 3));
+}
+
+__inline size_t node_bytes(uint8_t kind, uint8_t slot_bytes = sizeof(uint64_t))
+{
+	return (node_header_bytes + node_capacities[kind] * slot_bytes + alignof(ByteNode) - 1) & ~(alignof(ByteNode) - 1);
+}
+
+
+
+__inline int popcount64(uint64_t mask)
+{
+#ifdef _MSC_VER
+	return int(__popcnt64(mask));
+#else
+	return __builtin_popcountll(mask);
+#endif
+}
+
+//index of the lowest set bit, mask cant be 0
+__inline int countr_zero64(uint64_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return int(index);
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+//for every byte value, the positions of its set bits packed into a uint64 (one per byte) and how many there are
+struct BitIndexTable
+{
+	uint64_t indices[256];
+	uint8_t counts[256];
+};
+
+constexpr BitIndexTable build_bit_index_table()
+{
+	BitIndexTable table{};
+	for (int byte = 0; byte < 256; byte++)
+	{
+		int count = 0;
+		for (int bit = 0; bit < 8; bit++)
+		{
+			if (byte & (1 << bit))
+			{
+				table.indices[byte] |= uint64_t(bit) << (count * 8);
+				count++;
+			}
+		}
+		table.counts[byte] = uint8_t(count);
+	}
+	return table;
+}
+
+constexpr BitIndexTable bit_index_table = build_bit_index_table();
 
+//writes the positions of the set bits of mask into indices, returns how many there are.
+//indices must have space for 64 + 8 entries, the table path writes 8 bytes at a time
+__inline int expand_bitmask_indices(uint64_t mask, uint8_t* indices)
+{
+#if defined(__AVX512VBMI2__)
+	const __m512i iota = _mm512_set_epi8(
+		63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, 48,
+		47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32,
+		31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16,
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	_mm512_storeu_si512(indices, _mm512_maskz_compress_epi8(mask, iota));
+	return popcount64(mask);
+#else
+	const int nindices = popcount64(mask);
+	if (nindices <= 8)
+	{
+		//few bits, one tzcnt + blsr per bit
+		for (int i = 0; i < nindices; i++)
+		{
+			indices[i] = uint8_t(countr_zero64(mask));
+			mask &= mask - 1;
+		}
+	}
+	else
+	{
+		//many bits, a table lookup per byte
+		int n = 0;
+		for (int b = 0; b < 8; b++)
+		{
+			const uint8_t byte = uint8_t(mask >> (b * 8));
+			const uint64_t packed = bit_index_table.indices[byte] + uint64_t(0x0808080808080808) * b;
+			memcpy(&indices[n], &packed, sizeof(uint64_t));
+			n += bit_index_table.counts[byte];
+		}
+	}
+	return nindices;
+#endif
+}
 
 template<typename F>
 void bitmask_optimal_iterate(const uint64_t* bitmask, int count, F&& function)
@@ -26,39 +166,24 @@ void bitmask_optimal_iterate(const uint64_t* bitmask, int count, F&& function)
 	for (int idx = 0; idx < count; idx++)
 	{
 		const int begin = idx * 64;
-		if (bitmask[idx] != 0)
+		uint64_t mask = bitmask[idx];
+		while (mask != 0)
 		{
-			for (int i = 0; i < 64; i++)
-			{
-				uint64_t mask = (uint64_t(0x1) << i);
-
-				if (bitmask[idx] & mask)
-				{
-					function(begin + i);
-				}
-			}
+			function(begin + countr_zero64(mask));
+			mask &= mask - 1;
 		}
 	}
 
 #else
-	uint8_t indices[64];
-	uint8_t nindices;
+	uint8_t indices[64 + 8];
+	int nindices;
 	
 	for (int idx = 0; idx < count; idx++)
 	{		
 		if (bitmask[idx] != 0)
 		{
 			const int begin = idx * 64;
-			nindices = 0;
-			for (int i = 0; i < 64; i++)
-			{
-				uint64_t mask = (uint64_t(0x1) << i);
-
-				if (bitmask[idx] & mask)
-				{
-					indices[nindices++] = i;
-				}
-			}
+			nindices = expand_bitmask_indices(bitmask[idx], &indices[0]);
 			
 			{
 				for(int i = 0 ; i < nindices ; i++)
@@ -102,6 +227,78 @@ __inline bool is_node_empty(ByteNode* node)
 	return !(node->bytemask[0] | node->bytemask[1] | node->bytemask[2] | node->bytemask[3]);
 }
 
+__inline int node_child_count(const ByteNode* node)
+{
+	return popcount64(node->bytemask[0]) + popcount64(node->bytemask[1]) + popcount64(node->bytemask[2]) + popcount64(node->bytemask[3]);
+}
+
+//number of keys below a node at level (1 for leaves)
+__inline uint32_t node_population(const ByteNode* node, int level)
+{
+	return (level == 1) ? uint32_t(node_child_count(node)) : node->population;
+}
+
+//first set bit of the node at or after from, -1 if there is none
+__inline int node_next_set_bit(const ByteNode* node, int from)
+{
+	for (int word = from >> 6; word < 4; word++)
+	{
+		const uint64_t mask = (word == (from >> 6)) ? node->bytemask[word] & (~uint64_t(0) << (from & 0x3F)) : node->bytemask[word];
+		if (mask != 0)
+		{
+			return word * 64 + countr_zero64(mask);
+		}
+	}
+	return -1;
+}
+
+//slot that holds the value of index, the number of set bits before index on compact nodes
+__inline int node_slot(const ByteNode* node, const uint8_t index)
+{
+	if (node->kind == node_kind_full)
+	{
+		return index;
+	}
+
+	const uint8_t idx = (index >> 6);
+	const uint64_t below = (uint64_t(0x1) << (index & 0x3F)) - 1;
+
+	int rank = popcount64(node->bytemask[idx] & below);
+	for (int i = 0; i < idx; i++)
+	{
+		rank += popcount64(node->bytemask[i]);
+	}
+	return rank;
+}
+
+template<typename V>
+__inline V* node_vals(ByteNode* node)
+{
+	static_assert(std::is_unsigned<V>::value && (sizeof(V) == 2 || sizeof(V) == 4 || sizeof(V) == 8), "leaf values are 16, 32 or 64 bit unsigned integers");
+
+	if constexpr (sizeof(V) == 2) return node->vals16;
+	else if constexpr (sizeof(V) == 4) return node->vals32;
+	else return node->vals;
+}
+template<typename V>
+__inline const V* node_vals(const ByteNode* node)
+{
+	return node_vals<V>(const_cast<ByteNode*>(node));
+}
+
+template<typename V>
+__inline V& node_val(ByteNode* node, const uint8_t index)
+{
+	return node_vals<V>(node)[node_slot(node, index)];
+}
+
+__inline ByteNode*& node_child(ByteNode* node, const uint8_t index)
+{
+	return node->childs[node_slot(node, index)];
+}
+
+//V is the type of the values stored in the leaves
+template<typename V = uint32_t>
 struct ByteTree
 {
 	ByteNode* root;
@@ -110,678 +307,3113 @@ struct ByteTree
 	char depth;
 };
 
+//size of a leaf value, trees of V = void have no values, only the leaf bitmasks
+template<typename V>
+constexpr uint8_t leaf_slot_bytes = uint8_t(sizeof(V));
+template<>
+constexpr uint8_t leaf_slot_bytes<void> = 0;
 
+//slot size of the nodes at a level of a tree, leaves are level 1
+template<typename V>
+__inline uint8_t tree_slot_bytes(int level)
+{
+	return level == 1 ? leaf_slot_bytes<V> : uint8_t(sizeof(ByteNode*));
+}
 
-static ByteNode node_pool[256 * 256 * 10];
-int node_pool_index = 0;
 
-int allocations = 0;
-ByteNode* allocate_treenode()
-{
-	allocations++;
-	ByteNode* node = &node_pool[node_pool_index++];//new ByteNode();
 
-	memset(node, 0, sizeof(ByteNode));
+//nodes are allocated from 256kb chunks aligned to their own size, so the owning chunk of a node is found by masking its address.
+//every node kind and slot size has its own arena, as they are all different sizes
+constexpr size_t node_chunk_bytes = 256 * 1024;
 
-	return node;
-}
+struct NodeArena;
 
-int deletions = 0;
-void free_treenode(ByteNode* node)
+struct NodeChunk
 {
-	deletions++;
-	//delete node;
-	//delete node;
-}
+	NodeArena* arena;
+
+	//links in the list of chunks that still have free nodes
+	NodeChunk* next;
+	NodeChunk* prev;
+	//links in the list of every chunk owned by the arena
+	NodeChunk* all_next;
+	NodeChunk* all_prev;
+
+	//recycled nodes, linked through their first 8 bytes
+	ByteNode* free_list;
+	//nodes that were never handed out start at this offset
+	uint32_t bump_index;
+	uint32_t used;
+};
+
+constexpr size_t node_chunk_header = (sizeof(NodeChunk) + 63) & ~size_t(63);
 
-ByteTree create_bytetree()
+struct NodeArena
 {
-	ByteTree tree;
-	tree.capacity = 256 ^ 3;
-	tree.root = allocate_treenode();
-	tree.depth = 3;
-	return tree;
+	size_t node_bytes = 0;
+	uint32_t nodes_per_chunk = 0;
+
+	NodeChunk* free_chunks = nullptr;
+	NodeChunk* all_chunks = nullptr;
+	//a single fully empty chunk is kept around so a node being freed and allocated again doesnt hit the OS every time
+	NodeChunk* spare_chunk = nullptr;
+
+	size_t chunk_count = 0;
+	size_t live_nodes = 0;
+};
+
+NodeArena make_node_arena(uint8_t kind, uint8_t slot_bytes)
+{
+	NodeArena arena;
+	arena.node_bytes = node_bytes(kind, slot_bytes);
+	arena.nodes_per_chunk = uint32_t((node_chunk_bytes - node_chunk_header) / arena.node_bytes);
+	return arena;
 }
 
-void grow_tree(ByteTree* tree, uint32_t new_capacity)
+NodeArena node_arenas[node_width_count][node_kind_count] = {
+	{ make_node_arena(0, 0), make_node_arena(1, 0), make_node_arena(2, 0), make_node_arena(3, 0) },
+	{ make_node_arena(0, 2), make_node_arena(1, 2), make_node_arena(2, 2), make_node_arena(3, 2) },
+	{ make_node_arena(0, 4), make_node_arena(1, 4), make_node_arena(2, 4), make_node_arena(3, 4) },
+	{ make_node_arena(0, 8), make_node_arena(1, 8), make_node_arena(2, 8), make_node_arena(3, 8) }
+};
+
+NodeChunk* allocate_node_chunk(NodeArena* arena)
 {
-	int level = 1;
-	if (new_capacity >= 256 && new_capacity < 256 * 256)
+#ifdef _WIN32
+	void* memory = nullptr;
+	while (!memory)
 	{
-		level = 2;
-
+		//reserve a bigger range to find an aligned address, then map exactly there
+		void* reserved = VirtualAlloc(nullptr, node_chunk_bytes * 2, MEM_RESERVE, PAGE_NOACCESS);
+		if (!reserved)
+		{
+			throw std::bad_alloc();
+		}
+		uintptr_t aligned = (uintptr_t(reserved) + node_chunk_bytes - 1) & ~uintptr_t(node_chunk_bytes - 1);
+		VirtualFree(reserved, 0, MEM_RELEASE);
+		memory = VirtualAlloc((void*)aligned, node_chunk_bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
 	}
-	else if (new_capacity >= 256 * 256 && new_capacity < 256 * 256 * 256)
+#else
+	uint8_t* reserved = (uint8_t*)mmap(nullptr, node_chunk_bytes * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	//out of memory is reported like a failed new
+	if (reserved == MAP_FAILED)
 	{
-		level = 3;
+		throw std::bad_alloc();
 	}
 
-	while (tree->depth < level)
+	uint8_t* memory = (uint8_t*)((uintptr_t(reserved) + node_chunk_bytes - 1) & ~uintptr_t(node_chunk_bytes - 1));
+
+	//trim the unaligned head and tail
+	if (memory != reserved)
 	{
-		ByteNode* child = tree->root;
-		ByteNode* newroot = allocate_treenode();
-		newroot->childs[0] = child;
-		set_node_mask_at(newroot, 0);
-		tree->root = newroot;
-		tree->capacity = 256 ^ level;
-		tree->depth++;
+		munmap(reserved, memory - reserved);
 	}
+	munmap(memory + node_chunk_bytes, (reserved + node_chunk_bytes * 2) - (memory + node_chunk_bytes));
+#endif
+	arena->chunk_count++;
+
+	NodeChunk* chunk = (NodeChunk*)memory;
+	chunk->arena = arena;
+	chunk->next = nullptr;
+	chunk->prev = nullptr;
+	chunk->free_list = nullptr;
+	chunk->bump_index = 0;
+	chunk->used = 0;
+
+	chunk->all_prev = nullptr;
+	chunk->all_next = arena->all_chunks;
+	if (arena->all_chunks)
+	{
+		arena->all_chunks->all_prev = chunk;
+	}
+	arena->all_chunks = chunk;
+	return chunk;
 }
 
-
-void add_tree_val(ByteTree* tree, uint32_t index, uint64_t value)
+void release_node_chunk(NodeChunk* chunk)
 {
-	if (index >= tree->capacity)
+	NodeArena* arena = chunk->arena;
+	arena->chunk_count--;
+
+	if (chunk->all_prev)
 	{
-		grow_tree(tree, index);
+		chunk->all_prev->all_next = chunk->all_next;
 	}
-
-	int level = tree->depth;
-	ByteNode* node = tree->root;
-
-	while (true)
+	else
 	{
-		int shift = 8 * (level - 1);
-		uint32_t shifted = (index >> shift) & 0xFF;
-
-		if (get_node_mask_at(node, shifted))
-		{
-			if (level == 1)
-			{
-				node->vals[shifted] = value;
-				return;
-			}
-			else
-			{
-				level--;
-				node = node->childs[shifted];
-			}
-		}
-		else
-		{
-			set_node_mask_at(node, shifted);
-			if (level == 1)
-			{
-				node->vals[shifted] = value;
-				return;
-			}
-			else
-			{
-				level--;
-				node->childs[shifted] = allocate_treenode();
-				node = node->childs[shifted];
-			}
-		}
+		arena->all_chunks = chunk->all_next;
+	}
+	if (chunk->all_next)
+	{
+		chunk->all_next->all_prev = chunk->all_prev;
 	}
+#ifdef _WIN32
+	VirtualFree(chunk, 0, MEM_RELEASE);
+#else
+	munmap(chunk, node_chunk_bytes);
+#endif
 }
 
-bool get_tree_val(const ByteTree* tree, uint32_t index, uint64_t& value)
+__inline NodeChunk* get_node_chunk(ByteNode* node)
 {
-	int level = tree->depth;
-	ByteNode* node = tree->root;
+	return (NodeChunk*)(uintptr_t(node) & ~uintptr_t(node_chunk_bytes - 1));
+}
 
-	while (true)
+void link_free_chunk(NodeChunk* chunk)
+{
+	NodeArena* arena = chunk->arena;
+	chunk->prev = nullptr;
+	chunk->next = arena->free_chunks;
+	if (arena->free_chunks)
 	{
-		int shift = 8 * (level - 1);
-		uint32_t shifted = (index >> shift) & 0xFF;
-
-		if (get_node_mask_at(node, shifted))
-		{
-			if (level == 1)
-			{
-				value = node->vals[shifted];
-				return true;
-			}
-			else
-			{
-				level--;
-				node = node->childs[shifted];
-			}
-		}
-		else
-		{
-			return false;
-		}
+		arena->free_chunks->prev = chunk;
 	}
+	arena->free_chunks = chunk;
 }
 
-bool remove_tree_recursive(ByteNode* node, uint32_t index, int level, bool& clear_parent)
+void unlink_free_chunk(NodeChunk* chunk)
 {
-	int shift = 8 * (level - 1);
-	uint32_t shifted = (index >> shift) & 0xFF;
-
-	if (level == 1)
+	NodeArena* arena = chunk->arena;
+	if (chunk->prev)
 	{
-		clear_node_mask_at(node, shifted);
-
-		if (is_node_empty(node))
-		{
-			clear_parent = true;
-		}
-
-		return true;
+		chunk->prev->next = chunk->next;
 	}
-	else if (get_node_mask_at(node, shifted))
+	else
 	{
-		bool bclear = false;
-
-		bool bfound = remove_tree_recursive(node->childs[shifted], index, level - 1, bclear);
-
-		if (bclear)
-		{
-			free_treenode(node->childs[shifted]);
-			clear_node_mask_at(node, shifted);
-
-			if (is_node_empty(node))
-			{
-				clear_parent = true;
-			}
-		}
-		return bfound;
+		arena->free_chunks = chunk->next;
 	}
-	else
+	if (chunk->next)
 	{
-		return false;
+		chunk->next->prev = chunk->prev;
 	}
+	chunk->next = nullptr;
+	chunk->prev = nullptr;
 }
-#include <immintrin.h>
-__inline void merge_bitmasks(uint64_t** bitmasks, uint64_t* out, uint8_t nbitmasks, uint8_t count)
+
+int allocations = 0;
+ByteNode* allocate_treenode(uint8_t kind = node_kind_full, uint8_t slot_bytes = sizeof(uint64_t))
 {
-#if 1
-	for (int i = 0; i < count; i++)
+	allocations++;
+
+	//nodes without slots are the same size for every kind, so they are always full and never resized
+	if (slot_bytes == 0)
 	{
-		out[i] = bitmasks[0][i];
+		kind = node_kind_full;
 	}
 
-	for (int m = 1; m < nbitmasks; m++)
+	NodeArena* arena = &node_arenas[node_width_index(slot_bytes)][kind];
+	NodeChunk* chunk = arena->free_chunks;
+	if (!chunk)
 	{
-		for (int i = 0; i < count; i++)
+		if (arena->spare_chunk)
 		{
-			out[i] &= bitmasks[m][i];
+			chunk = arena->spare_chunk;
+			arena->spare_chunk = nullptr;
 		}
+		else
+		{
+			chunk = allocate_node_chunk(arena);
+		}
+		link_free_chunk(chunk);
 	}
-#else
-	__m256i accum = _mm256_load_si256((__m256i*)bitmasks[0]);
 
-	for (int m = 1; m < nbitmasks; m++)
+	ByteNode* node;
+	if (chunk->free_list)
 	{
-		__m256i accum2 = _mm256_load_si256((__m256i*)bitmasks[m]);
+		node = chunk->free_list;
+		chunk->free_list = *(ByteNode**)node;
+	}
+	else
+	{
+		node = (ByteNode*)((uint8_t*)chunk + node_chunk_header + chunk->bump_index * arena->node_bytes);
+		chunk->bump_index++;
+	}
 
-		accum = _mm256_and_si256(accum, accum2);
+	chunk->used++;
+	if (chunk->used == arena->nodes_per_chunk)
+	{
+		unlink_free_chunk(chunk);
 	}
-	//*(__m256i*(out)) = accum;
-	_mm256_store_si256((__m256i*)out, accum);
-#endif
-}
+	arena->live_nodes++;
 
+	memset(node, 0, arena->node_bytes);
+	node->kind = kind;
+	node->slot_bytes = slot_bytes;
 
-template<typename F>
-void iterate_joined_recursive(ByteNode** nodes, int nodecount, int depth, F function)
+	return node;
+}
+
+int deletions = 0;
+void free_treenode(ByteNode* node)
 {
-	uint64_t* bitmasks[10];
+	deletions++;
 
-	for (int i = 0; i < nodecount; i++)
+	NodeChunk* chunk = get_node_chunk(node);
+	NodeArena* arena = chunk->arena;
+
+	if (chunk->used == arena->nodes_per_chunk)
 	{
-		bitmasks[i] = &nodes[i]->bytemask[0];
+		link_free_chunk(chunk);
 	}
-	uint64_t out_bitmask[4];
-	merge_bitmasks(&bitmasks[0], &out_bitmask[0], nodecount, 4);
-
-	if (depth == 1)
-	{
-		//uint64_t* bitmasks[10];
-		//
-		//for(int i = 0; i < nodecount; i++)
-		//{
-		//	bitmasks[i] = &nodes[i]->bytemask[0];
-		//}
-		//uint64_t out_bitmask[4];
-		//merge_bitmasks(&bitmasks[0], &out_bitmask[0], nodecount, 4);
-		//
-		//int count = 4;
-		//for(int idx = 0; idx < count; idx++)
-		//{
-		//	const int begin = idx * 64;
-		//	if(out_bitmask[idx] != 0)
-		//	{
-		//		for(int i = 0; i < 64; i++)
-		//		{
-		//			uint64_t mask = (uint64_t(0x1) << i);
-		//
-		//			if(out_bitmask[idx] & mask)
-		//			{
-		//				//function();
-		//				function(begin + i, nodes);
-		//			}
-		//		}
-		//	}
-		//}
-#ifndef _PERF_TRYHARD
-		bitmask_optimal_iterate(&out_bitmask[0], 4, [&function, &nodes](uint32_t index) {
+	chunk->used--;
+	arena->live_nodes--;
+
+	*(ByteNode**)node = chunk->free_list;
+	chunk->free_list = node;
+
+	if (chunk->used == 0)
+	{
+		//the chunk is empty, keep one around and give the rest back to the OS
+		unlink_free_chunk(chunk);
+		chunk->free_list = nullptr;
+		chunk->bump_index = 0;
+
+		if (arena->spare_chunk)
+		{
+			release_node_chunk(chunk);
+		}
+		else
+		{
+			arena->spare_chunk = chunk;
+		}
+	}
+}
+
+//releases every chunk at once, all trees allocated before are invalid after this
+void reset_node_arena()
+{
+	for (NodeArena* arenas : node_arenas)
+	{
+		for (int kind = 0; kind < node_kind_count; kind++)
+		{
+			NodeArena& arena = arenas[kind];
+			while (arena.all_chunks)
+			{
+				release_node_chunk(arena.all_chunks);
+			}
+			arena.free_chunks = nullptr;
+			arena.spare_chunk = nullptr;
+			arena.live_nodes = 0;
+		}
+	}
+}
+
+size_t node_arena_live_nodes()
+{
+	size_t count = 0;
+	for (const NodeArena* arenas : node_arenas)
+	{
+		for (int kind = 0; kind < node_kind_count; kind++)
+		{
+			count += arenas[kind].live_nodes;
+		}
+	}
+	return count;
+}
+
+//bytes used by live nodes, not counting the unused parts of the chunks
+size_t node_arena_live_bytes()
+{
+	size_t bytes = 0;
+	for (const NodeArena* arenas : node_arenas)
+	{
+		for (int kind = 0; kind < node_kind_count; kind++)
+		{
+			bytes += arenas[kind].live_nodes * arenas[kind].node_bytes;
+		}
+	}
+	return bytes;
+}
+
+size_t node_arena_chunk_bytes()
+{
+	size_t bytes = 0;
+	for (const NodeArena* arenas : node_arenas)
+	{
+		for (int kind = 0; kind < node_kind_count; kind++)
+		{
+			bytes += arenas[kind].chunk_count * node_chunk_bytes;
+		}
+	}
+	return bytes;
+}
+
+//copies the slots of node into resized when one of them is a full node, so slots move between rank and index order
+template<typename V>
+void copy_resized_slots(const ByteNode* node, ByteNode* resized)
+{
+	const V* vals = node_vals<V>(node);
+	V* resized_vals = node_vals<V>(resized);
+
+	int rank = 0;
+	bitmask_optimal_iterate(&node->bytemask[0], 4, [&](uint32_t index) {
+		V value = (node->kind == node_kind_full) ? vals[index] : vals[rank];
+		if (resized->kind == node_kind_full)
+		{
+			resized_vals[index] = value;
+		}
+		else
+		{
+			resized_vals[rank] = value;
+		}
+		rank++;
+	});
+}
+
+//moves the node to a node of a different kind, returns the new node. The old one is freed
+ByteNode* resize_treenode(ByteNode* node, uint8_t kind)
+{
+	ByteNode* resized = allocate_treenode(kind, node->slot_bytes);
+	memcpy(resized->bytemask, node->bytemask, sizeof(node->bytemask));
+	resized->population = node->population;
+
+	if (node->kind != node_kind_full && kind != node_kind_full)
+	{
+		memcpy(resized->vals, node->vals, node_child_count(node) * node->slot_bytes);
+	}
+	else
+	{
+		switch (node->slot_bytes)
+		{
+		case 2: copy_resized_slots<uint16_t>(node, resized); break;
+		case 4: copy_resized_slots<uint32_t>(node, resized); break;
+		default: copy_resized_slots<uint64_t>(node, resized); break;
+		}
+	}
+
+	free_treenode(node);
+	return resized;
+}
+
+//sets the bit of index and makes space for its slot, promoting the node if its full. Returns the node, which might have moved
+ByteNode* insert_node_slot(ByteNode* node, const uint8_t index)
+{
+	if (node->kind != node_kind_full)
+	{
+		const int count = node_child_count(node);
+		if (count == node_capacities[node->kind])
+		{
+			node = resize_treenode(node, node->kind + 1);
+		}
+		if (node->kind != node_kind_full)
+		{
+			const int slot = node_slot(node, index);
+			uint8_t* slots = (uint8_t*)node->vals;
+			memmove(slots + (slot + 1) * node->slot_bytes, slots + slot * node->slot_bytes, (count - slot) * node->slot_bytes);
+			memset(slots + slot * node->slot_bytes, 0, node->slot_bytes);
+		}
+	}
+	set_node_mask_at(node, index);
+	return node;
+}
+
+//clears the bit of index and closes the gap of its slot, demoting the node once its less than half used. Returns the node, which might have moved
+ByteNode* remove_node_slot(ByteNode* node, const uint8_t index)
+{
+	if (node->kind != node_kind_full)
+	{
+		const int count = node_child_count(node);
+		const int slot = node_slot(node, index);
+		uint8_t* slots = (uint8_t*)node->vals;
+		memmove(slots + slot * node->slot_bytes, slots + (slot + 1) * node->slot_bytes, (count - slot - 1) * node->slot_bytes);
+	}
+	clear_node_mask_at(node, index);
+
+	const int count = node_child_count(node);
+	if (node->kind > 0 && node->slot_bytes > 0 && count > 0 && count * 2 <= node_capacities[node->kind - 1])
+	{
+		node = resize_treenode(node, node->kind - 1);
+	}
+	return node;
+}
+
+template<typename V = uint32_t>
+ByteTree<V> create_bytetree()
+{
+	ByteTree<V> tree;
+	tree.capacity = 256 ^ 3;
+	tree.root = allocate_treenode(0);
+	tree.depth = 3;
+	return tree;
+}
+
+//copies the slots of a leaf into a full 256 entry array, indexed by key
+template<typename V>
+void unpack_node_vals(const ByteNode* node, V* vals)
+{
+	const V* node_values = node_vals<V>(node);
+	if (node->kind == node_kind_full)
+	{
+		memcpy(vals, node_values, 256 * sizeof(V));
+	}
+	else
+	{
+		int rank = 0;
+		bitmask_optimal_iterate(&node->bytemask[0], 4, [&](uint32_t index) {
+			vals[index] = node_values[rank++];
+		});
+	}
+}
+
+//replaces the bitmask of node and fills its slots from a full 256 entry array, moving it to the smallest kind that fits.
+//Returns the node, which might have moved
+template<typename V>
+ByteNode* pack_node_vals(ByteNode* node, const uint64_t* bitmask, const V* vals)
+{
+	const int count = popcount64(bitmask[0]) + popcount64(bitmask[1]) + popcount64(bitmask[2]) + popcount64(bitmask[3]);
+
+	uint8_t kind = 0;
+	while (node_capacities[kind] < count)
+	{
+		kind++;
+	}
+	if (kind != node->kind)
+	{
+		free_treenode(node);
+		node = allocate_treenode(kind, sizeof(V));
+	}
+
+	V* node_values = node_vals<V>(node);
+	memcpy(node->bytemask, bitmask, sizeof(node->bytemask));
+	if (kind == node_kind_full)
+	{
+		memcpy(node_values, vals, 256 * sizeof(V));
+	}
+	else
+	{
+		int rank = 0;
+		bitmask_optimal_iterate(&node->bytemask[0], 4, [&](uint32_t index) {
+			node_values[rank++] = vals[index];
+		});
+	}
+	return node;
+}
+
+template<typename V>
+void grow_tree(ByteTree<V>* tree, uint32_t new_capacity)
+{
+	int level = 1;
+	if (new_capacity >= 256 && new_capacity < 256 * 256)
+	{
+		level = 2;
+
+	}
+	else if (new_capacity >= 256 * 256 && new_capacity < 256 * 256 * 256)
+	{
+		level = 3;
+	}
+
+	while (tree->depth < level)
+	{
+		ByteNode* child = tree->root;
+		ByteNode* newroot = allocate_treenode(0);
+		set_node_mask_at(newroot, 0);
+		node_child(newroot, 0) = child;
+		newroot->population = node_population(child, tree->depth);
+		tree->root = newroot;
+		tree->capacity = 256 ^ level;
+		tree->depth++;
+	}
+}
+
+
+template<typename V>
+void add_tree_val(ByteTree<V>* tree, uint32_t index, uint64_t value)
+{
+	assert(value <= std::numeric_limits<V>::max());
+
+	if (index >= tree->capacity)
+	{
+		grow_tree(tree, index);
+	}
+
+	int level = tree->depth;
+	ByteNode** link = &tree->root;
+	ByteNode* node = tree->root;
+
+	//inner nodes on the way down, their population grows if index is new
+	ByteNode* parents[4];
+	int nparents = 0;
+
+	while (true)
+	{
+		int shift = 8 * (level - 1);
+		uint32_t shifted = (index >> shift) & 0xFF;
+
+		if (get_node_mask_at(node, shifted))
+		{
+			if (level == 1)
+			{
+				node_val<V>(node, shifted) = V(value);
+				return;
+			}
+			else
+			{
+				parents[nparents++] = node;
+				level--;
+				link = &node_child(node, shifted);
+				node = *link;
+			}
+		}
+		else
+		{
+			node = insert_node_slot(node, shifted);
+			*link = node;
+			if (level == 1)
+			{
+				node_val<V>(node, shifted) = V(value);
+				for (int i = 0; i < nparents; i++)
+				{
+					parents[i]->population++;
+				}
+				return;
+			}
+			else
+			{
+				parents[nparents++] = node;
+				level--;
+				link = &node_child(node, shifted);
+				*link = allocate_treenode(0, tree_slot_bytes<V>(level));
+				node = *link;
+			}
+		}
+	}
+}
+
+//returns the link to the leaf node that holds index, creating the path to it if needed. The leaf may be empty.
+//If parents is set, it gets the depth - 1 inner nodes of the path from the root down, to update their population
+template<typename V>
+ByteNode** find_or_add_tree_leaf(ByteTree<V>* tree, uint32_t index, ByteNode** parents = nullptr)
+{
+	if (index >= tree->capacity)
+	{
+		grow_tree(tree, index);
+	}
+
+	int level = tree->depth;
+	ByteNode** link = &tree->root;
+
+	while (level > 1)
+	{
+		int shift = 8 * (level - 1);
+		uint32_t shifted = (index >> shift) & 0xFF;
+
+		ByteNode* node = *link;
+		if (get_node_mask_at(node, shifted))
+		{
+			link = &node_child(node, shifted);
+		}
+		else
+		{
+			node = insert_node_slot(node, shifted);
+			*link = node;
+			link = &node_child(node, shifted);
+			*link = allocate_treenode(0, tree_slot_bytes<V>(level - 1));
+		}
+		if (parents)
+		{
+			*parents++ = node;
+		}
+		level--;
+	}
+	return link;
+}
+
+//returns the link to the leaf node that holds index, or null if there is none. parents as in find_or_add_tree_leaf
+template<typename V>
+ByteNode** find_tree_leaf(ByteTree<V>* tree, uint32_t index, ByteNode** parents = nullptr)
+{
+	int level = tree->depth;
+	ByteNode** link = &tree->root;
+
+	while (level > 1)
+	{
+		int shift = 8 * (level - 1);
+		uint32_t shifted = (index >> shift) & 0xFF;
+
+		if (!get_node_mask_at(*link, shifted))
+		{
+			return nullptr;
+		}
+		if (parents)
+		{
+			*parents++ = *link;
+		}
+		link = &node_child(*link, shifted);
+		level--;
+	}
+	return link;
+}
+
+//adds delta to the population of the inner nodes of a path, as find_or_add_tree_leaf returns them.
+//For the paths that edit a leaf bitmask directly
+template<typename V>
+__inline void add_tree_population(const ByteTree<V>* tree, ByteNode* const* parents, int32_t delta)
+{
+	for (int i = 0; i < tree->depth - 1; i++)
+	{
+		parents[i]->population += uint32_t(delta);
+	}
+}
+
+//trees of V = void store no values, an index is in the tree if its bit is set in the leaf.
+//remove_tree_val works on them as on any other tree. Returns false if the key was there already
+__inline bool add_tree_key(ByteTree<void>* tree, uint32_t index)
+{
+	ByteNode* parents[4];
+	ByteNode* leaf = *find_or_add_tree_leaf(tree, index, parents);
+	if (get_node_mask_at(leaf, index & 0xFF))
+	{
+		return false;
+	}
+	set_node_mask_at(leaf, index & 0xFF);
+	add_tree_population(tree, parents, 1);
+	return true;
+}
+
+__inline bool has_tree_key(const ByteTree<void>* tree, uint32_t index)
+{
+	ByteNode** leaf = find_tree_leaf(const_cast<ByteTree<void>*>(tree), index);
+	return leaf && get_node_mask_at(*leaf, index & 0xFF);
+}
+
+//the leaf that holds index, null if the tree has no leaf there
+template<typename V>
+__inline ByteNode* find_tree_leaf_node(ByteTree<V>* tree, uint32_t index)
+{
+	ByteNode** leaf = find_tree_leaf(tree, index);
+	return leaf ? *leaf : nullptr;
+}
+
+//number of leaves of a tree, only the inner nodes are read
+template<typename V>
+size_t tree_leaf_count(const ByteTree<V>* tree)
+{
+	size_t count = 0;
+	bitmask_optimal_iterate(&tree->root->bytemask[0], 4, [&](uint32_t index) {
+		const ByteNode* mid = node_child(tree->root, uint8_t(index));
+		count += popcount64(mid->bytemask[0]) + popcount64(mid->bytemask[1]) + popcount64(mid->bytemask[2]) + popcount64(mid->bytemask[3]);
+	});
+	return count;
+}
+
+ByteNode* find_next_leaf_recursive(ByteNode* node, uint32_t index, int level, uint32_t& leaf_index)
+{
+	if (level == 1)
+	{
+		leaf_index = index & ~uint32_t(0xFF);
+		return node;
+	}
+
+	const int shift = 8 * (level - 1);
+	const int from = (index >> shift) & 0xFF;
+	for (int key = node_next_set_bit(node, from); key >= 0; key = (key < 255) ? node_next_set_bit(node, key + 1) : -1)
+	{
+		//past the slot of index, the subtree is visited from its start
+		const uint32_t child_index = (key == from) ? index : ((index >> (shift + 8)) << (shift + 8)) | (uint32_t(key) << shift);
+
+		ByteNode* leaf = find_next_leaf_recursive(node_child(node, key), child_index, level - 1, leaf_index);
+		if (leaf)
+		{
+			return leaf;
+		}
+	}
+	return nullptr;
+}
+
+//returns the first leaf that holds indices at or after index, in tree order, or null if there is none.
+//leaf_index is set to the first index of the leaf
+template<typename V>
+ByteNode* find_next_tree_leaf(const ByteTree<V>* tree, uint32_t index, uint32_t& leaf_index)
+{
+	return find_next_leaf_recursive(tree->root, index, tree->depth, leaf_index);
+}
+
+//position at a key of a tree. It keeps the nodes on the path to it, so moving forward only climbs
+//as far as the first node that has a later key, then goes down taking the lowest key on every level
+template<typename V>
+struct TreeCursor
+{
+	//nodes[level] is the node of that level on the path to index, nodes[1] the leaf
+	ByteNode* nodes[4];
+	uint32_t index;
+	int depth;
+	//set once there are no more keys
+	bool bend;
+};
+
+//moves the cursor to the first key at or after index, searching from the node at level, which has to contain index
+template<typename V>
+bool tree_cursor_find(TreeCursor<V>* cursor, int level, uint64_t index)
+{
+	while (true)
+	{
+		const int shift = 8 * (level - 1);
+		const int from = int(index >> shift) & 0xFF;
+		const int key = node_next_set_bit(cursor->nodes[level], from);
+		if (key < 0)
+		{
+			//nothing left in this node, continue at the start of the next subtree of the parent, climbing further if that carries out of it
+			const uint64_t next = ((index >> (shift + 8)) + 1) << (shift + 8);
+			do
+			{
+				if (level == cursor->depth)
+				{
+					cursor->bend = true;
+					return false;
+				}
+				level++;
+			} while ((next >> (8 * level)) != (index >> (8 * level)));
+			index = next;
+			continue;
+		}
+		if (key != from)
+		{
+			index = ((index >> (shift + 8)) << (shift + 8)) | (uint64_t(key) << shift);
+		}
+		if (level == 1)
+		{
+			cursor->index = uint32_t(index);
+			return true;
+		}
+		cursor->nodes[level - 1] = node_child(cursor->nodes[level], uint8_t(key));
+		level--;
+	}
+}
+
+//cursor at the first key of the tree at or after index
+template<typename V>
+TreeCursor<V> tree_lower_bound(const ByteTree<V>* tree, uint32_t index)
+{
+	TreeCursor<V> cursor;
+	cursor.nodes[int(tree->depth)] = tree->root;
+	cursor.index = 0;
+	cursor.depth = tree->depth;
+	cursor.bend = false;
+	tree_cursor_find(&cursor, tree->depth, index);
+	return cursor;
+}
+
+//moves the cursor to the next key, returns false once it runs out
+template<typename V>
+bool tree_cursor_next(TreeCursor<V>* cursor)
+{
+	if (cursor->bend)
+	{
+		return false;
+	}
+	const uint64_t index = uint64_t(cursor->index) + 1;
+
+	//climb to the lowest node whose subtree still contains index
+	int level = 1;
+	while ((index >> (8 * level)) != (cursor->index >> (8 * level)))
+	{
+		if (level == cursor->depth)
+		{
+			cursor->bend = true;
+			return false;
+		}
+		level++;
+	}
+	return tree_cursor_find(cursor, level, index);
+}
+
+template<typename V>
+__inline V tree_cursor_value(const TreeCursor<V>& cursor)
+{
+	return node_val<V>(cursor.nodes[1], uint8_t(cursor.index));
+}
+
+struct TreeRangeEnd {};
+
+//keys of a tree in [first, last), so they can be walked with range-for:
+//for (const TreeCursor<V>& cursor : tree_range(&tree, first, last)) { cursor.index, tree_cursor_value(cursor) }
+template<typename V>
+struct TreeRange
+{
+	struct Iterator
+	{
+		TreeCursor<V> cursor;
+		uint32_t last;
+
+		const TreeCursor<V>& operator*() const { return cursor; }
+		Iterator& operator++()
+		{
+			tree_cursor_next(&cursor);
+			return *this;
+		}
+		bool operator!=(TreeRangeEnd) const { return !cursor.bend && cursor.index < last; }
+	};
+
+	const ByteTree<V>* tree;
+	uint32_t first;
+	uint32_t last;
+
+	Iterator begin() const { return Iterator{ tree_lower_bound(tree, first), last }; }
+	TreeRangeEnd end() const { return {}; }
+};
+
+template<typename V>
+TreeRange<V> tree_range(const ByteTree<V>* tree, uint32_t first, uint32_t last)
+{
+	return TreeRange<V>{ tree, first, last };
+}
+
+template<typename V>
+bool get_tree_val(const ByteTree<V>* tree, uint32_t index, uint64_t& value)
+{
+	int level = tree->depth;
+	ByteNode* node = tree->root;
+
+	while (true)
+	{
+		int shift = 8 * (level - 1);
+		uint32_t shifted = (index >> shift) & 0xFF;
+
+		if (get_node_mask_at(node, shifted))
+		{
+			if (level == 1)
+			{
+				value = node_val<V>(node, shifted);
+				return true;
+			}
+			else
+			{
+				level--;
+				node = node_child(node, shifted);
+			}
+		}
+		else
+		{
+			return false;
+		}
+	}
+}
+
+//node is updated if removing the value moves it to a smaller kind
+bool remove_tree_recursive(ByteNode*& node, uint32_t index, int level, bool& clear_parent)
+{
+	int shift = 8 * (level - 1);
+	uint32_t shifted = (index >> shift) & 0xFF;
+
+	if (!get_node_mask_at(node, shifted))
+	{
+		return false;
+	}
+	else if (level == 1)
+	{
+		node = remove_node_slot(node, shifted);
+
+		if (is_node_empty(node))
+		{
+			clear_parent = true;
+		}
+
+		return true;
+	}
+	else
+	{
+		bool bclear = false;
+
+		bool bfound = remove_tree_recursive(node_child(node, shifted), index, level - 1, bclear);
+
+		if (bclear)
+		{
+			free_treenode(node_child(node, shifted));
+			node = remove_node_slot(node, shifted);
+
+			if (is_node_empty(node))
+			{
+				clear_parent = true;
+			}
+		}
+		if (bfound)
+		{
+			node->population--;
+		}
+		return bfound;
+	}
+}
+#ifdef _MSC_VER
+#define BYTECS_TARGET(isa)
+#else
+#define BYTECS_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+enum SimdLevel : int
+{
+	SIMD_SCALAR = 0,
+	SIMD_SSE42 = 1,
+	SIMD_AVX2 = 2,
+	SIMD_AVX512 = 3
+};
+
+SimdLevel detect_simd_level()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	const int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	const bool sse42 = (info[2] & (1 << 20)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+
+	//the OS also has to save the ymm and zmm registers on context switch
+	const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	const bool os_avx = (xcr0 & 0x6) == 0x6;
+	const bool os_avx512 = (xcr0 & 0xE6) == 0xE6;
+
+	bool avx2 = false;
+	bool avx512 = false;
+	if (max_leaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+		avx512 = (info[1] & (1 << 16)) != 0;
+	}
+
+	if (avx512 && avx && os_avx512) return SIMD_AVX512;
+	if (avx2 && avx && os_avx) return SIMD_AVX2;
+	if (sse42) return SIMD_SSE42;
+	return SIMD_SCALAR;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+	if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse4.2")) return SIMD_SSE42;
+	return SIMD_SCALAR;
+#endif
+}
+
+//kernel set used by merge_bitmasks, detected once at startup. Can be lowered to test the other kernels
+SimdLevel simd_level = detect_simd_level();
+
+//the merge kernels AND together nbitmasks 256 bit masks into out, returning false if the result is all zero.
+//they stop loading masks as soon as the accumulated mask is empty.
+//N is the number of masks when known at compile time, 0 otherwise
+template<int N>
+bool merge_bitmasks_scalar(const uint64_t* const* bitmasks, int nbitmasks, uint64_t* out)
+{
+	const int count = N > 0 ? N : nbitmasks;
+
+	uint64_t a0 = bitmasks[0][0], a1 = bitmasks[0][1], a2 = bitmasks[0][2], a3 = bitmasks[0][3];
+	for (int m = 1; m < count; m++)
+	{
+		if (!(a0 | a1 | a2 | a3)) break;
+
+		a0 &= bitmasks[m][0];
+		a1 &= bitmasks[m][1];
+		a2 &= bitmasks[m][2];
+		a3 &= bitmasks[m][3];
+	}
+	out[0] = a0;
+	out[1] = a1;
+	out[2] = a2;
+	out[3] = a3;
+	return (a0 | a1 | a2 | a3) != 0;
+}
+
+template<int N>
+BYTECS_TARGET("sse4.2")
+bool merge_bitmasks_sse42(const uint64_t* const* bitmasks, int nbitmasks, uint64_t* out)
+{
+	const int count = N > 0 ? N : nbitmasks;
+
+	__m128i lo = _mm_loadu_si128((const __m128i*)&bitmasks[0][0]);
+	__m128i hi = _mm_loadu_si128((const __m128i*)&bitmasks[0][2]);
+	for (int m = 1; m < count; m++)
+	{
+		const __m128i any = _mm_or_si128(lo, hi);
+		if (_mm_testz_si128(any, any)) break;
+
+		lo = _mm_and_si128(lo, _mm_loadu_si128((const __m128i*)&bitmasks[m][0]));
+		hi = _mm_and_si128(hi, _mm_loadu_si128((const __m128i*)&bitmasks[m][2]));
+	}
+	_mm_storeu_si128((__m128i*)&out[0], lo);
+	_mm_storeu_si128((__m128i*)&out[2], hi);
+
+	const __m128i any = _mm_or_si128(lo, hi);
+	return !_mm_testz_si128(any, any);
+}
+
+template<int N>
+BYTECS_TARGET("avx2")
+bool merge_bitmasks_avx2(const uint64_t* const* bitmasks, int nbitmasks, uint64_t* out)
+{
+	const int count = N > 0 ? N : nbitmasks;
+
+	__m256i accum = _mm256_loadu_si256((const __m256i*)bitmasks[0]);
+	for (int m = 1; m < count; m++)
+	{
+		if (_mm256_testz_si256(accum, accum)) break;
+
+		accum = _mm256_and_si256(accum, _mm256_loadu_si256((const __m256i*)bitmasks[m]));
+	}
+	_mm256_storeu_si256((__m256i*)out, accum);
+
+	return !_mm256_testz_si256(accum, accum);
+}
+
+//two masks per zmm register, the halves are merged at the end
+template<int N>
+BYTECS_TARGET("avx512f")
+bool merge_bitmasks_avx512(const uint64_t* const* bitmasks, int nbitmasks, uint64_t* out)
+{
+	const int count = N > 0 ? N : nbitmasks;
+
+	if (count < 2)
+	{
+		return merge_bitmasks_avx2<N>(bitmasks, nbitmasks, out);
+	}
+
+	__m512i accum = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_loadu_si256((const __m256i*)bitmasks[0])),
+		_mm256_loadu_si256((const __m256i*)bitmasks[1]), 1);
+
+	int m = 2;
+	for (; m + 1 < count; m += 2)
+	{
+		if (_mm512_test_epi64_mask(accum, accum) == 0) break;
+
+		const __m512i pair = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_loadu_si256((const __m256i*)bitmasks[m])),
+			_mm256_loadu_si256((const __m256i*)bitmasks[m + 1]), 1);
+		accum = _mm512_and_si512(accum, pair);
+	}
+
+	__m256i merged = _mm256_and_si256(_mm512_castsi512_si256(accum), _mm512_extracti64x4_epi64(accum, 1));
+	if (m < count)
+	{
+		merged = _mm256_and_si256(merged, _mm256_loadu_si256((const __m256i*)bitmasks[count - 1]));
+	}
+	_mm256_storeu_si256((__m256i*)out, merged);
+
+	return !_mm256_testz_si256(merged, merged);
+}
+
+typedef bool (*merge_bitmasks_fn)(const uint64_t* const* bitmasks, int nbitmasks, uint64_t* out);
+
+template<int N>
+constexpr merge_bitmasks_fn merge_bitmasks_kernels[] = {
+	&merge_bitmasks_scalar<N>,
+	&merge_bitmasks_sse42<N>,
+	&merge_bitmasks_avx2<N>,
+	&merge_bitmasks_avx512<N>
+};
+
+//ands nbitmasks bitmasks of count words into out, returns false if the result is empty
+__inline bool merge_bitmasks(uint64_t** bitmasks, uint64_t* out, uint8_t nbitmasks, uint8_t count)
+{
+	if (count == 4)
+	{
+		return merge_bitmasks_kernels<0>[simd_level](bitmasks, nbitmasks, out);
+	}
+
+	uint64_t any = 0;
+	for (int i = 0; i < count; i++)
+	{
+		out[i] = bitmasks[0][i];
+
+		for (int m = 1; m < nbitmasks; m++)
+		{
+			out[i] &= bitmasks[m][i];
+		}
+		any |= out[i];
+	}
+	return any != 0;
+}
+
+//merge_bitmasks for a fixed set of nodes, the kernel is instanced for the node count so its loop is unrolled
+template<size_t N>
+__inline bool merge_node_bitmasks(const std::array<ByteNode*, N>& nodes, uint64_t* out)
+{
+	const uint64_t* bitmasks[N];
+	for (size_t i = 0; i < N; i++)
+	{
+		bitmasks[i] = &nodes[i]->bytemask[0];
+	}
+	return merge_bitmasks_kernels<int(N)>[simd_level](bitmasks, int(N), out);
+}
+
+template<size_t N, size_t... I>
+__inline std::array<ByteNode*, N> gather_child_nodes(const std::array<ByteNode*, N>& nodes, uint32_t index, std::index_sequence<I...>)
+{
+	return { node_child(nodes[I], index)... };
+}
+
+//children of a set of nodes that may be missing, null where the node or the child doesnt exist
+template<size_t M>
+__inline std::array<ByteNode*, M> gather_optional_child_nodes(const std::array<ByteNode*, M>& nodes, uint32_t index)
+{
+	std::array<ByteNode*, M> children;
+	for (size_t i = 0; i < M; i++)
+	{
+		children[i] = (nodes[i] && get_node_mask_at(nodes[i], index)) ? node_child(nodes[i], index) : nullptr;
+	}
+	return children;
+}
+
+//ands out with the complement of the bitmasks of the exclude nodes, null nodes exclude nothing. Returns false if out is left empty
+template<size_t M>
+__inline bool exclude_node_bitmasks(const std::array<ByteNode*, M>& excludes, uint64_t* out)
+{
+	for (ByteNode* exclude : excludes)
+	{
+		if (exclude)
+		{
+			out[0] &= ~exclude->bytemask[0];
+			out[1] &= ~exclude->bytemask[1];
+			out[2] &= ~exclude->bytemask[2];
+			out[3] &= ~exclude->bytemask[3];
+		}
+	}
+	return (out[0] | out[1] | out[2] | out[3]) != 0;
+}
+
+//walks the intersection of N trees, calling function(base_index, leafnodes) for every set of leaf nodes that exist in all trees.
+//The M exclude trees are walked along, but only their leaves can remove entities: an inner bit means some index below it
+//is excluded, not all of them. With excludes, function is called as function(base_index, leafnodes, excludeleaves), missing leaves are null
+template<int Depth, size_t N, size_t M, typename F>
+void iterate_joined_recursive(const std::array<ByteNode*, N>& nodes, const std::array<ByteNode*, M>& excludes, uint32_t base_index, F& function)
+{
+	if constexpr (Depth == 1)
+	{
+		if constexpr (M == 0)
+		{
+			function(base_index, nodes);
+		}
+		else
+		{
+			function(base_index, nodes, excludes);
+		}
+	}
+	else
+	{
+		uint64_t out_bitmask[4];
+		if (!merge_node_bitmasks(nodes, &out_bitmask[0]))
+		{
+			//nothing in common, skip the subtree before touching the child pointers
+			return;
+		}
+
+		bitmask_optimal_iterate(&out_bitmask[0], 4, [&](uint32_t index) {
+
+			const std::array<ByteNode*, N> othernodes = gather_child_nodes(nodes, index, std::make_index_sequence<N>{});
+			const std::array<ByteNode*, M> otherexcludes = gather_optional_child_nodes(excludes, index);
+
+			iterate_joined_recursive<Depth - 1>(othernodes, otherexcludes, (base_index | index) << 8, function);
+		});
+	}
+}
+
+template<int Depth, size_t N, typename F>
+void iterate_joined_recursive(const std::array<ByteNode*, N>& nodes, uint32_t base_index, F& function)
+{
+	iterate_joined_recursive<Depth>(nodes, std::array<ByteNode*, 0>{}, base_index, function);
+}
+
+template<size_t N, typename V, typename F>
+void iterate_joined_trees(const std::array<ByteTree<V>*, N>& trees, F&& function)
+{
+	std::array<ByteNode*, N> rootnodes;
+
+	for (size_t i = 0; i < N; i++)
+	{
+		rootnodes[i] = trees[i]->root;
+	}
+
+	iterate_joined_recursive<3>(rootnodes, 0, function);
+}
+
+
+//sets the bits first..last of a 256 bit mask and clears the rest
+__inline void make_key_range_mask(int first, int last, uint64_t* mask)
+{
+	for (int word = 0; word < 4; word++)
+	{
+		const int lo = std::max(first - word * 64, 0);
+		const int hi = std::min(last - word * 64, 63);
+		mask[word] = (lo > hi) ? 0 : ((~uint64_t(0) >> (63 - hi)) & (~uint64_t(0) << lo));
+	}
+}
+
+//iterate_joined_recursive restricted to the indices first..last, both included. Only the subtrees that overlap the range are visited.
+//The leaf function gets one node more after the N of the trees, range_leaf, that only has a bitmask: the keys of the leaf inside the range
+template<int Depth, size_t N, typename F>
+void iterate_joined_range_recursive(const std::array<ByteNode*, N>& nodes, uint32_t base_index, uint32_t first, uint32_t last, ByteNode* range_leaf, F& function)
+{
+	constexpr int shift = 8 * (Depth - 1);
+	const uint32_t start = base_index << shift;
+	const int lo = (first > start) ? int((first - start) >> shift) : 0;
+	const int hi = int(std::min<uint32_t>((last - start) >> shift, 255));
+
+	if constexpr (Depth == 1)
+	{
+		std::array<ByteNode*, N + 1> leafnodes;
+		std::copy(nodes.begin(), nodes.end(), leafnodes.begin());
+		leafnodes[N] = range_leaf;
+		make_key_range_mask(lo, hi, &range_leaf->bytemask[0]);
+
+		function(base_index, leafnodes);
+	}
+	else
+	{
+		uint64_t out_bitmask[4];
+		uint64_t range_mask[4];
+		make_key_range_mask(lo, hi, &range_mask[0]);
+		if (!merge_node_bitmasks(nodes, &out_bitmask[0]))
+		{
+			return;
+		}
+		for (int word = 0; word < 4; word++)
+		{
+			out_bitmask[word] &= range_mask[word];
+		}
+
+		bitmask_optimal_iterate(&out_bitmask[0], 4, [&](uint32_t index) {
+
+			const std::array<ByteNode*, N> othernodes = gather_child_nodes(nodes, index, std::make_index_sequence<N>{});
+			iterate_joined_range_recursive<Depth - 1>(othernodes, (base_index | index) << 8, first, last, range_leaf, function);
+		});
+	}
+}
+
+//calls function(index, value) for every key of the tree in [first, last), in order. Trees of V = void call function(index)
+template<typename V, typename F>
+void iterate_range(const ByteTree<V>* tree, uint32_t first, uint32_t last, F&& function)
+{
+	if (first >= last)
+	{
+		return;
+	}
+
+	//only the bitmask of the range leaf is used
+	ByteNode range_leaf;
+	auto leaf = [&function](uint32_t leaf_index, const std::array<ByteNode*, 2>& nodes) {
+
+		uint64_t out_bitmask[4];
+		if (!merge_node_bitmasks(nodes, &out_bitmask[0]))
+		{
+			return;
+		}
+		bitmask_optimal_iterate(&out_bitmask[0], 4, [&](uint32_t key) {
+			if constexpr (std::is_void_v<V>)
+			{
+				function(leaf_index | key);
+			}
+			else
+			{
+				function(leaf_index | key, node_val<V>(nodes[0], uint8_t(key)));
+			}
+		});
+	};
+	iterate_joined_range_recursive<3>(std::array<ByteNode*, 1>{ tree->root }, 0, first, last - 1, &range_leaf, leaf);
+}
+
+//number of keys of the tree, read from the population of the root
+template<typename V>
+__inline size_t tree_size(const ByteTree<V>* tree)
+{
+	return node_population(tree->root, tree->depth);
+}
+
+//keys below node in first..last, both included. Children fully inside the range are counted by their population,
+//so only the two paths to the ends of the range are walked down
+template<int Depth>
+size_t count_range_recursive(ByteNode* node, uint32_t base_index, uint32_t first, uint32_t last)
+{
+	constexpr int shift = 8 * (Depth - 1);
+	const uint32_t start = base_index << shift;
+	const int lo = (first > start) ? int((first - start) >> shift) : 0;
+	const int hi = int(std::min<uint32_t>((last - start) >> shift, 255));
+
+	uint64_t mask[4];
+	make_key_range_mask(lo, hi, &mask[0]);
+	for (int word = 0; word < 4; word++)
+	{
+		mask[word] &= node->bytemask[word];
+	}
+
+	if constexpr (Depth == 1)
+	{
+		return popcount64(mask[0]) + popcount64(mask[1]) + popcount64(mask[2]) + popcount64(mask[3]);
+	}
+	else
+	{
+		size_t count = 0;
+		bitmask_optimal_iterate(&mask[0], 4, [&](uint32_t index) {
+
+			ByteNode* child = node_child(node, uint8_t(index));
+			const uint32_t child_first = (base_index | index) << shift;
+			const uint32_t child_last = child_first + ((uint32_t(1) << shift) - 1);
+			if (first <= child_first && last >= child_last)
+			{
+				count += node_population(child, Depth - 1);
+			}
+			else
+			{
+				count += count_range_recursive<Depth - 1>(child, (base_index | index) << 8, first, last);
+			}
+		});
+		return count;
+	}
+}
+
+//number of keys of the tree in [first, last)
+template<typename V>
+size_t count_range(const ByteTree<V>* tree, uint32_t first, uint32_t last)
+{
+	if (first >= last)
+	{
+		return 0;
+	}
+	return count_range_recursive<3>(tree->root, 0, first, last - 1);
+}
+
+//the k-th key of the tree in index order, counting from 0. False if the tree has k keys or less.
+//The populations of the children pick the subtree at every level, so only one path is walked down.
+//tree_select(tree, size * i / parts) splits a tree in parts of the same number of keys, for join_pools_range
+template<typename V>
+bool tree_select(const ByteTree<V>* tree, size_t k, uint32_t& index)
+{
+	if (k >= tree_size(tree))
+	{
+		return false;
+	}
+
+	ByteNode* node = tree->root;
+	uint32_t base_index = 0;
+	for (int level = tree->depth; level > 1; level--)
+	{
+		for (int i = node_next_set_bit(node, 0); i >= 0; i = node_next_set_bit(node, i + 1))
+		{
+			ByteNode* child = node_child(node, uint8_t(i));
+			const uint32_t population = node_population(child, level - 1);
+			if (k < population)
+			{
+				node = child;
+				base_index = (base_index | i) << 8;
+				break;
+			}
+			k -= population;
+		}
+	}
+
+	for (int word = 0; word < 4; word++)
+	{
+		uint64_t mask = node->bytemask[word];
+		const size_t count = popcount64(mask);
+		if (k < count)
+		{
+			for (; k > 0; k--)
+			{
+				mask &= mask - 1;
+			}
+			index = base_index | uint32_t(word * 64 + countr_zero64(mask));
+			return true;
+		}
+		k -= count;
+	}
+	return false;
+}
+
+template<typename V, typename F>
+void iterate_tree_values(ByteTree<V>* tree, F&& function)
+{
+	ByteNode* node_stack[4];
+	int iteration_stack[4];
+	int stack_head = 0;
+
+	node_stack[0] = tree->root;
+	iteration_stack[0] = -1;
+	int current_depth = tree->depth;
+
+	while (stack_head >= 0)
+	{
+	start:
+		ByteNode* nd = node_stack[stack_head];
+		int& iterator = iteration_stack[stack_head];
+
+		if (current_depth == 1)
+		{
+			uint32_t begin_index = (iteration_stack[0] << 16) + (iteration_stack[1] << 8);
+
+			for (int i = 0; i < 256; i++)
+			{
+				if (get_node_mask_at(nd, i))
+				{
+					function(begin_index + i, node_val<V>(nd, i));
+				}
+			}
+
+			//pop
+			stack_head--;
+			current_depth++;
+		}
+		else
+		{
+			while (iterator < 255)
+			{
+				iterator++;
+
+				if (get_node_mask_at(nd, iterator))
+				{
+					//push
+					stack_head++;
+					current_depth--;
+					node_stack[stack_head] = node_child(nd, iterator);
+					iteration_stack[stack_head] = -1;
+					goto start;
+				}
+			}
+			//pop
+			stack_head--;
+			current_depth++;
+		}
+	}
+	return;
+}
+
+template<typename V>
+bool remove_tree_val(ByteTree<V>* tree, uint32_t index)
+{
+	int level = tree->depth;
+
+	bool bclear = false;
+	return remove_tree_recursive(tree->root, index, level, bclear);
+}
+
+//frees the empty leaf that holds index and every parent left empty by it. Returns true if node was left empty
+bool prune_tree_recursive(ByteNode*& node, uint32_t index, int level)
+{
+	int shift = 8 * (level - 1);
+	uint32_t shifted = (index >> shift) & 0xFF;
+
+	if (level == 2 || prune_tree_recursive(node_child(node, shifted), index, level - 1))
+	{
+		free_treenode(node_child(node, shifted));
+		node = remove_node_slot(node, shifted);
+	}
+	return is_node_empty(node);
+}
+
+template<typename V>
+void prune_tree_leaf(ByteTree<V>* tree, uint32_t index)
+{
+	prune_tree_recursive(tree->root, index, tree->depth);
+}
+
+//a node other trees still share only loses an owner
+void destroy_tree_recursive(ByteNode* node, int level)
+{
+	if (node->shares > 0)
+	{
+		node->shares--;
+		return;
+	}
+	if (level > 1)
+	{
+		bitmask_optimal_iterate(&node->bytemask[0], 4, [&](uint32_t index) {
+			destroy_tree_recursive(node_child(node, index), level - 1);
+		});
+	}
+	free_treenode(node);
+}
+
+//gives every node of the tree back to the arena
+template<typename V>
+void destroy_bytetree(ByteTree<V>* tree)
+{
+	destroy_tree_recursive(tree->root, tree->depth);
+	tree->root = nullptr;
+}
+
+ByteNode* clone_tree_recursive(const ByteNode* node, int level)
+{
+	ByteNode* clone = allocate_treenode(node->kind, node->slot_bytes);
+	memcpy(clone, node, node_bytes(node->kind, node->slot_bytes));
+	clone->shares = 0;
+	if (level > 1)
+	{
+		bitmask_optimal_iterate(&clone->bytemask[0], 4, [&](uint32_t index) {
+			ByteNode*& child = node_child(clone, uint8_t(index));
+			child = clone_tree_recursive(child, level - 1);
+		});
+	}
+	return clone;
+}
+
+//copies every node of the tree into the arena. The source can live anywhere, like a mapped snapshot
+template<typename V>
+ByteTree<V> clone_bytetree(const ByteTree<V>* tree)
+{
+	ByteTree<V> clone = *tree;
+	clone.root = clone_tree_recursive(tree->root, tree->depth);
+	return clone;
+}
+
+//bytes of nodes copied by unshare_treenode, to measure what writing to shared trees costs
+size_t shared_copied_bytes = 0;
+
+//a tree with the same nodes, in O(1). The trees stay independent: the first write to a shared node copies it, along
+//the path to the written leaf, see unshare_tree_leaf. Shared trees are written and destroyed from one thread
+template<typename V>
+ByteTree<V> share_bytetree(ByteTree<V>* tree)
+{
+	assert(tree->root->shares < std::numeric_limits<uint16_t>::max());
+	tree->root->shares++;
+	return *tree;
+}
+
+//returns node if this tree is its only owner, or a private copy of it. The children of a copy gain an owner
+ByteNode* unshare_treenode(ByteNode* node, int level)
+{
+	if (node->shares == 0)
+	{
+		return node;
+	}
+	const size_t bytes = node_bytes(node->kind, node->slot_bytes);
+	ByteNode* clone = allocate_treenode(node->kind, node->slot_bytes);
+	memcpy(clone, node, bytes);
+	clone->shares = 0;
+	shared_copied_bytes += bytes;
+	if (level > 1)
+	{
+		bitmask_optimal_iterate(&clone->bytemask[0], 4, [&](uint32_t index) {
+			ByteNode* child = node_child(clone, uint8_t(index));
+			assert(child->shares < std::numeric_limits<uint16_t>::max());
+			child->shares++;
+		});
+	}
+	node->shares--;
+	return clone;
+}
+
+//find_or_add_tree_leaf for trees that may share nodes: every node on the path, the leaf included, is made private
+//to this tree first. Without badd a missing leaf returns null, after unsharing the part of the path that exists
+template<typename V>
+ByteNode** unshare_tree_leaf(ByteTree<V>* tree, uint32_t index, bool badd, ByteNode** parents = nullptr)
+{
+	if (badd && index >= tree->capacity)
+	{
+		//the new root owns the old one in place of the tree, which can stay shared
+		grow_tree(tree, index);
+	}
+
+	int level = tree->depth;
+	ByteNode** link = &tree->root;
+	*link = unshare_treenode(*link, level);
+
+	while (level > 1)
+	{
+		int shift = 8 * (level - 1);
+		uint32_t shifted = (index >> shift) & 0xFF;
+
+		ByteNode* node = *link;
+		if (!get_node_mask_at(node, shifted))
+		{
+			if (!badd)
+			{
+				return nullptr;
+			}
+			node = insert_node_slot(node, shifted);
+			*link = node;
+			node_child(node, shifted) = allocate_treenode(0, tree_slot_bytes<V>(level - 1));
+		}
+		if (parents)
+		{
+			*parents++ = node;
+		}
+		link = &node_child(node, shifted);
+		*link = unshare_treenode(*link, level - 1);
+		level--;
+	}
+	return link;
+}
+
+//add_tree_val for trees that may share nodes
+template<typename V>
+void add_shared_tree_val(ByteTree<V>* tree, uint32_t index, uint64_t value)
+{
+	assert(value <= std::numeric_limits<V>::max());
+
+	ByteNode* parents[4];
+	ByteNode** link = unshare_tree_leaf(tree, index, true, parents);
+	const uint8_t key = index & 0xFF;
+	if (!get_node_mask_at(*link, key))
+	{
+		*link = insert_node_slot(*link, key);
+		add_tree_population(tree, parents, 1);
+	}
+	node_val<V>(*link, key) = V(value);
+}
+
+//remove_tree_val for trees that may share nodes. Nothing is copied if index is not in the tree
+template<typename V>
+bool remove_shared_tree_val(ByteTree<V>* tree, uint32_t index)
+{
+	ByteNode** leaf = find_tree_leaf(tree, index);
+	if (!leaf || !get_node_mask_at(*leaf, index & 0xFF))
+	{
+		return false;
+	}
+	unshare_tree_leaf(tree, index, false);
+	return remove_tree_val(tree, index);
+}
+
+//callbacks a pool calls when an entity enters or leaves it, after the pool itself is updated
+struct PoolListener
+{
+	void* listener;
+	void (*added)(void* listener, uint32_t entity);
+	void (*removed)(void* listener, uint32_t entity);
+};
+
+__inline void notify_added(const std::vector<PoolListener>& listeners, uint32_t entity)
+{
+	for (const PoolListener& listener : listeners)
+	{
+		listener.added(listener.listener, entity);
+	}
+}
+__inline void notify_removed(const std::vector<PoolListener>& listeners, uint32_t entity)
+{
+	for (const PoolListener& listener : listeners)
+	{
+		listener.removed(listener.listener, entity);
+	}
+}
+
+//removes every listener registered with that listener pointer
+__inline void remove_pool_listener(std::vector<PoolListener>& listeners, void* listener)
+{
+	listeners.erase(std::remove_if(listeners.begin(), listeners.end(), [&](const PoolListener& registered) {
+		return registered.listener == listener;
+	}), listeners.end());
+}
+
+//V is the type of the dense indices in the tree leaves, it limits how many elements the pool can hold
+template<typename T, typename V = uint32_t>
+struct ComponentPool
+{
+	ByteTree<V> tree;
+	std::vector<T> Dense;
+	std::vector<uint32_t> Reverse;
+
+	//indices modified since the last clear_changed, as keys without values. Null root if change tracking is off
+	ByteTree<void> changed;
+
+	//told about membership changes, not about value changes
+	std::vector<PoolListener> listeners;
+};
+
+//pool of a component without data. Only the leaf bitmasks of its tree record which entities have it, there are no values
+//and no dense arrays. It holds entity indices, so a stale handle matches while its index isnt reused
+template<typename T>
+struct TagPool
+{
+	ByteTree<void> tree;
+	size_t count;
+
+	std::vector<PoolListener> listeners;
+};
+
+template<typename Pool>
+struct is_tag_pool : std::false_type {};
+template<typename T>
+struct is_tag_pool<TagPool<T>> : std::true_type {};
+
+//the pool a join takes the entity handles from: the first one that is not a tag pool, tags only know indices.
+//If every pool is a tag pool the entity is the bare index
+template<typename... Pools>
+constexpr size_t join_entity_pool()
+{
+	constexpr bool btags[] = { is_tag_pool<Pools>::value... };
+	for (size_t i = 0; i < sizeof...(Pools); i++)
+	{
+		if (!btags[i])
+		{
+			return i;
+		}
+	}
+	return 0;
+}
+
+//the pool create_pool makes for T, empty types get a TagPool
+template<typename T, typename V = uint32_t>
+using pool_t = std::conditional_t<std::is_empty_v<T>, TagPool<T>, ComponentPool<T, V>>;
+
+//what a join hands out for the key of a leaf. Other pool types overload these
+template<typename T, typename V>
+__inline T& pool_join_element(ComponentPool<T, V>* pool, ByteNode* leaf, uint32_t key)
+{
+	return pool->Dense[node_val<V>(leaf, key)];
+}
+template<typename T, typename V>
+__inline uint32_t pool_join_entity(ComponentPool<T, V>* pool, ByteNode* leaf, uint32_t /*leaf_index*/, uint32_t key)
+{
+	return pool->Reverse[node_val<V>(leaf, key)];
+}
+
+//number of elements of a pool
+template<typename T, typename V>
+__inline size_t pool_size(const ComponentPool<T, V>* pool)
+{
+	return pool->Reverse.size();
+}
+template<typename T>
+__inline size_t pool_size(const TagPool<T>* pool)
+{
+	return pool->count;
+}
+
+template<typename T, typename V>
+__inline T& pool_dense_element(ComponentPool<T, V>* pool, size_t dense_index)
+{
+	return pool->Dense[dense_index];
+}
+
+//tags only filter, every entity gets the same empty value
+template<typename T>
+__inline T& pool_join_element(TagPool<T>*, ByteNode*, uint32_t)
+{
+	static T tag{};
+	return tag;
+}
+template<typename T>
+__inline uint32_t pool_join_entity(TagPool<T>*, ByteNode*, uint32_t leaf_index, uint32_t key)
+{
+	return leaf_index | key;
+}
+
+template<typename T, typename V>
+__inline bool is_tracking_changes(const ComponentPool<T, V>* pool)
+{
+	return pool->changed.root != nullptr;
+}
+
+//starts marking every modified element, see mark_changed
+template<typename T, typename V>
+void enable_change_tracking(ComponentPool<T, V>* pool)
+{
+	if (!is_tracking_changes(pool))
+	{
+		pool->changed = create_bytetree<void>();
+	}
+}
+
+//add, find_pool_element, get_pool_element_raw and the joins whose callback takes T& mark elements automatically,
+//see mark_joined_leaf. Other writes through join references have to call this
+template<typename T, typename V>
+__inline void mark_changed(ComponentPool<T, V>* pool, uint32_t entity)
+{
+	if (is_tracking_changes(pool))
+	{
+		add_tree_key(&pool->changed, entity & 0xFFFFF);
+	}
+}
+
+//marks every key set in touched, of the leaf that starts at leaf_index. Leaves the changed tree untouched if they are
+//all marked already, so a join filtered by changed_pools can mark the pool it walks
+template<typename T, typename V>
+void mark_changed_leaf(ComponentPool<T, V>* pool, uint32_t leaf_index, const uint64_t* touched)
+{
+	ByteNode** found = find_tree_leaf(&pool->changed, leaf_index);
+	if (found && ((*found)->bytemask[0] & touched[0]) == touched[0] && ((*found)->bytemask[1] & touched[1]) == touched[1]
+		&& ((*found)->bytemask[2] & touched[2]) == touched[2] && ((*found)->bytemask[3] & touched[3]) == touched[3])
+	{
+		return;
+	}
+
+	ByteNode* parents[4];
+	ByteNode* leaf = *find_or_add_tree_leaf(&pool->changed, leaf_index, parents);
+	const int before = node_child_count(leaf);
+	for (int word = 0; word < 4; word++)
+	{
+		leaf->bytemask[word] |= touched[word];
+	}
+	add_tree_population(&pool->changed, parents, node_child_count(leaf) - before);
+}
+
+template<typename T, typename V>
+bool is_changed(const ComponentPool<T, V>* pool, uint32_t entity)
+{
+	return is_tracking_changes(pool) && has_tree_key(&pool->changed, entity & 0xFFFFF);
+}
+
+//forgets every change. The changed tree only has nodes on the paths to changed elements, so this costs one free per dirty node
+template<typename T, typename V>
+void clear_changed(ComponentPool<T, V>* pool)
+{
+	if (is_tracking_changes(pool) && !is_node_empty(pool->changed.root))
+	{
+		destroy_bytetree(&pool->changed);
+		pool->changed = create_bytetree<void>();
+	}
+}
+template<typename T, typename V>
+void remove_pool_element(ComponentPool<T, V>* pool, uint32_t entity)
+{
+	uint32_t index = entity & 0xFFFFF;
+
+	uint64_t val;
+	if (get_tree_val(&pool->tree, index, val))
+	{
+		if (pool->Reverse[val] == entity)
+		{
+			auto dense_end = pool->Dense.size() - 1;
+			auto reverse_end = pool->Reverse.size() - 1;
+
+			if (val != reverse_end)
+			{
+				//swap with last
+				uint32_t swap_et = pool->Reverse[reverse_end];
+				pool->Reverse[val] = pool->Reverse[reverse_end];
+				pool->Dense[val] = pool->Dense[dense_end];
+
+				uint32_t swap_index = swap_et & 0xFFFFF;
+
+				add_tree_val(&pool->tree, swap_index, val);
+			}
+
+			pool->Dense.pop_back();
+			pool->Reverse.pop_back();
+
+			remove_tree_val(&pool->tree, index);
+			notify_removed(pool->listeners, entity);
+		}
+	}
+}
+template<typename T, typename V>
+bool get_pool_element(ComponentPool<T, V>* pool, uint32_t entity, T& value)
+{
+	uint32_t index = entity & 0xFFFFF;
+
+	uint64_t val;
+	if (get_tree_val(&pool->tree, index, val))
+	{
+		if (pool->Reverse[val] == entity)
+		{
+			value = pool->Dense[val];
+			return true;
+		}
+	}
+	//missing, or a stale handle of a recycled index
+	return false;
+}
+template<typename T, typename V>
+bool has_pool_element(const ComponentPool<T, V>* pool, uint32_t entity)
+{
+	uint64_t val;
+	return get_tree_val(&pool->tree, entity & 0xFFFFF, val) && pool->Reverse[val] == entity;
+}
+//pointer to the value of entity, null if its not in the pool. Marks the element as changed
+template<typename T, typename V>
+T* find_pool_element(ComponentPool<T, V>* pool, uint32_t entity)
+{
+	uint64_t val;
+	if (get_tree_val(&pool->tree, entity & 0xFFFFF, val) && pool->Reverse[val] == entity)
+	{
+		mark_changed(pool, entity);
+		return &pool->Dense[val];
+	}
+	return nullptr;
+}
+template<typename T, typename V>
+__inline T& get_pool_element_raw(ComponentPool<T, V>* pool, uint32_t index)
+{
+	uint64_t val;
+	bool found = get_tree_val(&pool->tree, index, val);
+	assert(found);
+
+	mark_changed(pool, index);
+	return pool->Dense[val];
+}
+
+template<typename T, typename V>
+__inline uint32_t& get_pool_entity_from_index(ComponentPool<T, V>* pool, uint32_t index)
+{
+	uint64_t val;
+	bool found = get_tree_val(&pool->tree, index, val);
+	assert(found);
+
+	return pool->Reverse[val];
+}
+
+
+template<typename T, typename V>
+void add_pool_element(ComponentPool<T, V>* pool, uint32_t entity, const T& value)
+{
+	uint32_t index = entity & 0xFFFFF;
+
+	uint64_t val;
+	//already in set, replace
+	if (get_tree_val(&pool->tree, index, val))
+	{
+		if constexpr  (sizeof(T) > 0)
+		{
+			if (pool->Reverse[val] == entity)
+			{
+				pool->Dense[val] = value;
+				mark_changed(pool, entity);
+			}
+		}		
+	}
+	else
+	{
+		assert(pool->Reverse.size() <= std::numeric_limits<V>::max());
+		pool->Reverse.push_back(entity);
+		if constexpr  (sizeof(T) > 0)
+		{
+			pool->Dense.push_back(value);
+		}		
+
+		auto dense_end = pool->Dense.size() - 1;
+		add_tree_val(&pool->tree, index, dense_end);
+		mark_changed(pool, entity);
+		notify_added(pool->listeners, entity);
+	}
+}
+
+//stable sort of (index << 32 | position) keys by their 20 bit tree index, in two 10 bit counting passes
+void radix_sort_tree_indices(std::vector<uint64_t>& keys)
+{
+	std::vector<uint64_t> scratch(keys.size());
+	std::vector<uint32_t> offsets(1024);
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		const int shift = 32 + pass * 10;
+
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (uint64_t key : keys)
+		{
+			offsets[(key >> shift) & 0x3FF]++;
+		}
 
-			function(index, nodes);
-			});
-#endif
+		uint32_t total = 0;
+		for (uint32_t& offset : offsets)
+		{
+			const uint32_t bucket = offset;
+			offset = total;
+			total += bucket;
+		}
+
+		for (uint64_t key : keys)
+		{
+			scratch[offsets[(key >> shift) & 0x3FF]++] = key;
+		}
+		keys.swap(scratch);
+	}
+}
+
+//order of a batch of entities by tree index
+struct TreeBatchOrder
+{
+	const uint32_t* entities;
+	bool bsorted;
+	//tree index in the high bits, batch position in the low bits. Only built if the batch is not sorted already
+	std::vector<uint64_t> order;
 
-		
+	//sorted key i, index in the high 32 bits and batch position in the low ones
+	__inline uint64_t key(size_t i) const
+	{
+		return bsorted ? ((uint64_t(entities[i] & 0xFFFFF) << 32) | i) : order[i];
 	}
-	else
+};
+
+TreeBatchOrder make_tree_batch_order(const uint32_t* entities, size_t count)
+{
+	TreeBatchOrder batch;
+	batch.entities = entities;
+	batch.bsorted = true;
+	for (size_t i = 1; i < count; i++)
+	{
+		batch.bsorted &= (entities[i - 1] & 0xFFFFF) <= (entities[i] & 0xFFFFF);
+	}
+
+	if (!batch.bsorted)
+	{
+		batch.order.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			batch.order[i] = (uint64_t(entities[i] & 0xFFFFF) << 32) | i;
+		}
+		radix_sort_tree_indices(batch.order);
+	}
+	return batch;
+}
+
+//adds count entities at once, replacing the values of the ones already in the pool.
+//the batch is sorted by tree index, then every leaf is built in one go and the dense arrays grow once
+template<typename T, typename V>
+void add_pool_elements(ComponentPool<T, V>* pool, const uint32_t* entities, const T* values, size_t count)
+{
+	if (count == 0)
 	{
+		return;
+	}
 
+	//duplicates stay in batch order so the last one wins
+	const TreeBatchOrder batch = make_tree_batch_order(entities, count);
 
-		ByteNode* othernodes[10];
+	//new elements are appended, so they are the ones from here to the end once the batch is done
+	const size_t first_added = pool->Reverse.size();
+	pool->Reverse.reserve(pool->Reverse.size() + count);
+	pool->Dense.reserve(pool->Dense.size() + count);
 
-		bitmask_optimal_iterate(&out_bitmask[0], 4, [&](uint32_t index) {
+	V leaf_vals[256];
+	uint64_t leaf_bitmask[4];
+	uint64_t leaf_touched[4];
+
+	size_t begin = 0;
+	while (begin < count)
+	{
+		const uint32_t leaf_index = uint32_t(batch.key(begin) >> 32) & ~uint32_t(0xFF);
+		memset(leaf_touched, 0, sizeof(leaf_touched));
 
-			for (int i = 0; i < nodecount; i++)
+		ByteNode* parents[4];
+		ByteNode** link = find_or_add_tree_leaf(&pool->tree, leaf_index, parents);
+		ByteNode* leaf = *link;
+
+		memcpy(leaf_bitmask, leaf->bytemask, sizeof(leaf_bitmask));
+		unpack_node_vals(leaf, leaf_vals);
+		const size_t leaf_first_added = pool->Reverse.size();
+
+		size_t end = begin;
+		for (; end < count; end++)
+		{
+			const uint64_t sorted = batch.key(end);
+			if ((uint32_t(sorted >> 32) & ~uint32_t(0xFF)) != leaf_index)
 			{
-				othernodes[i] = nodes[i]->childs[index];
+				break;
 			}
-#ifdef _PERF_TRYHARD
-			if(depth == 2)
+
+			const uint32_t position = uint32_t(sorted);
+			const uint32_t entity = entities[position];
+			const uint8_t key = uint8_t(sorted >> 32);
+
+			const uint64_t mask = uint64_t(0x1) << (key & 0x3F);
+			if (leaf_bitmask[key >> 6] & mask)
 			{
-				function(0, othernodes);
+				//already in set, replace. A stale handle writes nothing and marks nothing
+				const uint64_t val = leaf_vals[key];
+				if (pool->Reverse[val] == entity)
+				{
+					pool->Dense[val] = values[position];
+					leaf_touched[key >> 6] |= mask;
+				}
 			}
 			else
 			{
-				iterate_joined_recursive(othernodes, nodecount, depth - 1, function);
+				assert(pool->Reverse.size() <= std::numeric_limits<V>::max());
+				leaf_bitmask[key >> 6] |= mask;
+				leaf_touched[key >> 6] |= mask;
+				leaf_vals[key] = V(pool->Reverse.size());
+
+				pool->Reverse.push_back(entity);
+				pool->Dense.push_back(values[position]);
 			}
+		}
 
-#else 
+		*link = pack_node_vals(leaf, leaf_bitmask, leaf_vals);
+		add_tree_population(&pool->tree, parents, int32_t(pool->Reverse.size() - leaf_first_added));
+		if (is_tracking_changes(pool))
+		{
+			mark_changed_leaf(pool, leaf_index, leaf_touched);
+		}
+		begin = end;
+	}
 
-			iterate_joined_recursive(othernodes, nodecount, depth - 1, function);
-#endif
-			});
+	for (size_t i = first_added; i < pool->Reverse.size() && !pool->listeners.empty(); i++)
+	{
+		notify_added(pool->listeners, pool->Reverse[i]);
 	}
 }
 
-template<typename F>
-void iterate_joined_trees(ByteTree* trees, int treecount, F&& function)
+//removes count entities at once. The tree is updated one leaf at a time, then the holes left in the dense arrays
+//are filled with elements from the end in a single sweep, and only those moved elements get their tree value patched
+template<typename T, typename V>
+void remove_pool_elements(ComponentPool<T, V>* pool, const uint32_t* entities, size_t count)
 {
+	if (count == 0)
+	{
+		return;
+	}
+
+	const TreeBatchOrder batch = make_tree_batch_order(entities, count);
+
+	std::vector<uint64_t> removed((pool->Reverse.size() + 63) / 64, 0);
+	size_t nremoved = 0;
+	//listeners are told once the pool is consistent again
+	std::vector<uint32_t> removed_entities;
+
+	V leaf_vals[256];
+	uint64_t leaf_bitmask[4];
+
+	size_t begin = 0;
+	while (begin < count)
+	{
+		const uint32_t leaf_index = uint32_t(batch.key(begin) >> 32) & ~uint32_t(0xFF);
+
+		size_t end = begin;
+		while (end < count && (uint32_t(batch.key(end) >> 32) & ~uint32_t(0xFF)) == leaf_index)
+		{
+			end++;
+		}
+
+		ByteNode* parents[4];
+		ByteNode** link = find_tree_leaf(&pool->tree, leaf_index, parents);
+		if (link)
+		{
+			ByteNode* leaf = *link;
+			memcpy(leaf_bitmask, leaf->bytemask, sizeof(leaf_bitmask));
+			unpack_node_vals(leaf, leaf_vals);
+			const size_t leaf_first_removed = nremoved;
+
+			for (size_t i = begin; i < end; i++)
+			{
+				const uint64_t sorted = batch.key(i);
+				const uint32_t entity = entities[uint32_t(sorted)];
+				const uint8_t key = uint8_t(sorted >> 32);
+
+				const uint64_t mask = uint64_t(0x1) << (key & 0x3F);
+				if ((leaf_bitmask[key >> 6] & mask) && pool->Reverse[leaf_vals[key]] == entity)
+				{
+					const uint64_t val = leaf_vals[key];
+					leaf_bitmask[key >> 6] &= ~mask;
+					removed[val / 64] |= uint64_t(0x1) << (val % 64);
+					nremoved++;
+					if (!pool->listeners.empty())
+					{
+						removed_entities.push_back(entity);
+					}
+				}
+			}
+
+			//before the prune, which can free the path
+			add_tree_population(&pool->tree, parents, -int32_t(nremoved - leaf_first_removed));
+			if (!(leaf_bitmask[0] | leaf_bitmask[1] | leaf_bitmask[2] | leaf_bitmask[3]))
+			{
+				prune_tree_leaf(&pool->tree, leaf_index);
+			}
+			else
+			{
+				*link = pack_node_vals(leaf, leaf_bitmask, leaf_vals);
+			}
+		}
+		begin = end;
+	}
+
+	auto is_removed = [&](size_t val) {
+		return (removed[val / 64] >> (val % 64)) & 0x1;
+	};
+
+	//every hole below the new size is filled by a survivor from above it
+	const size_t new_size = pool->Reverse.size() - nremoved;
+	size_t tail = pool->Reverse.size();
+	for (size_t hole = 0; hole < new_size; hole++)
+	{
+		if (is_removed(hole))
+		{
+			do
+			{
+				tail--;
+			} while (is_removed(tail));
+
+			pool->Reverse[hole] = pool->Reverse[tail];
+			pool->Dense[hole] = std::move(pool->Dense[tail]);
+
+			add_tree_val(&pool->tree, pool->Reverse[hole] & 0xFFFFF, hole);
+		}
+	}
 
-	ByteNode* rootnodes[10];
+	pool->Reverse.erase(pool->Reverse.begin() + new_size, pool->Reverse.end());
+	pool->Dense.erase(pool->Dense.begin() + new_size, pool->Dense.end());
 
-	for (int i = 0; i < treecount; i++)
+	for (uint32_t entity : removed_entities)
 	{
-		rootnodes[i] = trees[i].root;
+		notify_removed(pool->listeners, entity);
 	}
-#ifndef _PERF_TRYHARD
-	iterate_joined_recursive(&rootnodes[0], treecount, 3, function);
-#else
-	iterate_joined_recursive(&rootnodes[0], treecount, 3, [&](uint32_t index, ByteNode** nodes) {
-		function(index, nodes);
+}
+
+//rebuilds the dense arrays in tree order, so walking the tree reads them as a linear stream
+template<typename T, typename V>
+void sort_pool_by_index(ComponentPool<T, V>* pool)
+{
+	std::vector<T> dense;
+	std::vector<uint32_t> reverse;
+	dense.reserve(pool->Dense.size());
+	reverse.reserve(pool->Reverse.size());
+
+	const std::array<ByteTree<V>*, 1> trees = { &pool->tree };
+	iterate_joined_trees(trees, [&](uint32_t, const std::array<ByteNode*, 1>& nodes) {
+
+		ByteNode* leaf = nodes[0];
+		bitmask_optimal_iterate(&leaf->bytemask[0], 4, [&](uint32_t index) {
+
+			V& val = node_val<V>(leaf, index);
+			dense.push_back(std::move(pool->Dense[val]));
+			reverse.push_back(pool->Reverse[val]);
+			val = V(reverse.size() - 1);
+		});
 	});
-#endif
+
+	pool->Dense.swap(dense);
+	pool->Reverse.swap(reverse);
+}
+
+//progress of an incremental sort of a pool
+struct PoolSortCursor
+{
+	//next tree index to visit, and the dense position its element goes to
+	uint32_t index = 0;
+	uint32_t position = 0;
+};
+
+//sorts the pool towards tree order a few leaves at a time, swapping at most around budget elements into place per call.
+//Every element before the cursor position is in tree order, as long as no element is removed during the pass.
+//The pool is always valid in between, removals only mean the next pass has more work. Returns true when a pass ends
+template<typename T, typename V>
+bool sort_pool_by_index_step(ComponentPool<T, V>* pool, PoolSortCursor* cursor, size_t budget)
+{
+	size_t moved = 0;
+	while (moved < budget)
+	{
+		uint32_t leaf_index;
+		ByteNode* leaf = (cursor->position < pool->Dense.size()) ? find_next_tree_leaf(&pool->tree, cursor->index, leaf_index) : nullptr;
+		if (!leaf)
+		{
+			*cursor = PoolSortCursor{};
+			return true;
+		}
+
+		bitmask_optimal_iterate(&leaf->bytemask[0], 4, [&](uint32_t index) {
+
+			V& val = node_val<V>(leaf, index);
+			const uint32_t position = cursor->position++;
+			if (val != position)
+			{
+				//the element that was in the way goes to the old slot of this one
+				std::swap(pool->Dense[position], pool->Dense[val]);
+				std::swap(pool->Reverse[position], pool->Reverse[val]);
+				add_tree_val(&pool->tree, pool->Reverse[val] & 0xFFFFF, val);
+
+				val = V(position);
+				moved++;
+			}
+		});
+		cursor->index = leaf_index + 256;
+	}
+	return false;
 }
 
+//parameter types of a callback with a single, non template operator(). void for generic lambdas
+template<typename M>
+struct callback_arguments;
+template<typename C, typename R, typename... A>
+struct callback_arguments<R(C::*)(A...)>
+{
+	using type = std::tuple<A...>;
+};
+template<typename C, typename R, typename... A>
+struct callback_arguments<R(C::*)(A...) const>
+{
+	using type = std::tuple<A...>;
+};
 
+template<typename F, typename = void>
+struct join_callback_arguments
+{
+	using type = void;
+};
 template<typename F>
-void iterate_tree_values(ByteTree* tree, F&& function)
+struct join_callback_arguments<F, std::void_t<decltype(&F::operator())>>
 {
-	ByteNode* node_stack[4];
-	int iteration_stack[4];
-	int stack_head = 0;
+	using type = typename callback_arguments<decltype(&F::operator())>::type;
+};
 
-	node_stack[0] = tree->root;
-	iteration_stack[0] = -1;
-	int current_depth = tree->depth;
+//true if function takes the element of pool J as T&, to write it. Callbacks with const T& and generic lambdas count as reading
+template<size_t J, typename F>
+constexpr bool join_writes_pool()
+{
+	using Arguments = typename join_callback_arguments<std::decay_t<F>>::type;
+	if constexpr (std::is_void_v<Arguments>)
+	{
+		return false;
+	}
+	else if constexpr (J + 1 >= std::tuple_size_v<Arguments>)
+	{
+		return false;
+	}
+	else
+	{
+		using Argument = std::tuple_element_t<J + 1, Arguments>;
+		return std::is_lvalue_reference_v<Argument> && !std::is_const_v<std::remove_reference_t<Argument>>;
+	}
+}
 
-	while (stack_head >= 0)
+//marks the joined keys of a leaf as changed in a pool the callback writes, if the pool tracks changes
+template<typename Pool>
+__inline void mark_joined_leaf(Pool*, uint32_t, const uint64_t*)
+{
+}
+template<typename T, typename V>
+__inline void mark_joined_leaf(ComponentPool<T, V>* pool, uint32_t leaf_index, const uint64_t* joined)
+{
+	if (is_tracking_changes(pool))
 	{
-	start:
-		ByteNode* nd = node_stack[stack_head];
-		int& iterator = iteration_stack[stack_head];
+		mark_changed_leaf(pool, leaf_index, joined);
+	}
+}
+//the same for a single joined entity
+template<typename Pool>
+__inline void mark_joined_element(Pool*, uint32_t)
+{
+}
+template<typename T, typename V>
+__inline void mark_joined_element(ComponentPool<T, V>* pool, uint32_t entity)
+{
+	mark_changed(pool, entity);
+}
 
-		if (current_depth == 1)
-		{
-			uint32_t begin_index = (iteration_stack[0] << 16) + (iteration_stack[1] << 8);
+//builds the leaf level of a join: a callable that takes a set of leaf nodes and calls function(entity, A&, B&...) for each entity in all of them.
+//it can also take the leaves of the exclude trees, to skip the entities that are in any of them.
+//With bMarkWrites the pools function takes as T& get the joined keys marked as changed, once per leaf
+template<bool bMarkWrites = true, typename F, size_t... I, typename... Pools>
+auto make_join_leaf(F& function, std::index_sequence<I...>, Pools*... pools)
+{
+	constexpr size_t E = join_entity_pool<Pools...>();
+	auto* entity_pool = std::get<E>(std::forward_as_tuple(pools...));
 
-			for (int i = 0; i < 256; i++)
+	//nodes can have extra filter nodes after the ones of the pools, they are only merged
+	return [&function, entity_pool, pools...](uint32_t leaf_index, const auto& nodes, const auto&... excludes) {
+		static_assert(std::tuple_size<std::decay_t<decltype(nodes)>>::value >= sizeof...(Pools), "a leaf node per pool");
+
+
+		uint64_t out_bitmask[4];
+		if (!merge_node_bitmasks(nodes, &out_bitmask[0]))
+		{
+			return;
+		}
+		if constexpr (sizeof...(excludes) > 0)
+		{
+			if (!(exclude_node_bitmasks(excludes, &out_bitmask[0]) && ...))
 			{
-				if (get_node_mask_at(nd, i))
-				{
-					function(begin_index + i, nd->vals[i]);
-				}
+				return;
 			}
+		}
 
-			//pop
-			stack_head--;
-			current_depth++;
+		bitmask_optimal_iterate(&out_bitmask[0], 4, [&](uint32_t index) {
+
+			auto eid = pool_join_entity(entity_pool, nodes[E], leaf_index, index);
+
+			function(eid, pool_join_element(pools, nodes[I], index)...);
+		});
+
+		if constexpr (bMarkWrites)
+		{
+			((join_writes_pool<I, F>() ? mark_joined_leaf(pools, leaf_index, &out_bitmask[0]) : void()), ...);
+		}
+	};
+}
+
+//pools whose entities are left out of a join, made with exclude_pools(&poolC, ...)
+template<size_t M>
+struct ExcludePools
+{
+	std::array<ByteNode*, M> roots;
+};
+
+template<typename T>
+struct is_exclude_pools : std::false_type {};
+template<size_t M>
+struct is_exclude_pools<ExcludePools<M>> : std::true_type {};
+
+template<typename... Pools>
+ExcludePools<sizeof...(Pools)> exclude_pools(Pools*... pools)
+{
+	return { { pools->tree.root... } };
+}
+
+//restricts a join to the entities marked as changed in all of these pools, made with changed_pools(&poolA, ...).
+//the changed trees are merged like one more pool, so clean subtrees are skipped
+template<size_t K>
+struct ChangedPools
+{
+	std::array<ByteNode*, K> roots;
+};
+
+template<typename T>
+struct is_changed_pools : std::false_type {};
+template<size_t K>
+struct is_changed_pools<ChangedPools<K>> : std::true_type {};
+
+template<typename... Ts, typename... Vs>
+ChangedPools<sizeof...(Ts)> changed_pools(ComponentPool<Ts, Vs>*... pools)
+{
+	assert((is_tracking_changes(pools) && ...));
+	return { { pools->changed.root... } };
+}
+
+template<typename F, size_t K, size_t M, size_t... I, typename... Pools>
+void join_pools_impl(F& function, const ChangedPools<K>& changed, const ExcludePools<M>& excludes, std::index_sequence<I...> seq, Pools*... pools)
+{
+	constexpr size_t N = sizeof...(Pools);
+	//the pools can have different value widths, only the inner nodes are walked together
+	std::array<ByteNode*, N + K> rootnodes = { pools->tree.root... };
+	for (size_t i = 0; i < K; i++)
+	{
+		rootnodes[N + i] = changed.roots[i];
+	}
+
+	auto leaf = make_join_leaf(function, seq, pools...);
+	iterate_joined_recursive<3>(rootnodes, excludes.roots, 0, leaf);
+}
+
+template<typename F, size_t K, size_t M, typename Tuple, size_t... I>
+__inline void join_pools_unpack(F& function, const ChangedPools<K>& changed, const ExcludePools<M>& excludes, Tuple& args, std::index_sequence<I...> seq)
+{
+	join_pools_impl(function, changed, excludes, seq, std::get<I>(args)...);
+}
+
+//join_pools(&poolA, &poolB, ... , function)
+//join_pools(&poolA, &poolB, ... , changed_pools(&poolA, ...), exclude_pools(&poolC, ...), function)
+//calls function(entity, A&, B&, ...) for every entity that is in all the pools, and in none of the excluded ones.
+//SoaPool elements are handed out as a SoaRef of their fields. Tag pools only filter, the entity comes from the first pool that is not one, see join_entity_pool
+//the changed and excluded filters are both optional, in this order
+template<typename... Args>
+void join_pools(Args&&... args)
+{
+	constexpr size_t nargs = sizeof...(Args) - 1;
+	static_assert(nargs > 0, "join_pools needs at least one pool and a function");
+
+	auto argtuple = std::forward_as_tuple(std::forward<Args>(args)...);
+	auto& function = std::get<nargs>(argtuple);
+
+	using Last = std::decay_t<std::tuple_element_t<nargs - 1, std::tuple<Args...>>>;
+	if constexpr (is_exclude_pools<Last>::value)
+	{
+		static_assert(nargs > 1, "join_pools needs at least one pool to include");
+
+		using Previous = std::decay_t<std::tuple_element_t<nargs - 2, std::tuple<Args...>>>;
+		if constexpr (is_changed_pools<Previous>::value)
+		{
+			static_assert(nargs > 2, "join_pools needs at least one pool to include");
+			join_pools_unpack(function, std::get<nargs - 2>(argtuple), std::get<nargs - 1>(argtuple), argtuple, std::make_index_sequence<nargs - 2>{});
 		}
 		else
 		{
-			while (iterator < 255)
-			{
-				iterator++;
+			join_pools_unpack(function, ChangedPools<0>{}, std::get<nargs - 1>(argtuple), argtuple, std::make_index_sequence<nargs - 1>{});
+		}
+	}
+	else if constexpr (is_changed_pools<Last>::value)
+	{
+		static_assert(nargs > 1, "join_pools needs at least one pool to include");
+		join_pools_unpack(function, std::get<nargs - 1>(argtuple), ExcludePools<0>{}, argtuple, std::make_index_sequence<nargs - 1>{});
+	}
+	else
+	{
+		join_pools_unpack(function, ChangedPools<0>{}, ExcludePools<0>{}, argtuple, std::make_index_sequence<nargs>{});
+	}
+}
 
-				if (get_node_mask_at(nd, iterator))
-				{
-					//push
-					stack_head++;
-					current_depth--;
-					node_stack[stack_head] = nd->childs[iterator];
-					iteration_stack[stack_head] = -1;
-					goto start;
-				}
+template<typename F, size_t... I, typename... Pools>
+void join_pools_range_impl(uint32_t first, uint32_t last, F& function, std::index_sequence<I...> seq, Pools*... pools)
+{
+	constexpr size_t N = sizeof...(Pools);
+	const std::array<ByteNode*, N> rootnodes = { pools->tree.root... };
+
+	//merged by the join leaf like the changed trees, after the N pools
+	ByteNode range_leaf;
+	auto leaf = make_join_leaf(function, seq, pools...);
+	iterate_joined_range_recursive<3>(rootnodes, 0, first, last, &range_leaf, leaf);
+}
+
+template<typename F, typename Tuple, size_t... I>
+__inline void join_pools_range_unpack(uint32_t first, uint32_t last, F& function, Tuple& args, std::index_sequence<I...> seq)
+{
+	join_pools_range_impl(first, last, function, seq, std::get<I>(args)...);
+}
+
+//join_pools_range(first, last, &poolA, &poolB, ... , function)
+//join_pools restricted to the entities whose index (entity & 0xFFFFF) is in [first, last). Subtrees outside the range are never touched
+template<typename... Args>
+void join_pools_range(uint32_t first, uint32_t last, Args&&... args)
+{
+	constexpr size_t npools = sizeof...(Args) - 1;
+	static_assert(npools > 0, "join_pools_range needs at least one pool and a function");
+
+	if (first >= last)
+	{
+		return;
+	}
+	auto argtuple = std::forward_as_tuple(std::forward<Args>(args)...);
+
+	join_pools_range_unpack(first, last - 1, std::get<npools>(argtuple), argtuple, std::make_index_sequence<npools>{});
+}
+
+//size of the intersection of N trees. Only bitmasks and populations are read, never the leaf values.
+//A subtree where every node but one is full has the population of that one, without walking it
+template<int Depth, size_t N>
+size_t count_joined_recursive(const std::array<ByteNode*, N>& nodes)
+{
+	if constexpr (Depth == 1)
+	{
+		uint64_t out_bitmask[4];
+		merge_node_bitmasks(nodes, &out_bitmask[0]);
+		return popcount64(out_bitmask[0]) + popcount64(out_bitmask[1]) + popcount64(out_bitmask[2]) + popcount64(out_bitmask[3]);
+	}
+	else
+	{
+		constexpr uint32_t full_population = uint32_t(1) << (8 * Depth);
+		int npartial = 0;
+		uint32_t population = full_population;
+		for (ByteNode* node : nodes)
+		{
+			if (node->population < full_population)
+			{
+				npartial++;
+				population = node->population;
 			}
-			//pop
-			stack_head--;
-			current_depth++;
 		}
+		if (npartial <= 1)
+		{
+			return population;
+		}
+
+		uint64_t out_bitmask[4];
+		if (!merge_node_bitmasks(nodes, &out_bitmask[0]))
+		{
+			return 0;
+		}
+
+		size_t count = 0;
+		bitmask_optimal_iterate(&out_bitmask[0], 4, [&](uint32_t index) {
+			count += count_joined_recursive<Depth - 1>(gather_child_nodes(nodes, index, std::make_index_sequence<N>{}));
+		});
+		return count;
 	}
-	return;
 }
 
-bool remove_tree_val(const ByteTree* tree, uint32_t index)
+//count_joined(&poolA, &poolB, ...), the number of entities join_pools would call its function for
+template<typename... Pools>
+size_t count_joined(Pools*... pools)
 {
-	int level = tree->depth;
-	ByteNode* node = tree->root;
+	if constexpr (sizeof...(Pools) == 1)
+	{
+		return tree_size(&pools->tree...);
+	}
+	else
+	{
+		return count_joined_recursive<3>(std::array<ByteNode*, sizeof...(Pools)>{ pools->tree.root... });
+	}
+}
 
-	bool bclear = false;
-	return remove_tree_recursive(node, index, level, bclear);
+enum class JoinStrategy : uint8_t
+{
+	//walk every tree together from the root, merging their bitmasks on every level
+	Intersect,
+	//go through the Reverse array of the smallest pool and look every entity up in the other trees
+	Probe,
+	//decide for every subtree below the root: where the smallest pool is sparse walk only its leaves and look up the
+	//leaves of the other trees once per leaf, elsewhere intersect
+	Hybrid
+};
+
+__inline const char* join_strategy_name(JoinStrategy strategy)
+{
+	switch (strategy)
+	{
+	case JoinStrategy::Probe: return "probe";
+	case JoinStrategy::Hybrid: return "hybrid";
+	default: return "intersect";
+	}
 }
 
+//the smallest pool only drives the join if the others are at least this many times bigger
+constexpr size_t join_driver_ratio = 16;
+//a leaf visited by the intersection of N trees costs about this many lookups of an entity in N trees
+constexpr size_t join_leaf_lookup_cost = 2;
 
-template<typename T>
-struct ComponentPool
+struct JoinPlan
 {
-	ByteTree tree;
-	std::vector<T> Dense;
-	std::vector<uint32_t> Reverse;
+	JoinStrategy strategy;
+	//position of the pool that drives Probe and Hybrid, the smallest one
+	uint32_t driver;
+	size_t driver_size;
+	size_t driver_leaves;
+	//size of the smallest of the other pools
+	size_t others_size;
+	//root keys of the subtrees the driver walks alone in Hybrid, the other subtrees are intersected
+	uint64_t driven_subtrees[4];
 };
-template<typename T>
-void remove_pool_element(ComponentPool<T>* pool, uint32_t entity)
+
+//true if a driver with size elements in leaves leaves should be looked up in the other pools instead of intersected.
+//Probing costs a lookup per element in every other tree, the intersection a merge per leaf in every tree
+__inline bool should_drive_join(size_t size, size_t leaves, size_t others_size, size_t npools)
 {
-	uint32_t index = entity & 0xFFFFF;
+	const bool bsparse = size * (npools - 1) <= leaves * npools * join_leaf_lookup_cost;
+	return npools > 1 && bsparse && size * join_driver_ratio <= others_size;
+}
 
-	uint64_t val;
-	if (get_tree_val(&pool->tree, index, val))
+//picks how to join the pools from their sizes and the leaf counts of the smallest one, subtree by subtree below the root.
+//The intersection never visits more leaves than the smallest pool has, so it stays the best choice unless that pool
+//is much smaller than the rest and has few elements per leaf, then looking its elements up in the big trees is cheaper.
+//Probe if that holds in every subtree the pools share, Intersect if it holds in none, Hybrid if it holds in some.
+//Tag pools have no Reverse array to probe from, they drive with Hybrid
+template<typename... Pools>
+JoinPlan plan_join(Pools*... pools)
+{
+	constexpr size_t N = sizeof...(Pools);
+	const size_t sizes[N] = { pool_size(pools)... };
+	const bool btags[N] = { is_tag_pool<Pools>::value... };
+
+	JoinPlan plan;
+	plan.strategy = JoinStrategy::Intersect;
+	plan.driver = 0;
+	for (uint32_t i = 1; i < N; i++)
 	{
-		if (pool->Reverse[val] == entity)
+		if (sizes[i] < sizes[plan.driver])
 		{
-			auto dense_end = pool->Dense.size() - 1;
-			auto reverse_end = pool->Reverse.size() - 1;
-
-			//swap with last
-			uint32_t swap_et = pool->Reverse[reverse_end];
-			pool->Reverse[val] = pool->Reverse[reverse_end];
-			pool->Dense[val] = pool->Dense[dense_end];
+			plan.driver = i;
+		}
+	}
+	plan.driver_size = sizes[plan.driver];
+	plan.others_size = std::numeric_limits<size_t>::max();
+	for (uint32_t i = 0; i < N; i++)
+	{
+		if (i != plan.driver)
+		{
+			plan.others_size = std::min(plan.others_size, sizes[i]);
+		}
+	}
 
-			pool->Dense.pop_back();
-			pool->Reverse.pop_back();
+	ByteNode* const roots[N] = { pools->tree.root... };
+	plan.driver_leaves = 0;
+	memset(plan.driven_subtrees, 0, sizeof(plan.driven_subtrees));
+	int ndriven = 0;
+	int nintersected = 0;
+	bitmask_optimal_iterate(&roots[plan.driver]->bytemask[0], 4, [&](uint32_t key) {
+		ByteNode* driver_subtree = node_child(roots[plan.driver], uint8_t(key));
+		const size_t leaves = size_t(node_child_count(driver_subtree));
+		plan.driver_leaves += leaves;
+
+		//only the inner nodes below the root are read, for their populations
+		size_t others = std::numeric_limits<size_t>::max();
+		for (uint32_t i = 0; i < N; i++)
+		{
+			if (i != plan.driver)
+			{
+				others = std::min<size_t>(others, get_node_mask_at(roots[i], uint8_t(key)) ? node_population(node_child(roots[i], uint8_t(key)), 2) : 0);
+			}
+		}
+		if (others == 0)
+		{
+			return;
+		}
+		if (should_drive_join(node_population(driver_subtree, 2), leaves, others, N))
+		{
+			plan.driven_subtrees[key >> 6] |= uint64_t(1) << (key & 63);
+			ndriven++;
+		}
+		else
+		{
+			nintersected++;
+		}
+	});
 
-			uint32_t swap_index = swap_et & 0xFFFFF;
+	if (ndriven > 0)
+	{
+		plan.strategy = (nintersected > 0 || btags[plan.driver]) ? JoinStrategy::Hybrid : JoinStrategy::Probe;
+	}
+	return plan;
+}
 
-			add_tree_val(&pool->tree, swap_index, val);
-		}
+template<bool bDriver, typename Pool>
+__inline decltype(auto) probe_join_element(Pool* pool, ByteNode* leaf, uint32_t key, size_t dense_index)
+{
+	if constexpr (bDriver)
+	{
+		return pool_dense_element(pool, dense_index);
+	}
+	else
+	{
+		return pool_join_element(pool, leaf, key);
 	}
 }
-template<typename T>
-bool get_pool_element(ComponentPool<T>* pool, uint32_t entity, T& value)
+
+template<size_t D, typename F, size_t... I, typename... Pools>
+void join_pools_probe(F& function, std::index_sequence<I...>, Pools*... pools)
 {
-	uint32_t index = entity & 0xFFFFF;
+	constexpr size_t N = sizeof...(Pools);
+	auto* driver = std::get<D>(std::forward_as_tuple(pools...));
 
-	uint64_t val;
-	if (get_tree_val(&pool->tree, index, val))
+	if constexpr (!is_tag_pool<std::remove_pointer_t<decltype(driver)>>::value)
 	{
-		if (pool->Reverse[val] == entity)
+		for (size_t i = 0; i < pool_size(driver); i++)
 		{
-			value = pool->Dense[val];
-			return true;
+			const uint32_t entity = driver->Reverse[i];
+			const uint8_t key = uint8_t(entity);
+
+			//the driver element is read by its dense index, only the other trees are walked
+			std::array<ByteNode*, N> leaves;
+			if (((I == D || ((leaves[I] = find_tree_leaf_node(&pools->tree, entity & 0xFFFFF)) && get_node_mask_at(leaves[I], key))) && ...))
+			{
+				function(entity, probe_join_element<I == D>(pools, leaves[I], key, i)...);
+				((join_writes_pool<I, F>() ? mark_joined_element(pools, entity) : void()), ...);
+			}
 		}
 	}
+}
+
+//calls function(leaf_index, leaf) for every leaf of a subtree, without merging anything
+template<int Depth, typename F>
+void iterate_tree_leaves_recursive(ByteNode* node, uint32_t base_index, F& function)
+{
+	if constexpr (Depth == 1)
+	{
+		function(base_index, node);
+	}
 	else
 	{
-		return false;
+		bitmask_optimal_iterate(&node->bytemask[0], 4, [&](uint32_t index) {
+			iterate_tree_leaves_recursive<Depth - 1>(node_child(node, uint8_t(index)), (base_index | index) << 8, function);
+		});
 	}
 }
-template<typename T>
-__inline T& get_pool_element_raw(ComponentPool<T>* pool, uint32_t index)
+
+template<size_t D, typename F, size_t... I, typename... Pools>
+void join_pools_hybrid(F& function, const JoinPlan& plan, std::index_sequence<I...> seq, Pools*... pools)
 {
-	uint64_t val;
-	bool found = get_tree_val(&pool->tree, index, val);
-	assert(found);
+	constexpr size_t N = sizeof...(Pools);
+	constexpr size_t E = join_entity_pool<Pools...>();
+	auto* entity_pool = std::get<E>(std::forward_as_tuple(pools...));
+	const std::array<ByteNode*, N> roots = { pools->tree.root... };
+
+	std::array<ByteNode*, N> subtrees;
+	auto probe_leaf = [&](uint32_t leaf_index, ByteNode* driver_leaf) {
+
+		//one lookup per pool for the whole leaf, then the keys of the driver are merged with the other leaves
+		const uint8_t leaf_key = uint8_t(leaf_index >> 8);
+		std::array<ByteNode*, N> leaves;
+		uint64_t joined[4];
+		if (((leaves[I] = (I == D) ? driver_leaf : (get_node_mask_at(subtrees[I], leaf_key) ? node_child(subtrees[I], leaf_key) : nullptr)) && ...)
+			&& merge_node_bitmasks(leaves, &joined[0]))
+		{
+			bitmask_optimal_iterate(&joined[0], 4, [&](uint32_t key) {
+				function(pool_join_entity(entity_pool, leaves[E], leaf_index, key), pool_join_element(pools, leaves[I], key)...);
+			});
+			((join_writes_pool<I, F>() ? mark_joined_leaf(pools, leaf_index, &joined[0]) : void()), ...);
+		}
+	};
+	auto join_leaf = make_join_leaf(function, seq, pools...);
 
-	return pool->Dense[val];
+	uint64_t common[4];
+	merge_node_bitmasks(roots, &common[0]);
+	bitmask_optimal_iterate(&common[0], 4, [&](uint32_t key) {
+		subtrees = gather_child_nodes(roots, key, std::make_index_sequence<N>{});
+		if ((plan.driven_subtrees[key >> 6] >> (key & 63)) & 0x1)
+		{
+			iterate_tree_leaves_recursive<2>(subtrees[D], key << 8, probe_leaf);
+		}
+		else
+		{
+			iterate_joined_recursive<2>(subtrees, key << 8, join_leaf);
+		}
+	});
 }
 
-template<typename T>
-__inline uint32_t& get_pool_entity_from_index(ComponentPool<T>* pool, uint32_t index)
+template<typename F, size_t... I, typename... Pools>
+JoinPlan join_pools_planned_impl(F& function, std::index_sequence<I...> seq, Pools*... pools)
 {
-	uint64_t val;
-	bool found = get_tree_val(&pool->tree, index, val);
-	assert(found);
+	const JoinPlan plan = plan_join(pools...);
+	switch (plan.strategy)
+	{
+	case JoinStrategy::Probe:
+		((plan.driver == I ? join_pools_probe<I>(function, seq, pools...) : void()), ...);
+		break;
+	case JoinStrategy::Hybrid:
+		((plan.driver == I ? join_pools_hybrid<I>(function, plan, seq, pools...) : void()), ...);
+		break;
+	default:
+		join_pools_impl(function, ChangedPools<0>{}, ExcludePools<0>{}, seq, pools...);
+		break;
+	}
+	return plan;
+}
 
-	return pool->Reverse[val];
+template<typename F, typename Tuple, size_t... I>
+__inline JoinPlan join_pools_planned_unpack(F& function, Tuple& args, std::index_sequence<I...> seq)
+{
+	return join_pools_planned_impl(function, seq, std::get<I>(args)...);
+}
+
+//join_pools_planned(&poolA, &poolB, ... , function)
+//same matches as join_pools, with the strategy picked by plan_join, which is returned so it can be checked.
+//Probe calls function in the dense order of the driver instead of in tree order, with the entity handle of the driver
+template<typename... Args>
+JoinPlan join_pools_planned(Args&&... args)
+{
+	constexpr size_t npools = sizeof...(Args) - 1;
+	static_assert(npools > 0, "join_pools_planned needs at least one pool and a function");
+
+	auto argtuple = std::forward_as_tuple(std::forward<Args>(args)...);
+
+	return join_pools_planned_unpack(std::get<npools>(argtuple), argtuple, std::make_index_sequence<npools>{});
 }
 
+//entries of a chunked join, the matches of one 64 bit word of a leaf. A component type can be const,
+//JoinChunk<const A, B> reads A and writes B
+template<typename... Ts>
+struct JoinChunk
+{
+	int count;
+	uint32_t entities[64];
+	//dense index of every entry, per pool
+	uint32_t indices[sizeof...(Ts)][64];
+	//if bcontiguous, the entries of every pool are consecutive in its Dense array and dense points to the first of them,
+	//so they can be read as plain arrays. Otherwise dense points to the start of each Dense array and indices has to be used
+	bool bcontiguous;
+	std::tuple<Ts*...> dense;
+};
 
-template<typename T>
-void add_pool_element(ComponentPool<T>* pool, uint32_t entity, const T& value)
+//component I of entry i of the chunk
+template<size_t I, typename... Ts>
+__inline auto& join_chunk_component(JoinChunk<Ts...>& chunk, int i)
 {
-	uint32_t index = entity & 0xFFFFF;
+	return chunk.bcontiguous ? std::get<I>(chunk.dense)[i] : std::get<I>(chunk.dense)[chunk.indices[I][i]];
+}
 
-	uint64_t val;
-	//already in set, replace
-	if (get_tree_val(&pool->tree, index, val))
+//the chunk a chunked join callback takes, JoinChunk<Ts...> for generic callbacks
+template<typename Arguments, typename... Ts>
+struct join_chunk_type
+{
+	using type = JoinChunk<Ts...>;
+};
+template<typename... U, typename... Ts>
+struct join_chunk_type<std::tuple<JoinChunk<U...>&>, Ts...>
+{
+	static_assert((std::is_same_v<std::remove_const_t<U>, Ts> && ...), "the chunk has the component types of the pools");
+	using type = JoinChunk<U...>;
+};
+
+//true if the chunk hands out the column of pool I writable
+template<size_t I, typename... U>
+constexpr bool chunk_writes_pool(const JoinChunk<U...>*)
+{
+	return !std::is_const_v<std::tuple_element_t<I, std::tuple<U...>>>;
+}
+
+//reads the values of the keys of a leaf word into indices, returns true if they are consecutive
+template<typename V>
+__inline bool gather_chunk_indices(ByteNode* node, int word, const uint8_t* keys, int count, uint32_t* indices)
+{
+	const V* vals = node_vals<V>(node);
+	uint32_t mismatch = 0;
+	if (node->kind == node_kind_full)
 	{
-		if constexpr  (sizeof(T) > 0)
+		const V* wordvals = vals + word * 64;
+		const uint32_t base = wordvals[keys[0]];
+		for (int i = 0; i < count; i++)
 		{
-			if (pool->Reverse[val] == entity)
-			{
-				pool->Dense[val] = value;
-			}
-		}		
+			const uint32_t index = wordvals[keys[i]];
+			indices[i] = index;
+			mismatch |= index ^ (base + i);
+		}
 	}
 	else
 	{
-		pool->Reverse.push_back(entity);
-		if constexpr  (sizeof(T) > 0)
+		for (int i = 0; i < count; i++)
 		{
-			pool->Dense.push_back(value);
-		}		
-
-		auto dense_end = pool->Dense.size() - 1;
-		add_tree_val(&pool->tree, index, dense_end);
+			indices[i] = vals[node_slot(node, uint8_t(word * 64 + keys[i]))];
+		}
+		for (int i = 0; i < count; i++)
+		{
+			mismatch |= indices[i] ^ (indices[0] + i);
+		}
 	}
+	return mismatch == 0;
 }
 
-template<typename A, typename B, typename F>
-void join_pools(ComponentPool<A>* poolA, ComponentPool<B>* poolB, F&& function)
+template<typename F, size_t... I, typename... Ts, typename... Vs>
+void join_pools_chunked_impl(F& function, std::index_sequence<I...>, ComponentPool<Ts, Vs>*... pools)
 {
+	constexpr size_t N = sizeof...(Ts);
+	const std::array<ByteNode*, N> rootnodes = { pools->tree.root... };
+	auto* first = std::get<0>(std::forward_as_tuple(pools...));
 
-	ByteTree trees[] = { poolA->tree, poolB->tree };
-
-	iterate_joined_trees(trees, 2, [&](uint32_t id, ByteNode** nodes) {
-
-#ifndef _PERF_TRYHARD
-		auto eid = poolA->Reverse[nodes[0]->vals[id]];
-		A& cA = poolA->Dense[nodes[0]->vals[id]];
-		B& cB = poolB->Dense[nodes[1]->vals[id]];
+	typename join_chunk_type<typename join_callback_arguments<std::decay_t<F>>::type, Ts...>::type chunk;
 
-		function(eid, cA, cB);
-#else
-		uint64_t* bitmasks[2] = { &nodes[0]->bytemask[0] ,&nodes[1]->bytemask[0] };
+	auto leaf = [&](uint32_t leaf_index, const std::array<ByteNode*, N>& nodes) {
 
 		uint64_t out_bitmask[4];
-		merge_bitmasks(&bitmasks[0], &out_bitmask[0], 2, 4);
-
-		uint8_t indices[64];
-		uint8_t nindices;
+		if (!merge_node_bitmasks(nodes, &out_bitmask[0]))
+		{
+			return;
+		}
 
-		int count = 4;
-		for(int idx = 0; idx < count; idx++)
+		uint8_t keys[64 + 8];
+		for (int word = 0; word < 4; word++)
 		{
-			const int begin = idx * 64;
-			if(out_bitmask[idx] != 0)
+			if (out_bitmask[word] == 0)
 			{
-				nindices = 0;
-				for (int i = 0; i < 64; i++)
-				{
-					uint64_t mask = (uint64_t(0x1) << i);
-
-					if (out_bitmask[idx] & mask)
-					{
-						indices[nindices++] = i;
-					}
-				}
-				{
-					constexpr int prefetch = 0;
-					if (prefetch > 0) {
-
-						int j = 0;
-						for (j; j < nindices - prefetch; j++) {
-
-							int index = begin + indices[j];
-							int nxindex = begin + indices[j + 3];
-
-							_mm_prefetch((char*)& poolA->Reverse[nodes[0]->vals[nxindex]], 0);
-							_mm_prefetch((char*)& poolA->Dense[nodes[0]->vals[nxindex]], 0);
-							_mm_prefetch((char*)& poolB->Dense[nodes[0]->vals[nxindex]], 0);
-
-							auto eid = poolA->Reverse[nodes[0]->vals[index]];
-							A& cA = poolA->Dense[nodes[0]->vals[index]];
-							B& cB = poolB->Dense[nodes[1]->vals[index]];
-
-							function(eid, cA, cB);
-						}
-						for ( j ; j < nindices - 3; j++) {
-							int index = begin + indices[j];
-
-							auto eid = poolA->Reverse[nodes[0]->vals[index]];
-							A& cA = poolA->Dense[nodes[0]->vals[index]];
-							B& cB = poolB->Dense[nodes[1]->vals[index]];
-
-							function(eid, cA, cB);
-						}
-					}
-					else {
-						for (int j = 0; j < nindices; j++) {
-							int index = begin + indices[j];
+				continue;
+			}
 
-							auto eid = poolA->Reverse[nodes[0]->vals[index]];
-							A& cA = poolA->Dense[nodes[0]->vals[index]];
-							B& cB = poolB->Dense[nodes[1]->vals[index]];
+			chunk.count = expand_bitmask_indices(out_bitmask[word], &keys[0]);
+			//every pool has to be gathered, no short circuit
+			chunk.bcontiguous = (gather_chunk_indices<Vs>(nodes[I], word, &keys[0], chunk.count, chunk.indices[I]) & ...);
 
-							function(eid, cA, cB);
-						}
-					}
-				}
+			for (int i = 0; i < chunk.count; i++)
+			{
+				chunk.entities[i] = first->Reverse[chunk.indices[0][i]];
 			}
+			chunk.dense = std::make_tuple((chunk.bcontiguous ? &pools->Dense[chunk.indices[I][0]] : pools->Dense.data())...);
+
+			function(chunk);
 		}
 
-#endif
-		});
+		((chunk_writes_pool<I>(&chunk) ? mark_joined_leaf(pools, leaf_index, &out_bitmask[0]) : void()), ...);
+	};
+	iterate_joined_recursive<3>(rootnodes, 0, leaf);
 }
-template<typename A, typename B, typename C,typename F>
-void join_pools(ComponentPool<A>* poolA, ComponentPool<B>* poolB, ComponentPool<C>* poolC, F&& function)
-{
 
-	ByteTree trees[] = { poolA->tree, poolB->tree ,poolC->tree};
+template<typename F, typename Tuple, size_t... I>
+__inline void join_pools_chunked_unpack(F& function, Tuple& args, std::index_sequence<I...> seq)
+{
+	join_pools_chunked_impl(function, seq, std::get<I>(args)...);
+}
 
-	iterate_joined_trees(trees, 3, [&](uint32_t id, ByteNode** nodes) {
+//join_pools_chunked(&poolA, &poolB, ... , function)
+//same matches as join_pools, but function(JoinChunk<A, B, ...>& chunk) is called with up to 64 entities at a time.
+//pools sorted with sort_pool_by_index give contiguous chunks, that can be processed as arrays.
+//Pools that track changes get the chunks marked as changed unless the callback takes their type as const, JoinChunk<const A, ...>
+template<typename... Args>
+void join_pools_chunked(Args&&... args)
+{
+	constexpr size_t npools = sizeof...(Args) - 1;
+	static_assert(npools > 0, "join_pools_chunked needs at least one pool and a function");
 
-#ifndef _PERF_TRYHARD
-		auto eid = poolA->Reverse[nodes[0]->vals[id]];
-		A& cA = poolA->Dense[nodes[0]->vals[id]];
-		B& cB = poolB->Dense[nodes[1]->vals[id]];
-		C& cC = poolC->Dense[nodes[2]->vals[id]];
-		function(eid, cA, cB,cC);
-#else
-		uint64_t* bitmasks[3] = { &nodes[0]->bytemask[0] ,&nodes[1]->bytemask[0],&nodes[2]->bytemask[0] };
+	auto argtuple = std::forward_as_tuple(std::forward<Args>(args)...);
 
-		uint64_t out_bitmask[4];
-		merge_bitmasks(&bitmasks[0], &out_bitmask[0], 3, 4);
+	join_pools_chunked_unpack(std::get<npools>(argtuple), argtuple, std::make_index_sequence<npools>{});
+}
 
-		uint8_t indices[64];
-		uint8_t nindices;
+//calls function(entity, T&) for every element of the pool marked as changed
+template<typename T, typename V, typename F>
+void iterate_changed(ComponentPool<T, V>* pool, F&& function)
+{
+	if (is_tracking_changes(pool))
+	{
+		join_pools(pool, changed_pools(pool), function);
+	}
+}
 
-		int count = 4;
-		for (int idx = 0; idx < count; idx++)
-		{
-			const int begin = idx * 64;
-			if (out_bitmask[idx] != 0)
-			{
-				nindices = 0;
-				for (int i = 0; i < 64; i++)
-				{
-					uint64_t mask = (uint64_t(0x1) << i);
+template<typename T>
+void add_pool_element(TagPool<T>* pool, uint32_t entity, const T& = T{})
+{
+	if (add_tree_key(&pool->tree, entity & 0xFFFFF))
+	{
+		pool->count++;
+		notify_added(pool->listeners, entity);
+	}
+}
 
-					if (out_bitmask[idx] & mask)
-					{
-						indices[nindices++] = i;
-					}
-				}
-				{
-					constexpr int prefetch = 0;
-					if (prefetch > 0) {
+template<typename T>
+void add_pool_elements(TagPool<T>* pool, const uint32_t* entities, const T*, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		add_pool_element(pool, entities[i]);
+	}
+}
 
-						int j = 0;
-						for (j; j < nindices - prefetch; j++) {
-					
-							const int index = begin + indices[j];
-							const int nxindex = begin + indices[j + prefetch];							
-							
-							const auto iA = nodes[0]->vals[index];
-							const auto iB = nodes[1]->vals[index];
-							const auto iC = nodes[2]->vals[index];
-
-							auto eid = poolA->Reverse[iA];
-
-							A& cA = poolA->Dense[iA];
-							
-							B& cB = poolB->Dense[iB];
-							
-							C& cC = poolC->Dense[iC];	
-
-							const auto iAp = nodes[0]->vals[nxindex];
-							const auto iBp = nodes[1]->vals[nxindex];
-							const auto iCp = nodes[2]->vals[nxindex];
-
-							_mm_prefetch((char*)&poolA->Reverse[iAp], 0);
-							_mm_prefetch((char*)&poolA->Dense[iAp], 0);
-							_mm_prefetch((char*)&poolB->Dense[iBp], 0);
-							_mm_prefetch((char*)&poolC->Dense[iCp], 0);
-
-							function(eid, cA, cB, cC);
-						}
-						for (j; j < nindices - prefetch; j++) {
-							int index = begin + indices[j];
-					
-							auto eid = poolA->Reverse[nodes[0]->vals[index]];
-							A& cA = poolA->Dense[nodes[0]->vals[index]];
-							B& cB = poolB->Dense[nodes[1]->vals[index]];
-							C& cC = poolC->Dense[nodes[2]->vals[index]];
+template<typename T>
+void remove_pool_element(TagPool<T>* pool, uint32_t entity)
+{
+	if (remove_tree_val(&pool->tree, entity & 0xFFFFF))
+	{
+		pool->count--;
+		notify_removed(pool->listeners, entity);
+	}
+}
 
-							function(eid, cA, cB, cC);
-						}
-					}
-					else 
-					{
-						for (int j = 0; j < nindices; j++) {
-							int index = begin + indices[j];
+template<typename T>
+void remove_pool_elements(TagPool<T>* pool, const uint32_t* entities, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		remove_pool_element(pool, entities[i]);
+	}
+}
 
-							auto eid = poolA->Reverse[nodes[0]->vals[index]];
-							A& cA = poolA->Dense[nodes[0]->vals[index]];
-							B& cB = poolB->Dense[nodes[1]->vals[index]];
-							C& cC = poolC->Dense[nodes[2]->vals[index]];
+template<typename T>
+bool has_pool_element(const TagPool<T>* pool, uint32_t entity)
+{
+	return has_tree_key(&pool->tree, entity & 0xFFFFF);
+}
 
-							function(eid, cA, cB, cC);
-						}
-					}			
-				}
-			}
-		}
+template<typename T>
+bool get_pool_element(TagPool<T>* pool, uint32_t entity, T& value)
+{
+	return has_pool_element(pool, entity);
+}
 
-#endif
-	});
+//all the elements of a tag pool share one empty value
+template<typename T>
+T* find_pool_element(TagPool<T>* pool, uint32_t entity)
+{
+	static T tag{};
+	return has_pool_element(pool, entity) ? &tag : nullptr;
 }
 
 template<typename T>
-ComponentPool<T> create_pool()
+void destroy_pool(TagPool<T>* pool)
 {
-	ComponentPool<T> pool;
-	pool.tree = create_bytetree();
+	destroy_bytetree(&pool->tree);
+	pool->count = 0;
+}
+
+//empty types get a TagPool, see pool_t
+template<typename T, typename V = uint32_t>
+pool_t<T, V> create_pool()
+{
+	pool_t<T, V> pool;
+	if constexpr (std::is_empty_v<T>)
+	{
+		pool.tree = create_bytetree<void>();
+		pool.count = 0;
+	}
+	else
+	{
+		pool.tree = create_bytetree<V>();
+		pool.changed.root = nullptr;
+	}
 	return pool;
 }
 
+template<typename T, typename V>
+void destroy_pool(ComponentPool<T, V>* pool)
+{
+	destroy_bytetree(&pool->tree);
+	if (is_tracking_changes(pool))
+	{
+		destroy_bytetree(&pool->changed);
+	}
+	pool->Dense.clear();
+	pool->Reverse.clear();
+}
+
+//deep copy of the elements of a pool, to keep an older state around. Changes and listeners are not copied
+template<typename T, typename V>
+ComponentPool<T, V> copy_pool(const ComponentPool<T, V>* pool)
+{
+	ComponentPool<T, V> copy;
+	copy.tree = clone_bytetree(&pool->tree);
+	copy.Dense = pool->Dense;
+	copy.Reverse = pool->Reverse;
+	copy.changed.root = nullptr;
+	return copy;
+}
+
@@ -0,0 +1,251 @@
+#pragma once
+
+#include "BitTree.h"
+#include "TaskPool.h"
+
+//commands of one thread for one pool. A command holds the entity in its low 32 bits and the index of its value
+//in the high ones, or command_no_value for a remove
+constexpr uint32_t command_no_value = 0xFFFFFFFF;
+
+struct CommandLane
+{
+	void* pool;
+	uint32_t value_bytes;
+	std::vector<uint64_t> commands;
+	std::vector<uint8_t> values;
+	//removes then adds with the batch paths of the pool type. Both lists come sorted by tree index
+	void (*apply)(void* pool, const uint32_t* removed, size_t nremoved, const uint32_t* added, const uint8_t* values, size_t nadded);
+};
+
+//commands recorded by one thread. Lanes are kept with their memory between flushes, only the first used_lanes are live
+struct alignas(64) CommandBuffer
+{
+	std::vector<CommandLane> lanes;
+	size_t used_lanes = 0;
+	size_t last_lane = 0;
+};
+
+//structural changes recorded during a join and applied later in one go. There is a buffer per thread of a task pool,
+//so recording never locks and never touches the pools. flush_commands runs once no thread is recording
+struct CommandQueue
+{
+	std::unique_ptr<CommandBuffer[]> buffers;
+	int buffer_count;
+
+	//flush scratch, kept between flushes
+	std::vector<uint64_t> order;
+	std::vector<std::pair<uint32_t, const uint8_t*>> flat;
+	std::vector<uint32_t> removed;
+	std::vector<uint32_t> added;
+	std::vector<uint8_t> added_values;
+};
+
+//nthreads buffers, use task_pool_thread_count to record from the tasks of a task pool
+CommandQueue create_command_queue(int nthreads = 1)
+{
+	CommandQueue queue;
+	queue.buffer_count = nthreads < 1 ? 1 : nthreads;
+	queue.buffers.reset(new CommandBuffer[queue.buffer_count]);
+	return queue;
+}
+
+void destroy_command_queue(CommandQueue* queue)
+{
+	queue->buffers.reset();
+	queue->buffer_count = 0;
+}
+
+//the buffer of the calling thread. Threads outside of a task pool share the last one with the thread that runs the tasks,
+//so only one of them may record at a time
+__inline CommandBuffer* thread_command_buffer(CommandQueue* queue)
+{
+	const int index = task_thread_index < 0 ? queue->buffer_count - 1 : task_thread_index;
+	assert(index < queue->buffer_count);
+	return &queue->buffers[index];
+}
+
+template<typename T, typename Pool>
+void apply_pool_commands(void* pool, const uint32_t* removed, size_t nremoved, const uint32_t* added, const uint8_t* values, size_t nadded)
+{
+	Pool* typed = static_cast<Pool*>(pool);
+	remove_pool_elements(typed, removed, nremoved);
+	add_pool_elements(typed, added, (const T*)values, nadded);
+}
+
+template<typename T, typename Pool>
+CommandLane* find_command_lane(CommandBuffer* buffer, Pool* pool)
+{
+	if (buffer->last_lane < buffer->used_lanes && buffer->lanes[buffer->last_lane].pool == pool)
+	{
+		return &buffer->lanes[buffer->last_lane];
+	}
+	for (size_t i = 0; i < buffer->used_lanes; i++)
+	{
+		if (buffer->lanes[i].pool == pool)
+		{
+			buffer->last_lane = i;
+			return &buffer->lanes[i];
+		}
+	}
+
+	if (buffer->used_lanes == buffer->lanes.size())
+	{
+		buffer->lanes.emplace_back();
+	}
+	buffer->last_lane = buffer->used_lanes++;
+	CommandLane* lane = &buffer->lanes[buffer->last_lane];
+	lane->pool = pool;
+	lane->value_bytes = std::is_empty_v<T> ? 0 : uint32_t(sizeof(T));
+	lane->apply = &apply_pool_commands<T, Pool>;
+	return lane;
+}
+
+template<typename T, typename Pool>
+__inline void record_command(CommandBuffer* buffer, Pool* pool, uint32_t entity, const T* value)
+{
+	static_assert(std::is_trivially_copyable_v<T>, "commands store the elements as raw bytes");
+	static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "flush gathers the values in a byte vector");
+
+	CommandLane* lane = find_command_lane<T>(buffer, pool);
+	uint32_t value_index = command_no_value;
+	if (value)
+	{
+		value_index = lane->value_bytes ? uint32_t(lane->values.size() / lane->value_bytes) : 0;
+		lane->values.insert(lane->values.end(), (const uint8_t*)value, (const uint8_t*)value + lane->value_bytes);
+	}
+	lane->commands.push_back((uint64_t(value_index) << 32) | entity);
+}
+
+//add_pool_element at flush time. It replaces the value of an entity that has the component already
+template<typename T, typename V>
+void defer_add_pool_element(CommandBuffer* buffer, ComponentPool<T, V>* pool, uint32_t entity, const T& value)
+{
+	record_command(buffer, pool, entity, &value);
+}
+template<typename T>
+void defer_add_pool_element(CommandBuffer* buffer, TagPool<T>* pool, uint32_t entity)
+{
+	static const T tag{};
+	record_command(buffer, pool, entity, &tag);
+}
+
+template<typename T, typename V>
+void defer_remove_pool_element(CommandBuffer* buffer, ComponentPool<T, V>* pool, uint32_t entity)
+{
+	record_command<T>(buffer, pool, entity, nullptr);
+}
+template<typename T>
+void defer_remove_pool_element(CommandBuffer* buffer, TagPool<T>* pool, uint32_t entity)
+{
+	record_command<T>(buffer, pool, entity, nullptr);
+}
+
+//applies the commands of every buffer and empties them. The commands of a pool are sorted by tree index and go through
+//its batch paths, removes first. When an entity has several commands only the last one counts, in recording order for
+//one thread and in buffer order across threads
+void flush_commands(CommandQueue* queue)
+{
+	for (int b = 0; b < queue->buffer_count; b++)
+	{
+		CommandBuffer* buffer = &queue->buffers[b];
+		for (size_t l = 0; l < buffer->used_lanes; l++)
+		{
+			CommandLane* first = &buffer->lanes[l];
+			if (!first->pool)
+			{
+				continue;
+			}
+			void* pool = first->pool;
+
+			//the commands of every lane of this pool, from this buffer on
+			queue->flat.clear();
+			for (int ob = b; ob < queue->buffer_count; ob++)
+			{
+				CommandBuffer* other = &queue->buffers[ob];
+				for (size_t ol = (ob == b ? l : 0); ol < other->used_lanes; ol++)
+				{
+					CommandLane* lane = &other->lanes[ol];
+					if (lane->pool != pool)
+					{
+						continue;
+					}
+					for (uint64_t command : lane->commands)
+					{
+						//adds to pools without values still need a non null value
+						static const uint8_t no_bytes = 0;
+						const uint32_t value_index = uint32_t(command >> 32);
+						const uint8_t* value = (value_index == command_no_value) ? nullptr
+							: lane->value_bytes ? lane->values.data() + size_t(value_index) * lane->value_bytes : &no_bytes;
+						queue->flat.push_back({ uint32_t(command), value });
+					}
+					lane->pool = nullptr;
+				}
+			}
+
+			queue->order.resize(queue->flat.size());
+			for (size_t i = 0; i < queue->flat.size(); i++)
+			{
+				queue->order[i] = (uint64_t(queue->flat[i].first & 0xFFFFF) << 32) | i;
+			}
+			radix_sort_tree_indices(queue->order);
+
+			queue->removed.clear();
+			queue->added.clear();
+			queue->added_values.clear();
+			const uint32_t value_bytes = first->value_bytes;
+			for (size_t i = 0; i < queue->order.size();)
+			{
+				const uint64_t index = queue->order[i] >> 32;
+				size_t end = i + 1;
+				while (end < queue->order.size() && (queue->order[end] >> 32) == index)
+				{
+					end++;
+				}
+
+				//the group is rekeyed by (entity, position) so the commands of each handle end up together, oldest first.
+				//Only the last command of each run counts
+				if (end - i > 1)
+				{
+					for (size_t j = i; j < end; j++)
+					{
+						const uint32_t position = uint32_t(queue->order[j]);
+						queue->order[j] = (uint64_t(queue->flat[position].first) << 32) | position;
+					}
+					std::sort(queue->order.begin() + i, queue->order.begin() + end);
+				}
+				for (size_t j = i; j < end; j++)
+				{
+					if (j + 1 < end && (queue->order[j + 1] >> 32) == (queue->order[j] >> 32))
+					{
+						continue;
+					}
+					const std::pair<uint32_t, const uint8_t*>& command = queue->flat[uint32_t(queue->order[j])];
+					if (command.second)
+					{
+						queue->added.push_back(command.first);
+						queue->added_values.insert(queue->added_values.end(), command.second, command.second + value_bytes);
+					}
+					else
+					{
+						queue->removed.push_back(command.first);
+					}
+				}
+				i = end;
+			}
+
+			first->apply(pool, queue->removed.data(), queue->removed.size(), queue->added.data(), queue->added_values.data(), queue->added.size());
+		}
+	}
+
+	for (int b = 0; b < queue->buffer_count; b++)
+	{
+		CommandBuffer* buffer = &queue->buffers[b];
+		for (size_t l = 0; l < buffer->used_lanes; l++)
+		{
+			buffer->lanes[l].commands.clear();
+			buffer->lanes[l].values.clear();
+		}
+		buffer->used_lanes = 0;
+		buffer->last_lane = 0;
+	}
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+#include "BitTree.h"
+#include <thread>
+
+//elements of a CowPool live in fixed pages, so a write after a snapshot copies one page and not the whole array
+constexpr size_t cow_page_elements = 256;
+
+template<typename T>
+struct CowPage
+{
+	//owners besides the first, as ByteNode::shares. Not atomic, see CowPool
+	uint32_t shares;
+	T Dense[cow_page_elements];
+	uint32_t Reverse[cow_page_elements];
+};
+
+//the page list is shared as a whole too, so taking a snapshot touches no page
+template<typename T>
+struct CowPageTable
+{
+	//not atomic either
+	uint32_t shares;
+	std::vector<CowPage<T>*> pages;
+};
+
+//pool whose snapshots cost O(1) and then only what is written after them. snapshot_pool shares the tree and the pages,
+//a write copies the tree path and the page it touches. Joins hand out const elements, values are written with
+//find_pool_element.
+//Other threads can read a snapshot while the owning thread keeps writing the pool: writes copy the nodes and pages
+//they touch and only change the share counts of the shared ones, which readers never look at. The share counts are
+//plain integers, so taking snapshots, writing and destroying the pool or any of its snapshots stay on the thread that
+//created the pool, and a snapshot is only destroyed once no thread reads it. Debug builds assert the owning thread
+template<typename T, typename V = uint32_t>
+struct CowPool
+{
+	ByteTree<V> tree;
+	CowPageTable<T>* table;
+	size_t count;
+	std::thread::id owner;
+};
+
+template<typename T, typename V>
+__inline void assert_cow_owner(const CowPool<T, V>* pool)
+{
+	assert(pool->owner == std::this_thread::get_id());
+	(void)pool;
+}
+
+template<typename T, typename V = uint32_t>
+CowPool<T, V> create_cow_pool()
+{
+	CowPool<T, V> pool;
+	pool.tree = create_bytetree<V>();
+	pool.table = new CowPageTable<T>();
+	pool.count = 0;
+	pool.owner = std::this_thread::get_id();
+	return pool;
+}
+
+//a pool with the same elements, sharing everything with the original. Both can be written afterwards without seeing each other
+template<typename T, typename V>
+CowPool<T, V> snapshot_pool(CowPool<T, V>* pool)
+{
+	assert_cow_owner(pool);
+	CowPool<T, V> snapshot;
+	snapshot.tree = share_bytetree(&pool->tree);
+	pool->table->shares++;
+	snapshot.table = pool->table;
+	snapshot.count = pool->count;
+	snapshot.owner = pool->owner;
+	return snapshot;
+}
+
+template<typename T>
+__inline void release_cow_page(CowPage<T>* page)
+{
+	if (page->shares > 0)
+	{
+		page->shares--;
+	}
+	else
+	{
+		delete page;
+	}
+}
+
+//releases the pool, the nodes and pages a snapshot still uses stay alive for it
+template<typename T, typename V>
+void destroy_pool(CowPool<T, V>* pool)
+{
+	assert_cow_owner(pool);
+	destroy_bytetree(&pool->tree);
+	if (pool->table->shares > 0)
+	{
+		pool->table->shares--;
+	}
+	else
+	{
+		for (CowPage<T>* page : pool->table->pages)
+		{
+			release_cow_page(page);
+		}
+		delete pool->table;
+	}
+	pool->table = nullptr;
+	pool->count = 0;
+}
+
+//the page list of the pool, copied first if it is shared. The pages it lists gain an owner
+template<typename T, typename V>
+CowPageTable<T>* unshare_cow_table(CowPool<T, V>* pool)
+{
+	assert_cow_owner(pool);
+	CowPageTable<T>* table = pool->table;
+	if (table->shares > 0)
+	{
+		CowPageTable<T>* copy = new CowPageTable<T>();
+		copy->pages = table->pages;
+		for (CowPage<T>* page : copy->pages)
+		{
+			page->shares++;
+		}
+		shared_copied_bytes += copy->pages.size() * sizeof(CowPage<T>*);
+		table->shares--;
+		pool->table = copy;
+	}
+	return pool->table;
+}
+
+//the page of dense index, copied first if it is shared
+template<typename T, typename V>
+CowPage<T>* unshare_cow_page(CowPool<T, V>* pool, size_t dense_index)
+{
+	CowPage<T>*& page = unshare_cow_table(pool)->pages[dense_index / cow_page_elements];
+	if (page->shares > 0)
+	{
+		CowPage<T>* copy = new CowPage<T>(*page);
+		copy->shares = 0;
+		shared_copied_bytes += sizeof(CowPage<T>);
+		page->shares--;
+		page = copy;
+	}
+	return page;
+}
+
+template<typename T, typename V>
+__inline const T& cow_dense_element(const CowPool<T, V>* pool, size_t dense_index)
+{
+	return pool->table->pages[dense_index / cow_page_elements]->Dense[dense_index % cow_page_elements];
+}
+template<typename T, typename V>
+__inline uint32_t cow_dense_entity(const CowPool<T, V>* pool, size_t dense_index)
+{
+	return pool->table->pages[dense_index / cow_page_elements]->Reverse[dense_index % cow_page_elements];
+}
+
+template<typename T, typename V>
+__inline const T& pool_join_element(CowPool<T, V>* pool, ByteNode* leaf, uint32_t key)
+{
+	return cow_dense_element(pool, node_val<V>(leaf, key));
+}
+template<typename T, typename V>
+__inline const T& pool_dense_element(CowPool<T, V>* pool, size_t dense_index)
+{
+	return cow_dense_element(pool, dense_index);
+}
+template<typename T, typename V>
+__inline uint32_t pool_join_entity(CowPool<T, V>* pool, ByteNode* leaf, uint32_t /*leaf_index*/, uint32_t key)
+{
+	return cow_dense_entity(pool, node_val<V>(leaf, key));
+}
+template<typename T, typename V>
+__inline size_t pool_size(const CowPool<T, V>* pool)
+{
+	return pool->count;
+}
+
+template<typename T, typename V>
+bool has_pool_element(const CowPool<T, V>* pool, uint32_t entity)
+{
+	uint64_t val;
+	return get_tree_val(&pool->tree, entity & 0xFFFFF, val) && cow_dense_entity(pool, val) == entity;
+}
+
+template<typename T, typename V>
+bool get_pool_element(const CowPool<T, V>* pool, uint32_t entity, T& value)
+{
+	uint64_t val;
+	if (get_tree_val(&pool->tree, entity & 0xFFFFF, val) && cow_dense_entity(pool, val) == entity)
+	{
+		value = cow_dense_element(pool, val);
+		return true;
+	}
+	return false;
+}
+
+//copies the page of the element if a snapshot shares it, the pointer is only valid until the next snapshot
+template<typename T, typename V>
+T* find_pool_element(CowPool<T, V>* pool, uint32_t entity)
+{
+	assert_cow_owner(pool);
+	uint64_t val;
+	if (get_tree_val(&pool->tree, entity & 0xFFFFF, val) && cow_dense_entity(pool, val) == entity)
+	{
+		return &unshare_cow_page(pool, val)->Dense[val % cow_page_elements];
+	}
+	return nullptr;
+}
+
+template<typename T, typename V>
+void add_pool_element(CowPool<T, V>* pool, uint32_t entity, const T& value)
+{
+	assert_cow_owner(pool);
+	uint32_t index = entity & 0xFFFFF;
+
+	uint64_t val;
+	//already in set, replace
+	if (get_tree_val(&pool->tree, index, val))
+	{
+		if (cow_dense_entity(pool, val) == entity)
+		{
+			unshare_cow_page(pool, val)->Dense[val % cow_page_elements] = value;
+		}
+	}
+	else
+	{
+		assert(pool->count <= std::numeric_limits<V>::max());
+		if (pool->count % cow_page_elements == 0)
+		{
+			unshare_cow_table(pool)->pages.push_back(new CowPage<T>());
+		}
+		CowPage<T>* page = unshare_cow_page(pool, pool->count);
+		page->Dense[pool->count % cow_page_elements] = value;
+		page->Reverse[pool->count % cow_page_elements] = entity;
+
+		add_shared_tree_val(&pool->tree, index, pool->count);
+		pool->count++;
+	}
+}
+
+template<typename T, typename V>
+void remove_pool_element(CowPool<T, V>* pool, uint32_t entity)
+{
+	assert_cow_owner(pool);
+	uint32_t index = entity & 0xFFFFF;
+
+	uint64_t val;
+	if (get_tree_val(&pool->tree, index, val) && cow_dense_entity(pool, val) == entity)
+	{
+		const size_t last = pool->count - 1;
+		if (val != last)
+		{
+			//the last element moves into the hole
+			CowPage<T>* page = unshare_cow_page(pool, val);
+			const CowPage<T>* last_page = pool->table->pages[last / cow_page_elements];
+			const uint32_t swap_et = last_page->Reverse[last % cow_page_elements];
+			page->Dense[val % cow_page_elements] = last_page->Dense[last % cow_page_elements];
+			page->Reverse[val % cow_page_elements] = swap_et;
+			add_shared_tree_val(&pool->tree, swap_et & 0xFFFFF, val);
+		}
+		if (last % cow_page_elements == 0)
+		{
+			CowPageTable<T>* table = unshare_cow_table(pool);
+			release_cow_page(table->pages.back());
+			table->pages.pop_back();
+		}
+		pool->count--;
+
+		remove_shared_tree_val(&pool->tree, index);
+	}
+}
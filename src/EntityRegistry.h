@@ -0,0 +1,187 @@
+#pragma once
+
+#include "BitTree.h"
+
+//entity handles are 20 bits of index, used by the pools as the tree index, and 12 bits of generation
+constexpr uint32_t entity_index_bits = 20;
+constexpr uint32_t entity_index_mask = 0xFFFFF;
+constexpr uint32_t entity_generation_mask = 0xFFF;
+constexpr uint32_t entity_max_count = entity_index_mask + 1;
+
+__inline uint32_t entity_index(uint32_t entity)
+{
+	return entity & entity_index_mask;
+}
+__inline uint32_t entity_generation(uint32_t entity)
+{
+	return entity >> entity_index_bits;
+}
+__inline uint32_t make_entity(uint32_t index, uint32_t generation)
+{
+	return ((generation & entity_generation_mask) << entity_index_bits) | index;
+}
+
+//type erased pool, so destroy can remove an entity from every pool it was registered with
+struct RegisteredPool
+{
+	void* pool;
+	void (*remove)(void* pool, uint32_t entity);
+};
+
+struct EntityRegistry
+{
+	//handle of every index. Destroy bumps the generation in place, so a stale handle never matches. The bumped handle
+	//of a free index is the one create will hand out, it is not valid until then
+	std::vector<uint32_t> handles;
+	size_t alive_count = 0;
+
+	//destroyed indices as a 3 level bitmask, same fanout as the trees. Reusing the lowest index first keeps the pools trees dense
+	std::vector<uint64_t> free_bits;
+	std::vector<uint64_t> free_words;
+	uint64_t free_top[entity_max_count / (64 * 64 * 64)] = {};
+
+	std::vector<RegisteredPool> pools;
+};
+
+void push_free_index(EntityRegistry* registry, uint32_t index)
+{
+	const uint32_t word = index >> 6;
+	const uint32_t summary = word >> 6;
+	if (registry->free_bits.size() <= word)
+	{
+		registry->free_bits.resize(word + 1, 0);
+		registry->free_words.resize(summary + 1, 0);
+	}
+	registry->free_bits[word] |= uint64_t(1) << (index & 63);
+	registry->free_words[summary] |= uint64_t(1) << (word & 63);
+	registry->free_top[summary >> 6] |= uint64_t(1) << (summary & 63);
+}
+
+bool pop_lowest_free_index(EntityRegistry* registry, uint32_t& index)
+{
+	for (uint32_t top = 0; top < sizeof(registry->free_top) / sizeof(uint64_t); top++)
+	{
+		if (registry->free_top[top] == 0) continue;
+
+		const uint32_t summary = top * 64 + countr_zero64(registry->free_top[top]);
+		const uint32_t word = summary * 64 + countr_zero64(registry->free_words[summary]);
+		uint64_t& bits = registry->free_bits[word];
+		index = word * 64 + countr_zero64(bits);
+
+		//clear upwards only while the level below became empty
+		bits &= bits - 1;
+		if (bits == 0)
+		{
+			registry->free_words[summary] &= ~(uint64_t(1) << (word & 63));
+			if (registry->free_words[summary] == 0)
+			{
+				registry->free_top[top] &= ~(uint64_t(1) << (summary & 63));
+			}
+		}
+		return true;
+	}
+	return false;
+}
+
+EntityRegistry create_registry()
+{
+	return EntityRegistry{};
+}
+
+void destroy_registry(EntityRegistry* registry)
+{
+	registry->handles.clear();
+	registry->free_bits.clear();
+	registry->free_words.clear();
+	memset(registry->free_top, 0, sizeof(registry->free_top));
+	registry->pools.clear();
+	registry->alive_count = 0;
+}
+
+//any pool with a remove_pool_element overload, ComponentPool or SoaPool
+template<typename Pool>
+void register_pool(EntityRegistry* registry, Pool* pool)
+{
+	RegisteredPool registered;
+	registered.pool = pool;
+	registered.remove = [](void* pool, uint32_t entity) {
+		remove_pool_element(static_cast<Pool*>(pool), entity);
+	};
+	registry->pools.push_back(registered);
+}
+
+uint32_t create_entity(EntityRegistry* registry)
+{
+	//every index below handles.size() that is not alive is waiting in the free bitmask
+	uint32_t index;
+	if (registry->alive_count == registry->handles.size() || !pop_lowest_free_index(registry, index))
+	{
+		index = uint32_t(registry->handles.size());
+		assert(index < entity_max_count);
+
+		registry->handles.push_back(make_entity(index, 0));
+	}
+
+	registry->alive_count++;
+	return registry->handles[index];
+}
+
+void create_entities(EntityRegistry* registry, uint32_t* entities, size_t count)
+{
+	size_t i = 0;
+	uint32_t index;
+	for (; i < count && pop_lowest_free_index(registry, index); i++)
+	{
+		entities[i] = registry->handles[index];
+	}
+
+	//nothing left to recycle, the rest are fresh indices in order
+	const size_t fresh = count - i;
+	const uint32_t first = uint32_t(registry->handles.size());
+	assert(first + fresh <= entity_max_count);
+
+	registry->handles.resize(first + fresh);
+	for (size_t n = 0; n < fresh; n++)
+	{
+		registry->handles[first + n] = make_entity(uint32_t(first + n), 0);
+		entities[i + n] = registry->handles[first + n];
+	}
+	registry->alive_count += count;
+}
+
+__inline bool is_free_index(const EntityRegistry* registry, uint32_t index)
+{
+	const uint32_t word = index >> 6;
+	return word < registry->free_bits.size() && ((registry->free_bits[word] >> (index & 63)) & 0x1);
+}
+
+__inline bool is_entity_valid(const EntityRegistry* registry, uint32_t entity)
+{
+	const uint32_t index = entity_index(entity);
+	return index < registry->handles.size() && registry->handles[index] == entity && !is_free_index(registry, index);
+}
+
+bool destroy_entity(EntityRegistry* registry, uint32_t entity)
+{
+	if (!is_entity_valid(registry, entity))
+	{
+		return false;
+	}
+
+	for (const RegisteredPool& registered : registry->pools)
+	{
+		registered.remove(registered.pool, entity);
+	}
+
+	const uint32_t index = entity_index(entity);
+	registry->handles[index] = make_entity(index, entity_generation(entity) + 1);
+	registry->alive_count--;
+
+	push_free_index(registry, index);
+	return true;
+}
+
+__inline size_t registry_alive_count(const EntityRegistry* registry)
+{
+	return registry->alive_count;
+}
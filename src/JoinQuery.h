@@ -0,0 +1,120 @@
+#pragma once
+
+#include "BitTree.h"
+
+//materialized join of a set of pools. It holds the indices of the entities that are in all of them, and the pools keep
+//it up to date through their listeners, so iterating it costs only the matches instead of a full tree intersection
+template<typename... Pools>
+struct JoinQuery
+{
+	std::tuple<Pools*...> pools;
+	//indices of the matching entities, only the leaf bitmasks are used
+	ByteTree<void> members;
+	size_t count;
+};
+
+template<typename... Pools>
+void query_entity_added(void* listener, uint32_t entity)
+{
+	auto* query = static_cast<JoinQuery<Pools...>*>(listener);
+	const bool bmatch = std::apply([&](Pools*... pools) {
+		return (has_pool_element(pools, entity) && ...);
+	}, query->pools);
+
+	if (bmatch && add_tree_key(&query->members, entity & 0xFFFFF))
+	{
+		query->count++;
+	}
+}
+
+template<typename... Pools>
+void query_entity_removed(void* listener, uint32_t entity)
+{
+	auto* query = static_cast<JoinQuery<Pools...>*>(listener);
+	if (remove_tree_val(&query->members, entity & 0xFFFFF))
+	{
+		query->count--;
+	}
+}
+
+//create_query(&poolA, &poolB, ...) registers a query with every pool and fills it with their current join.
+//It has to be destroyed with destroy_query before any of the pools is destroyed
+template<typename... Pools>
+JoinQuery<Pools...>* create_query(Pools*... pools)
+{
+	static_assert(sizeof...(Pools) > 0, "create_query needs at least one pool");
+
+	JoinQuery<Pools...>* query = new JoinQuery<Pools...>{ std::tuple<Pools*...>(pools...), create_bytetree<void>(), 0 };
+
+	join_pools(pools..., [&](uint32_t entity, auto&&...) {
+		add_tree_key(&query->members, entity & 0xFFFFF);
+		query->count++;
+	});
+
+	const PoolListener listener{ query, &query_entity_added<Pools...>, &query_entity_removed<Pools...> };
+	(pools->listeners.push_back(listener), ...);
+	return query;
+}
+
+template<typename... Pools>
+void destroy_query(JoinQuery<Pools...>* query)
+{
+	std::apply([&](Pools*... pools) {
+		(remove_pool_listener(pools->listeners, query), ...);
+	}, query->pools);
+
+	destroy_bytetree(&query->members);
+	delete query;
+}
+
+template<typename... Pools>
+__inline size_t query_size(const JoinQuery<Pools...>* query)
+{
+	return query->count;
+}
+
+//walks the members tree and takes the same path down every pool tree, which has the members below it too.
+//No bitmasks are merged, the members already are the intersection
+template<int Depth, size_t N, typename F>
+void iterate_members_recursive(ByteNode* members, const std::array<ByteNode*, N>& nodes, uint32_t base_index, F& function)
+{
+	if constexpr (Depth == 1)
+	{
+		function(base_index, members, nodes);
+	}
+	else
+	{
+		bitmask_optimal_iterate(&members->bytemask[0], 4, [&](uint32_t index) {
+
+			const std::array<ByteNode*, N> othernodes = gather_child_nodes(nodes, index, std::make_index_sequence<N>{});
+			iterate_members_recursive<Depth - 1>(node_child(members, uint8_t(index)), othernodes, (base_index | index) << 8, function);
+		});
+	}
+}
+
+template<typename F, size_t... I, typename... Pools>
+void iterate_query_impl(JoinQuery<Pools...>* query, F& function, std::index_sequence<I...>, Pools*... pools)
+{
+	constexpr size_t N = sizeof...(Pools);
+	constexpr size_t E = join_entity_pool<Pools...>();
+	auto* entity_pool = std::get<E>(query->pools);
+
+	auto member_leaf = [&](uint32_t leaf_index, ByteNode* members_leaf, const std::array<ByteNode*, N>& leaves) {
+		bitmask_optimal_iterate(&members_leaf->bytemask[0], 4, [&](uint32_t key) {
+			function(pool_join_entity(entity_pool, leaves[E], leaf_index, key), pool_join_element(pools, leaves[I], key)...);
+		});
+		((join_writes_pool<I, F>() ? mark_joined_leaf(pools, leaf_index, &members_leaf->bytemask[0]) : void()), ...);
+	};
+	const std::array<ByteNode*, N> roots = { pools->tree.root... };
+	iterate_members_recursive<3>(query->members.root, roots, 0, member_leaf);
+}
+
+//calls function(entity, A&, B&, ...) for every member of the query, in tree order like join_pools.
+//Like join_pools, the members are marked as changed in the tracked pools the callback takes as T&
+template<typename F, typename... Pools>
+void iterate_query(JoinQuery<Pools...>* query, F&& function)
+{
+	std::apply([&](Pools*... pools) {
+		iterate_query_impl(query, function, std::index_sequence_for<Pools...>{}, pools...);
+	}, query->pools);
+}
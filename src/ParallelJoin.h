@@ -0,0 +1,93 @@
+#pragma once
+
+#include "BitTree.h"
+#include "TaskPool.h"
+
+enum class JoinGrain : uint8_t
+{
+	//one task per root slot, subtrees of 65536 entities
+	Root,
+	//one task per level 2 slot, single leaves of 256 entities
+	Leaf,
+	//root tasks, unless there are too few of them to keep every thread busy
+	Auto
+};
+
+template<typename F, size_t... I, typename... Pools>
+void parallel_join_pools_impl(TaskPool* taskpool, JoinGrain grain, F& function, std::index_sequence<I...> seq, Pools*... pools)
+{
+	constexpr size_t N = sizeof...(Pools);
+	const std::array<ByteNode*, N> rootnodes = { pools->tree.root... };
+
+	//the changed trees are not thread safe, so writes are not marked here. Mark them with mark_changed after the join, from one thread
+	const auto leaf = make_join_leaf<false>(function, seq, pools...);
+
+	uint64_t root_bitmask[4];
+	if (!merge_node_bitmasks(rootnodes, &root_bitmask[0]))
+	{
+		return;
+	}
+
+	if (grain == JoinGrain::Auto)
+	{
+		const int root_tasks = popcount64(root_bitmask[0]) + popcount64(root_bitmask[1]) + popcount64(root_bitmask[2]) + popcount64(root_bitmask[3]);
+		grain = (root_tasks >= task_pool_thread_count(taskpool) * 4) ? JoinGrain::Root : JoinGrain::Leaf;
+	}
+
+	//every task owns a distinct subtree, so no entity is ever seen by two tasks
+	std::vector<Task> tasks;
+
+	bitmask_optimal_iterate(&root_bitmask[0], 4, [&](uint32_t index) {
+
+		const std::array<ByteNode*, N> midnodes = gather_child_nodes(rootnodes, index, std::make_index_sequence<N>{});
+		const uint32_t mid_base = index << 8;
+
+		if (grain == JoinGrain::Root)
+		{
+			tasks.push_back([&leaf, midnodes, mid_base]() {
+				iterate_joined_recursive<2>(midnodes, mid_base, leaf);
+			});
+		}
+		else
+		{
+			uint64_t mid_bitmask[4];
+			if (!merge_node_bitmasks(midnodes, &mid_bitmask[0]))
+			{
+				return;
+			}
+
+			bitmask_optimal_iterate(&mid_bitmask[0], 4, [&](uint32_t midindex) {
+
+				const std::array<ByteNode*, N> leafnodes = gather_child_nodes(midnodes, midindex, std::make_index_sequence<N>{});
+				const uint32_t leaf_base = (mid_base | midindex) << 8;
+
+				tasks.push_back([&leaf, leafnodes, leaf_base]() {
+					leaf(leaf_base, leafnodes);
+				});
+			});
+		}
+	});
+
+	run_tasks(taskpool, tasks);
+}
+
+template<typename F, typename Tuple, size_t... I>
+__inline void parallel_join_pools_unpack(TaskPool* taskpool, JoinGrain grain, F& function, Tuple& args, std::index_sequence<I...> seq)
+{
+	parallel_join_pools_impl(taskpool, grain, function, seq, std::get<I>(args)...);
+}
+
+//parallel_join_pools(taskpool, grain, &poolA, &poolB, ... , function)
+//same as join_pools, but the matching subtrees are split into tasks and run on the task pool.
+//function is called from many threads at once, but never twice for the same entity.
+//the pools must not be modified until it returns
+template<typename... Args>
+void parallel_join_pools(TaskPool* taskpool, JoinGrain grain, Args&&... args)
+{
+	constexpr size_t npools = sizeof...(Args) - 1;
+	static_assert(npools > 0, "parallel_join_pools needs at least one pool and a function");
+
+	auto argtuple = std::forward_as_tuple(std::forward<Args>(args)...);
+
+	parallel_join_pools_unpack(taskpool, grain, std::get<npools>(argtuple), argtuple, std::make_index_sequence<npools>{});
+}
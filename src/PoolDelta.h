@@ -0,0 +1,287 @@
+#pragma once
+
+#include "BitTree.h"
+#include "CowPool.h"
+
+//walks two trees together and calls function(leaf_index, before_leaf, after_leaf) for every leaf that can differ.
+//A leaf missing on one side is null. Subtrees only one side has are not merged with anything, and subtrees
+//both sides share by pointer are skipped. Only trees from share_bytetree share nodes, as the ones of a CowPool and
+//its snapshots, so between two separate trees every leaf is visited
+template<int Depth, typename F>
+void diff_trees_recursive(ByteNode* before, ByteNode* after, uint32_t base_index, F& function)
+{
+	if (before == after)
+	{
+		return;
+	}
+	if constexpr (Depth == 1)
+	{
+		function(base_index, before, after);
+	}
+	else
+	{
+		static const uint64_t no_bits[4] = {};
+		const uint64_t* before_mask = before ? &before->bytemask[0] : no_bits;
+		const uint64_t* after_mask = after ? &after->bytemask[0] : no_bits;
+
+		uint64_t both[4];
+		uint64_t differ[4];
+		for (int word = 0; word < 4; word++)
+		{
+			both[word] = before_mask[word] & after_mask[word];
+			differ[word] = before_mask[word] ^ after_mask[word];
+		}
+
+		bitmask_optimal_iterate(&both[0], 4, [&](uint32_t index) {
+			diff_trees_recursive<Depth - 1>(node_child(before, uint8_t(index)), node_child(after, uint8_t(index)), (base_index | index) << 8, function);
+		});
+		bitmask_optimal_iterate(&differ[0], 4, [&](uint32_t index) {
+			const bool bbefore = (before_mask[index >> 6] >> (index & 0x3F)) & 0x1;
+			ByteNode* before_child = bbefore ? node_child(before, uint8_t(index)) : nullptr;
+			ByteNode* after_child = bbefore ? nullptr : node_child(after, uint8_t(index));
+			diff_trees_recursive<Depth - 1>(before_child, after_child, (base_index | index) << 8, function);
+		});
+	}
+}
+
+template<typename V, typename F>
+void diff_trees(const ByteTree<V>* before, const ByteTree<V>* after, F&& function)
+{
+	diff_trees_recursive<3>(before->root, after->root, 0, function);
+}
+
+//binary delta between two states of a pool: the header, then the removed entities, the written entities
+//(added ones first, then changed ones) and their values, aligned for T
+constexpr uint32_t delta_magic = 0x44434542;
+constexpr uint32_t delta_version = 1;
+
+struct DeltaHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t value_bytes;
+	uint32_t removed;
+	uint32_t added;
+	uint32_t changed;
+	//from the start of the delta
+	uint64_t values_offset;
+};
+
+template<typename T>
+__inline uint64_t delta_values_offset(uint64_t written_end)
+{
+	return (written_end + alignof(T) - 1) & ~uint64_t(alignof(T) - 1);
+}
+
+//what changed between two states of a pool, before it is written out as a delta
+template<typename T>
+struct PoolDiff
+{
+	std::vector<uint32_t> removed;
+	std::vector<uint32_t> added;
+	std::vector<uint32_t> changed;
+	std::vector<T> added_values;
+	std::vector<T> changed_values;
+};
+
+template<typename T, typename V>
+__inline uint32_t delta_dense_entity(const ComponentPool<T, V>* pool, size_t dense_index)
+{
+	return pool->Reverse[dense_index];
+}
+template<typename T, typename V>
+__inline const T& delta_dense_element(const ComponentPool<T, V>* pool, size_t dense_index)
+{
+	return pool->Dense[dense_index];
+}
+template<typename T, typename V>
+__inline uint32_t delta_dense_entity(const CowPool<T, V>* pool, size_t dense_index)
+{
+	return cow_dense_entity(pool, dense_index);
+}
+template<typename T, typename V>
+__inline const T& delta_dense_element(const CowPool<T, V>* pool, size_t dense_index)
+{
+	return cow_dense_element(pool, dense_index);
+}
+
+//adds the removed and added entities of one leaf to diff. Values of the entities both leaves hold are only compared
+//if bCompareValues is set
+template<bool bCompareValues, typename V, typename Pool, typename T>
+void diff_pool_leaf(const Pool* before, const Pool* after, ByteNode* before_leaf, ByteNode* after_leaf, PoolDiff<T>& diff)
+{
+	static const uint64_t no_bits[4] = {};
+	const uint64_t* before_mask = before_leaf ? &before_leaf->bytemask[0] : no_bits;
+	const uint64_t* after_mask = after_leaf ? &after_leaf->bytemask[0] : no_bits;
+
+	uint64_t gone[4];
+	uint64_t born[4];
+	uint64_t both[4];
+	for (int word = 0; word < 4; word++)
+	{
+		const uint64_t differ = before_mask[word] ^ after_mask[word];
+		gone[word] = differ & before_mask[word];
+		born[word] = differ & after_mask[word];
+		both[word] = before_mask[word] & after_mask[word];
+	}
+
+	bitmask_optimal_iterate(&gone[0], 4, [&](uint32_t key) {
+		diff.removed.push_back(delta_dense_entity(before, node_val<V>(before_leaf, uint8_t(key))));
+	});
+	bitmask_optimal_iterate(&born[0], 4, [&](uint32_t key) {
+		const V val = node_val<V>(after_leaf, uint8_t(key));
+		diff.added.push_back(delta_dense_entity(after, val));
+		diff.added_values.push_back(delta_dense_element(after, val));
+	});
+	bitmask_optimal_iterate(&both[0], 4, [&](uint32_t key) {
+		const V before_val = node_val<V>(before_leaf, uint8_t(key));
+		const V after_val = node_val<V>(after_leaf, uint8_t(key));
+		const uint32_t before_entity = delta_dense_entity(before, before_val);
+		const uint32_t after_entity = delta_dense_entity(after, after_val);
+		if (before_entity != after_entity)
+		{
+			diff.removed.push_back(before_entity);
+			diff.added.push_back(after_entity);
+			diff.added_values.push_back(delta_dense_element(after, after_val));
+		}
+		else if (bCompareValues && memcmp(&delta_dense_element(before, before_val), &delta_dense_element(after, after_val), sizeof(T)) != 0)
+		{
+			diff.changed.push_back(after_entity);
+			diff.changed_values.push_back(delta_dense_element(after, after_val));
+		}
+	});
+}
+
+template<typename T>
+void write_delta(const PoolDiff<T>& diff, std::vector<uint8_t>& delta)
+{
+	DeltaHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = delta_magic;
+	header.version = delta_version;
+	header.value_bytes = sizeof(T);
+	header.removed = uint32_t(diff.removed.size());
+	header.added = uint32_t(diff.added.size());
+	header.changed = uint32_t(diff.changed.size());
+
+	const uint64_t removed_offset = sizeof(DeltaHeader);
+	const uint64_t added_offset = removed_offset + diff.removed.size() * sizeof(uint32_t);
+	const uint64_t changed_offset = added_offset + diff.added.size() * sizeof(uint32_t);
+	header.values_offset = delta_values_offset<T>(changed_offset + diff.changed.size() * sizeof(uint32_t));
+	const uint64_t changed_values_offset = header.values_offset + diff.added_values.size() * sizeof(T);
+
+	delta.assign(changed_values_offset + diff.changed_values.size() * sizeof(T), 0);
+	uint8_t* bytes = delta.data();
+	memcpy(bytes, &header, sizeof(header));
+	//data() of an empty vector can be null, which memcpy does not take even for 0 bytes
+	if (diff.removed.size())
+	{
+		memcpy(bytes + removed_offset, diff.removed.data(), diff.removed.size() * sizeof(uint32_t));
+	}
+	if (diff.added.size())
+	{
+		memcpy(bytes + added_offset, diff.added.data(), diff.added.size() * sizeof(uint32_t));
+		memcpy(bytes + header.values_offset, diff.added_values.data(), diff.added_values.size() * sizeof(T));
+	}
+	if (diff.changed.size())
+	{
+		memcpy(bytes + changed_offset, diff.changed.data(), diff.changed.size() * sizeof(uint32_t));
+		memcpy(bytes + changed_values_offset, diff.changed_values.data(), diff.changed_values.size() * sizeof(T));
+	}
+}
+
+//writes into delta what apply_delta needs to turn before into after. Diffing the other way gives the rollback.
+//Values are compared bytewise, an index whose entity changed generation is removed and added again. Two ComponentPools
+//share no nodes, so every leaf of both is compared
+template<typename T, typename V>
+void diff_pools(const ComponentPool<T, V>* before, const ComponentPool<T, V>* after, std::vector<uint8_t>& delta)
+{
+	static_assert(std::is_trivially_copyable_v<T>, "deltas store the elements as raw bytes");
+
+	PoolDiff<T> diff;
+	diff_trees(&before->tree, &after->tree, [&](uint32_t /*leaf_index*/, ByteNode* before_leaf, ByteNode* after_leaf) {
+		diff_pool_leaf<true, V>(before, after, before_leaf, after_leaf, diff);
+	});
+	write_delta(diff, delta);
+}
+
+//the same between a CowPool and one of its snapshots, or two snapshots of one pool. Only what was written since the
+//snapshot is visited: the tree paths and pages a write copied. The delta applies to a ComponentPool in the before state
+template<typename T, typename V>
+void diff_pools(const CowPool<T, V>* before, const CowPool<T, V>* after, std::vector<uint8_t>& delta)
+{
+	static_assert(std::is_trivially_copyable_v<T>, "deltas store the elements as raw bytes");
+
+	PoolDiff<T> diff;
+	diff_trees(&before->tree, &after->tree, [&](uint32_t /*leaf_index*/, ByteNode* before_leaf, ByteNode* after_leaf) {
+		diff_pool_leaf<false, V>(before, after, before_leaf, after_leaf, diff);
+	});
+
+	//values are written in their page without touching the tree, so the values come from the pages that differ.
+	//A page both sides share holds the same entities at the same dense indices, with the same values
+	if (before->table != after->table)
+	{
+		for (size_t page = 0; page * cow_page_elements < after->count; page++)
+		{
+			const CowPage<T>* after_page = after->table->pages[page];
+			if (page < before->table->pages.size() && before->table->pages[page] == after_page)
+			{
+				continue;
+			}
+			const size_t end = std::min(cow_page_elements, after->count - page * cow_page_elements);
+			for (size_t i = 0; i < end; i++)
+			{
+				//entities before does not have with this generation were added by the tree pass
+				const uint32_t entity = after_page->Reverse[i];
+				uint64_t before_val;
+				if (get_tree_val(&before->tree, entity & 0xFFFFF, before_val) && cow_dense_entity(before, before_val) == entity
+					&& memcmp(&cow_dense_element(before, before_val), &after_page->Dense[i], sizeof(T)) != 0)
+				{
+					diff.changed.push_back(entity);
+					diff.changed_values.push_back(after_page->Dense[i]);
+				}
+			}
+		}
+	}
+	write_delta(diff, delta);
+}
+
+//applies a delta from diff_pools with the batch paths, removals first. The pool has to be in the before state, or at
+//least hold the same removed entities. False if the delta is not for T or is cut short. The buffer has to be aligned for T
+template<typename T, typename V>
+bool apply_delta(ComponentPool<T, V>* pool, const uint8_t* delta, size_t bytes)
+{
+	static_assert(std::is_trivially_copyable_v<T>, "deltas store the elements as raw bytes");
+
+	if (bytes < sizeof(DeltaHeader))
+	{
+		return false;
+	}
+	DeltaHeader header;
+	memcpy(&header, delta, sizeof(header));
+
+	const size_t nwritten = size_t(header.added) + header.changed;
+	const uint64_t written_offset = sizeof(DeltaHeader) + uint64_t(header.removed) * sizeof(uint32_t);
+	if (header.magic != delta_magic || header.version != delta_version || header.value_bytes != sizeof(T)
+		|| header.values_offset != delta_values_offset<T>(written_offset + nwritten * sizeof(uint32_t))
+		|| header.values_offset + nwritten * sizeof(T) > bytes)
+	{
+		return false;
+	}
+	assert(uintptr_t(delta + header.values_offset) % alignof(T) == 0);
+
+	const uint32_t* removed = (const uint32_t*)(delta + sizeof(DeltaHeader));
+	const uint32_t* written = (const uint32_t*)(delta + written_offset);
+	const T* values = (const T*)(delta + header.values_offset);
+
+	remove_pool_elements(pool, removed, header.removed);
+	add_pool_elements(pool, written, values, nwritten);
+	return true;
+}
+
+__inline DeltaHeader read_delta_header(const uint8_t* delta)
+{
+	DeltaHeader header;
+	memcpy(&header, delta, sizeof(header));
+	return header;
+}
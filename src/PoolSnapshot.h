@@ -0,0 +1,362 @@
+#pragma once
+
+#include "BitTree.h"
+#include <cstdio>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//on disk image of a ComponentPool: header, Dense, Reverse and the tree nodes, every section starting on a page.
+//Nodes are stored as they are in memory, except that inner nodes hold the offsets of their children from the start
+//of the node section instead of pointers
+constexpr uint32_t snapshot_magic = 0x53434542;
+constexpr uint32_t snapshot_version = 1;
+constexpr size_t snapshot_section_alignment = 4096;
+
+struct SnapshotHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	//sizeof(T) and sizeof(V) of the pool, a snapshot only loads into the same types
+	uint32_t value_bytes;
+	uint32_t slot_bytes;
+	uint64_t count;
+	uint64_t dense_offset;
+	uint64_t reverse_offset;
+	uint64_t nodes_offset;
+	uint64_t nodes_bytes;
+	//from the start of the node section
+	uint64_t root_offset;
+	uint32_t depth;
+	uint32_t capacity;
+};
+
+//pool loaded from a snapshot. Dense, Reverse and the tree point into the mapping, which is private, so writing
+//a value copies its page on first write and never reaches the file. Adding or removing elements needs a
+//ComponentPool, see copy_mapped_pool
+template<typename T, typename V = uint32_t>
+struct MappedPool
+{
+	ByteTree<V> tree;
+	T* Dense;
+	uint32_t* Reverse;
+	size_t count;
+
+	void* mapping;
+	size_t mapping_bytes;
+};
+
+__inline uint64_t snapshot_align(uint64_t offset)
+{
+	return (offset + snapshot_section_alignment - 1) & ~uint64_t(snapshot_section_alignment - 1);
+}
+
+//appends node and its subtree to nodes. Returns the offset of node
+uint64_t write_snapshot_nodes(std::vector<uint8_t>& nodes, ByteNode* node, int level)
+{
+	const size_t bytes = node_bytes(node->kind, node->slot_bytes);
+	const uint64_t offset = nodes.size();
+	nodes.resize(offset + bytes);
+	memcpy(nodes.data() + offset, node, bytes);
+
+	if (level > 1)
+	{
+		bitmask_optimal_iterate(&node->bytemask[0], 4, [&](uint32_t index) {
+			const uint64_t child = write_snapshot_nodes(nodes, node_child(node, uint8_t(index)), level - 1);
+			//the buffer may have moved while writing the child
+			ByteNode* written = (ByteNode*)(nodes.data() + offset);
+			written->vals[node_slot(written, uint8_t(index))] = child;
+		});
+	}
+	return offset;
+}
+
+//long is 32 bit on windows, so sections past 2gb need the 64 bit seeks
+__inline bool seek_snapshot_file(FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, int64_t(offset), SEEK_SET) == 0;
+#else
+	return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+__inline bool write_snapshot_section(FILE* file, uint64_t offset, const void* data, size_t bytes)
+{
+	return seek_snapshot_file(file, offset) && (bytes == 0 || fwrite(data, 1, bytes, file) == bytes);
+}
+
+//writes the pool to path, replacing the file. The change tracking and listeners of the pool are not saved
+template<typename T, typename V>
+bool save_pool_snapshot(const ComponentPool<T, V>* pool, const char* path)
+{
+	static_assert(std::is_trivially_copyable_v<T>, "snapshots store the elements as raw bytes");
+
+	std::vector<uint8_t> nodes;
+	const uint64_t root_offset = write_snapshot_nodes(nodes, pool->tree.root, pool->tree.depth);
+
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = snapshot_magic;
+	header.version = snapshot_version;
+	header.value_bytes = sizeof(T);
+	header.slot_bytes = sizeof(V);
+	header.count = pool->Reverse.size();
+	header.dense_offset = snapshot_align(sizeof(SnapshotHeader));
+	header.reverse_offset = snapshot_align(header.dense_offset + header.count * sizeof(T));
+	header.nodes_offset = snapshot_align(header.reverse_offset + header.count * sizeof(uint32_t));
+	header.nodes_bytes = nodes.size();
+	header.root_offset = root_offset;
+	header.depth = pool->tree.depth;
+	header.capacity = pool->tree.capacity;
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+	{
+		return false;
+	}
+	const bool bwritten = write_snapshot_section(file, 0, &header, sizeof(header))
+		&& write_snapshot_section(file, header.dense_offset, pool->Dense.data(), header.count * sizeof(T))
+		&& write_snapshot_section(file, header.reverse_offset, pool->Reverse.data(), header.count * sizeof(uint32_t))
+		&& write_snapshot_section(file, header.nodes_offset, nodes.data(), nodes.size());
+	return (fclose(file) == 0) && bwritten;
+}
+
+//checks the node at offset and its subtree and turns the child offsets of the inner nodes back into pointers. Only inner
+//nodes are written, so the pages of the leaves stay shared with the file. Nodes were written parent first in key order, so
+//every node has to start past the end of the one checked before it, which also rules out cycles and overlapping nodes.
+//Leaves are only read with bcheck_leaves, then their values have to be dense indices below count. Returns the node,
+//null if anything is out of place
+template<typename V>
+ByteNode* link_snapshot_nodes(uint8_t* nodes, uint64_t nodes_bytes, uint64_t offset, int level, uint64_t count, bool bcheck_leaves, uint64_t& next_offset)
+{
+	if (offset < next_offset || offset > nodes_bytes || offset % alignof(ByteNode) != 0 || nodes_bytes - offset < node_header_bytes)
+	{
+		return nullptr;
+	}
+	ByteNode* node = (ByteNode*)(nodes + offset);
+	if (level == 1 && !bcheck_leaves)
+	{
+		next_offset = offset + node_header_bytes;
+		return node;
+	}
+	if (node->kind >= node_kind_count || node->slot_bytes != tree_slot_bytes<V>(level)
+		|| nodes_bytes - offset < node_bytes(node->kind, node->slot_bytes)
+		|| node_child_count(node) > node_capacities[node->kind])
+	{
+		return nullptr;
+	}
+	next_offset = offset + node_bytes(node->kind, node->slot_bytes);
+
+	bool bvalid = true;
+	if (level > 1)
+	{
+		//the populations of the leaves are their bitmasks, only counted when leaves are read
+		const bool bcheck_population = level > 2 || bcheck_leaves;
+		uint64_t population = 0;
+		bitmask_optimal_iterate(&node->bytemask[0], 4, [&](uint32_t index) {
+			if (!bvalid)
+			{
+				return;
+			}
+			uint64_t& slot = node->vals[node_slot(node, uint8_t(index))];
+			ByteNode* child = link_snapshot_nodes<V>(nodes, nodes_bytes, slot, level - 1, count, bcheck_leaves, next_offset);
+			bvalid = child != nullptr;
+			if (bvalid)
+			{
+				population += bcheck_population ? node_population(child, level - 1) : 0;
+				slot = uint64_t(uintptr_t(child));
+			}
+		});
+		bvalid = bvalid && (!bcheck_population || population == node->population);
+	}
+	else
+	{
+		bitmask_optimal_iterate(&node->bytemask[0], 4, [&](uint32_t index) {
+			bvalid = bvalid && node_val<V>(node, uint8_t(index)) < count;
+		});
+	}
+	return bvalid ? node : nullptr;
+}
+
+//maps the whole file copy on write, null on failure
+__inline void* map_snapshot_file(const char* path, size_t& bytes)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return nullptr;
+	}
+	LARGE_INTEGER size;
+	void* memory = nullptr;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+	{
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		if (mapping)
+		{
+			memory = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+	bytes = size_t(size.QuadPart);
+	return memory;
+#else
+	const int file = open(path, O_RDONLY);
+	if (file < 0)
+	{
+		return nullptr;
+	}
+	struct stat info;
+	void* memory = nullptr;
+	if (fstat(file, &info) == 0 && info.st_size > 0)
+	{
+		memory = mmap(nullptr, size_t(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+		memory = (memory == MAP_FAILED) ? nullptr : memory;
+	}
+	close(file);
+	bytes = size_t(info.st_size);
+	return memory;
+#endif
+}
+
+__inline void unmap_snapshot_file(void* memory, size_t bytes)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(memory);
+#else
+	munmap(memory, bytes);
+#endif
+}
+
+//maps a snapshot written by save_pool_snapshot. Nothing is copied and no element is read, the header and the inner nodes
+//are checked and the child pointers of the inner nodes are fixed. False if the file is missing, from another version,
+//for other types or corrupt.
+//Leaves are trusted unless bcheck_leaves is set, which reads every leaf page to check its node and its values. A file
+//with damaged leaves loaded without it can make reads go out of bounds, so files from untrusted sources need the check
+template<typename T, typename V = uint32_t>
+bool load_pool_snapshot(const char* path, MappedPool<T, V>* pool, bool bcheck_leaves = false)
+{
+	static_assert(std::is_trivially_copyable_v<T>, "snapshots store the elements as raw bytes");
+
+	size_t bytes = 0;
+	uint8_t* memory = (uint8_t*)map_snapshot_file(path, bytes);
+	if (!memory)
+	{
+		return false;
+	}
+
+	//sections are checked as offset <= bytes and size <= bytes - offset, so a corrupt header cannot overflow count * sizeof(T)
+	const SnapshotHeader* header = (const SnapshotHeader*)memory;
+	bool bvalid = bytes >= sizeof(SnapshotHeader)
+		&& header->magic == snapshot_magic && header->version == snapshot_version
+		&& header->value_bytes == sizeof(T) && header->slot_bytes == sizeof(V)
+		//the joins walk the three levels of a tree from create_bytetree
+		&& header->depth == 3 && header->capacity == (256 ^ 3)
+		&& header->dense_offset <= bytes && header->dense_offset % alignof(T) == 0
+		&& header->count <= (bytes - header->dense_offset) / sizeof(T)
+		&& header->reverse_offset <= bytes && header->reverse_offset % alignof(uint32_t) == 0
+		&& header->count <= (bytes - header->reverse_offset) / sizeof(uint32_t)
+		&& header->nodes_offset <= bytes && header->nodes_offset % alignof(ByteNode) == 0
+		&& header->nodes_bytes <= bytes - header->nodes_offset
+		&& header->root_offset <= header->nodes_bytes;
+
+	if (bvalid)
+	{
+		uint64_t next_offset = 0;
+		pool->tree.root = link_snapshot_nodes<V>(memory + header->nodes_offset, header->nodes_bytes, header->root_offset,
+			int(header->depth), header->count, bcheck_leaves, next_offset);
+		pool->tree.depth = char(header->depth);
+		pool->tree.capacity = header->capacity;
+		bvalid = pool->tree.root != nullptr;
+	}
+	if (!bvalid)
+	{
+		unmap_snapshot_file(memory, bytes);
+		return false;
+	}
+
+	pool->Dense = (T*)(memory + header->dense_offset);
+	pool->Reverse = (uint32_t*)(memory + header->reverse_offset);
+	pool->count = header->count;
+	pool->mapping = memory;
+	pool->mapping_bytes = bytes;
+	return true;
+}
+
+//unmaps the snapshot. The tree nodes are in the mapping, not in the arena, so nothing else is freed
+template<typename T, typename V>
+void destroy_pool(MappedPool<T, V>* pool)
+{
+	unmap_snapshot_file(pool->mapping, pool->mapping_bytes);
+	pool->tree.root = nullptr;
+	pool->mapping = nullptr;
+	pool->count = 0;
+}
+
+//a ComponentPool with the same elements, for when the set of elements has to change. The mapping is left as it is
+template<typename T, typename V>
+ComponentPool<T, V> copy_mapped_pool(const MappedPool<T, V>* pool)
+{
+	ComponentPool<T, V> copy;
+	copy.tree = clone_bytetree(&pool->tree);
+	copy.Dense.assign(pool->Dense, pool->Dense + pool->count);
+	copy.Reverse.assign(pool->Reverse, pool->Reverse + pool->count);
+	copy.changed.root = nullptr;
+	return copy;
+}
+
+template<typename T, typename V>
+__inline T& pool_join_element(MappedPool<T, V>* pool, ByteNode* leaf, uint32_t key)
+{
+	return pool->Dense[node_val<V>(leaf, key)];
+}
+template<typename T, typename V>
+__inline T& pool_dense_element(MappedPool<T, V>* pool, size_t dense_index)
+{
+	return pool->Dense[dense_index];
+}
+template<typename T, typename V>
+__inline uint32_t pool_join_entity(MappedPool<T, V>* pool, ByteNode* leaf, uint32_t /*leaf_index*/, uint32_t key)
+{
+	return pool->Reverse[node_val<V>(leaf, key)];
+}
+template<typename T, typename V>
+__inline size_t pool_size(const MappedPool<T, V>* pool)
+{
+	return pool->count;
+}
+
+template<typename T, typename V>
+bool has_pool_element(const MappedPool<T, V>* pool, uint32_t entity)
+{
+	uint64_t val;
+	return get_tree_val(&pool->tree, entity & 0xFFFFF, val) && pool->Reverse[val] == entity;
+}
+
+template<typename T, typename V>
+bool get_pool_element(const MappedPool<T, V>* pool, uint32_t entity, T& value)
+{
+	uint64_t val;
+	if (get_tree_val(&pool->tree, entity & 0xFFFFF, val) && pool->Reverse[val] == entity)
+	{
+		value = pool->Dense[val];
+		return true;
+	}
+	return false;
+}
+
+//writing through the pointer copies the page of the value, the snapshot file is never modified
+template<typename T, typename V>
+T* find_pool_element(MappedPool<T, V>* pool, uint32_t entity)
+{
+	uint64_t val;
+	if (get_tree_val(&pool->tree, entity & 0xFFFFF, val) && pool->Reverse[val] == entity)
+	{
+		return &pool->Dense[val];
+	}
+	return nullptr;
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include "BitTree.h"
+#include <new>
+
+//fields of T that a SoaPool stores in separate arrays, declared as a tuple of member pointers:
+//template<> struct SoaFields<Position> { static constexpr auto members = std::make_tuple(&Position::x, &Position::y, &Position::z); };
+template<typename T>
+struct SoaFields;
+
+template<typename M>
+struct soa_member;
+template<typename F, typename T>
+struct soa_member<F T::*>
+{
+	using type = F;
+};
+
+//columns start on a cache line, so loops over them can use aligned vector loads
+constexpr size_t soa_column_alignment = 64;
+
+template<typename F>
+struct SoaColumnAllocator
+{
+	using value_type = F;
+
+	SoaColumnAllocator() = default;
+	template<typename U>
+	SoaColumnAllocator(const SoaColumnAllocator<U>&) {}
+
+	F* allocate(size_t count)
+	{
+		return static_cast<F*>(::operator new(count * sizeof(F), std::align_val_t(soa_column_alignment)));
+	}
+	void deallocate(F* data, size_t)
+	{
+		::operator delete(data, std::align_val_t(soa_column_alignment));
+	}
+
+	template<typename U>
+	bool operator==(const SoaColumnAllocator<U>&) const { return true; }
+	template<typename U>
+	bool operator!=(const SoaColumnAllocator<U>&) const { return false; }
+};
+
+template<typename F>
+using SoaColumn = std::vector<F, SoaColumnAllocator<F>>;
+
+template<typename Members>
+struct soa_layout;
+template<typename... Ms>
+struct soa_layout<std::tuple<Ms...>>
+{
+	using columns = std::tuple<SoaColumn<typename soa_member<Ms>::type>...>;
+	using refs = std::tuple<typename soa_member<Ms>::type&...>;
+};
+
+template<typename T>
+using soa_layout_t = soa_layout<std::remove_cv_t<decltype(SoaFields<T>::members)>>;
+
+//references to the fields of one element, in SoaFields order. Read them with std::get<I>, or a structured binding
+template<typename T>
+using SoaRef = typename soa_layout_t<T>::refs;
+
+//same tree and Reverse as ComponentPool, but the values are split into one array per field, all in the same dense order
+template<typename T, typename V = uint32_t>
+struct SoaPool
+{
+	ByteTree<V> tree;
+	typename soa_layout_t<T>::columns Columns;
+	std::vector<uint32_t> Reverse;
+
+	std::vector<PoolListener> listeners;
+};
+
+template<typename T>
+constexpr size_t soa_field_count = std::tuple_size<std::remove_cv_t<decltype(SoaFields<T>::members)>>::value;
+
+//first element of field I, the column has one entry per element of the pool
+template<size_t I, typename T, typename V>
+__inline auto* soa_column(SoaPool<T, V>* pool)
+{
+	return std::get<I>(pool->Columns).data();
+}
+
+template<typename T, typename V, size_t... I>
+__inline SoaRef<T> soa_ref_impl(SoaPool<T, V>* pool, uint64_t index, std::index_sequence<I...>)
+{
+	return SoaRef<T>(std::get<I>(pool->Columns)[index]...);
+}
+
+//field references of the element at a dense index
+template<typename T, typename V>
+__inline SoaRef<T> soa_ref(SoaPool<T, V>* pool, uint64_t index)
+{
+	return soa_ref_impl(pool, index, std::make_index_sequence<soa_field_count<T>>{});
+}
+
+//joins hand out SoaRef<T> by value, join_pools(&soapool, [](uint32_t entity, SoaRef<T> fields) { ... })
+template<typename T, typename V>
+__inline SoaRef<T> pool_join_element(SoaPool<T, V>* pool, ByteNode* leaf, uint32_t key)
+{
+	return soa_ref(pool, node_val<V>(leaf, key));
+}
+template<typename T, typename V>
+__inline SoaRef<T> pool_dense_element(SoaPool<T, V>* pool, size_t dense_index)
+{
+	return soa_ref(pool, dense_index);
+}
+template<typename T, typename V>
+__inline uint32_t pool_join_entity(SoaPool<T, V>* pool, ByteNode* leaf, uint32_t /*leaf_index*/, uint32_t key)
+{
+	return pool->Reverse[node_val<V>(leaf, key)];
+}
+
+template<typename T, typename V>
+__inline size_t pool_size(const SoaPool<T, V>* pool)
+{
+	return pool->Reverse.size();
+}
+
+template<typename T, typename V, size_t... I>
+__inline void soa_push_back(SoaPool<T, V>* pool, const T& value, std::index_sequence<I...>)
+{
+	constexpr auto members = SoaFields<T>::members;
+	(std::get<I>(pool->Columns).push_back(value.*std::get<I>(members)), ...);
+}
+
+template<typename T, typename V, size_t... I>
+__inline void soa_store(SoaPool<T, V>* pool, uint64_t index, const T& value, std::index_sequence<I...>)
+{
+	constexpr auto members = SoaFields<T>::members;
+	((std::get<I>(pool->Columns)[index] = value.*std::get<I>(members)), ...);
+}
+
+template<typename T, typename V, size_t... I>
+__inline void soa_load(const SoaPool<T, V>* pool, uint64_t index, T& value, std::index_sequence<I...>)
+{
+	constexpr auto members = SoaFields<T>::members;
+	((value.*std::get<I>(members) = std::get<I>(pool->Columns)[index]), ...);
+}
+
+//moves the last element into index and drops the last slot of every column
+template<typename T, typename V, size_t... I>
+__inline void soa_swap_pop(SoaPool<T, V>* pool, uint64_t index, std::index_sequence<I...>)
+{
+	((std::get<I>(pool->Columns)[index] = std::get<I>(pool->Columns).back(), std::get<I>(pool->Columns).pop_back()), ...);
+}
+
+template<typename T, typename V = uint32_t>
+SoaPool<T, V> create_soa_pool()
+{
+	SoaPool<T, V> pool;
+	pool.tree = create_bytetree<V>();
+	return pool;
+}
+
+template<typename T, typename V>
+void destroy_pool(SoaPool<T, V>* pool)
+{
+	destroy_bytetree(&pool->tree);
+	std::apply([](auto&... columns) { (columns.clear(), ...); }, pool->Columns);
+	pool->Reverse.clear();
+}
+
+template<typename T, typename V>
+bool has_pool_element(const SoaPool<T, V>* pool, uint32_t entity)
+{
+	uint64_t val;
+	return get_tree_val(&pool->tree, entity & 0xFFFFF, val) && pool->Reverse[val] == entity;
+}
+
+//gathers the fields of entity into value, false if its not in the pool
+template<typename T, typename V>
+bool get_pool_element(const SoaPool<T, V>* pool, uint32_t entity, T& value)
+{
+	uint64_t val;
+	if (get_tree_val(&pool->tree, entity & 0xFFFFF, val) && pool->Reverse[val] == entity)
+	{
+		soa_load(pool, val, value, std::make_index_sequence<soa_field_count<T>>{});
+		return true;
+	}
+	return false;
+}
+
+template<typename T, typename V>
+void add_pool_element(SoaPool<T, V>* pool, uint32_t entity, const T& value)
+{
+	uint32_t index = entity & 0xFFFFF;
+
+	uint64_t val;
+	//already in set, replace
+	if (get_tree_val(&pool->tree, index, val))
+	{
+		if (pool->Reverse[val] == entity)
+		{
+			soa_store(pool, val, value, std::make_index_sequence<soa_field_count<T>>{});
+		}
+	}
+	else
+	{
+		assert(pool->Reverse.size() <= std::numeric_limits<V>::max());
+		pool->Reverse.push_back(entity);
+		soa_push_back(pool, value, std::make_index_sequence<soa_field_count<T>>{});
+
+		add_tree_val(&pool->tree, index, pool->Reverse.size() - 1);
+		notify_added(pool->listeners, entity);
+	}
+}
+
+template<typename T, typename V>
+void remove_pool_element(SoaPool<T, V>* pool, uint32_t entity)
+{
+	uint32_t index = entity & 0xFFFFF;
+
+	uint64_t val;
+	if (get_tree_val(&pool->tree, index, val) && pool->Reverse[val] == entity)
+	{
+		const size_t reverse_end = pool->Reverse.size() - 1;
+		if (val != reverse_end)
+		{
+			//the last element moves into the hole
+			const uint32_t swap_et = pool->Reverse[reverse_end];
+			pool->Reverse[val] = swap_et;
+			add_tree_val(&pool->tree, swap_et & 0xFFFFF, val);
+		}
+		soa_swap_pop(pool, val, std::make_index_sequence<soa_field_count<T>>{});
+		pool->Reverse.pop_back();
+
+		remove_tree_val(&pool->tree, index);
+		notify_removed(pool->listeners, entity);
+	}
+}
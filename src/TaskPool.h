@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::function<void()> Task;
+
+struct TaskQueue
+{
+	std::mutex lock;
+	std::deque<Task> tasks;
+};
+
+//work stealing thread pool. Each thread owns a queue and takes work from its back,
+//when it runs dry it steals from the front of the other queues
+struct TaskPool
+{
+	std::vector<std::thread> threads;
+	//one queue per worker thread, plus the last one for the thread that calls run_tasks
+	std::unique_ptr<TaskQueue[]> queues;
+	int queue_count;
+
+	std::mutex wake_lock;
+	std::condition_variable wake;
+	uint64_t generation = 0;
+	bool bexit = false;
+
+	std::atomic<int> pending{ 0 };
+};
+
+bool pop_task(TaskPool* pool, int queue_index, Task& task)
+{
+	{
+		TaskQueue& own = pool->queues[queue_index];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (int i = 1; i < pool->queue_count; i++)
+	{
+		TaskQueue& victim = pool->queues[(queue_index + i) % pool->queue_count];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void work_until_done(TaskPool* pool, int queue_index)
+{
+	Task task;
+	while (pool->pending.load(std::memory_order_acquire) > 0)
+	{
+		if (pop_task(pool, queue_index, task))
+		{
+			task();
+			pool->pending.fetch_sub(1, std::memory_order_release);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+//queue index of the calling thread on the workers of a task pool and inside run_tasks, -1 elsewhere.
+//Lets tasks pick per thread data without locking
+thread_local int task_thread_index = -1;
+
+void task_worker(TaskPool* pool, int queue_index)
+{
+	task_thread_index = queue_index;
+	uint64_t seen_generation = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> guard(pool->wake_lock);
+			pool->wake.wait(guard, [&]() { return pool->bexit || pool->generation != seen_generation; });
+			if (pool->bexit)
+			{
+				return;
+			}
+			seen_generation = pool->generation;
+		}
+		work_until_done(pool, queue_index);
+	}
+}
+
+//creates a pool that runs tasks on nthreads threads, counting the one that calls run_tasks
+TaskPool* create_task_pool(int nthreads = int(std::thread::hardware_concurrency()))
+{
+	if (nthreads < 1)
+	{
+		nthreads = 1;
+	}
+
+	TaskPool* pool = new TaskPool();
+	pool->queue_count = nthreads;
+	pool->queues.reset(new TaskQueue[nthreads]);
+
+	for (int i = 0; i < nthreads - 1; i++)
+	{
+		pool->threads.emplace_back(task_worker, pool, i);
+	}
+	return pool;
+}
+
+void destroy_task_pool(TaskPool* pool)
+{
+	{
+		std::lock_guard<std::mutex> guard(pool->wake_lock);
+		pool->bexit = true;
+	}
+	pool->wake.notify_all();
+
+	for (std::thread& thread : pool->threads)
+	{
+		thread.join();
+	}
+	delete pool;
+}
+
+int task_pool_thread_count(const TaskPool* pool)
+{
+	return pool->queue_count;
+}
+
+//runs every task and returns once they are all done. The calling thread works on them too
+void run_tasks(TaskPool* pool, std::vector<Task>& tasks)
+{
+	if (tasks.empty())
+	{
+		return;
+	}
+
+	pool->pending.store(int(tasks.size()), std::memory_order_release);
+
+	for (size_t i = 0; i < tasks.size(); i++)
+	{
+		TaskQueue& queue = pool->queues[i % pool->queue_count];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		queue.tasks.push_back(std::move(tasks[i]));
+	}
+	tasks.clear();
+
+	{
+		std::lock_guard<std::mutex> guard(pool->wake_lock);
+		pool->generation++;
+	}
+	pool->wake.notify_all();
+
+	const int outer_index = task_thread_index;
+	task_thread_index = pool->queue_count - 1;
+	work_until_done(pool, pool->queue_count - 1);
+	task_thread_index = outer_index;
+}
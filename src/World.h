@@ -0,0 +1,162 @@
+#pragma once
+
+#include "BitTree.h"
+#include "EntityRegistry.h"
+
+//sequential id per component type, assigned once at startup. Indexes the pool table of a World directly
+__inline uint32_t next_component_type_id()
+{
+	static uint32_t counter = 0;
+	return counter++;
+}
+
+template<typename T>
+inline const uint32_t component_type_id = next_component_type_id();
+
+//component types left out of a World join, world.join<A, B>(exclude<C>, function)
+template<typename... Ts>
+struct ExcludeTypes {};
+
+template<typename... Ts>
+constexpr ExcludeTypes<Ts...> exclude{};
+
+struct WorldPool
+{
+	void* pool;
+	bool (*contains)(void* pool, uint32_t entity);
+	void (*release)(void* pool);
+};
+
+//owns an entity registry and one pool per component type, created the first time the type is used
+struct World
+{
+	EntityRegistry registry;
+	//indexed by component_type_id, null for types that were never used
+	std::vector<WorldPool> pools;
+
+	template<typename T>
+	pool_t<T>* pool()
+	{
+		const uint32_t id = component_type_id<T>;
+		if (id < pools.size() && pools[id].pool)
+		{
+			return static_cast<pool_t<T>*>(pools[id].pool);
+		}
+		return create_world_pool<T>();
+	}
+
+	template<typename T>
+	pool_t<T>* create_world_pool()
+	{
+		const uint32_t id = component_type_id<T>;
+		if (id >= pools.size())
+		{
+			pools.resize(id + 1, WorldPool{ nullptr, nullptr, nullptr });
+		}
+
+		pool_t<T>* created = new pool_t<T>(create_pool<T>());
+		register_pool(&registry, created);
+
+		WorldPool& slot = pools[id];
+		slot.pool = created;
+		slot.contains = [](void* pool, uint32_t entity) {
+			return has_pool_element(static_cast<pool_t<T>*>(pool), entity);
+		};
+		slot.release = [](void* pool) {
+			pool_t<T>* typed = static_cast<pool_t<T>*>(pool);
+			destroy_pool(typed);
+			delete typed;
+		};
+		return created;
+	}
+
+	uint32_t create()
+	{
+		return create_entity(&registry);
+	}
+	bool valid(uint32_t entity) const
+	{
+		return is_entity_valid(&registry, entity);
+	}
+	//removes the entity from every pool
+	bool destroy(uint32_t entity)
+	{
+		return destroy_entity(&registry, entity);
+	}
+
+	//add<T>(entity, args...) constructs T{ args... }, replacing the old value if there was one
+	template<typename T, typename... Args>
+	void add(uint32_t entity, Args&&... args)
+	{
+		add_pool_element(pool<T>(), entity, T{ std::forward<Args>(args)... });
+	}
+	//null if the entity doesnt have a T. Marks it as changed if the pool tracks changes
+	template<typename T>
+	T* get(uint32_t entity)
+	{
+		return find_pool_element(pool<T>(), entity);
+	}
+	template<typename T>
+	bool has(uint32_t entity)
+	{
+		return has_pool_element(pool<T>(), entity);
+	}
+	template<typename T>
+	void remove(uint32_t entity)
+	{
+		remove_pool_element(pool<T>(), entity);
+	}
+
+	//join<A, B, ...>(function) calls function(entity, A&, B&, ...) for every entity that has all the components
+	template<typename... Ts, typename F>
+	void join(F&& function)
+	{
+		join_pools(pool<Ts>()..., function);
+	}
+	//same, skipping the entities that have any of the excluded components
+	template<typename... Ts, typename... Ex, typename F>
+	void join(ExcludeTypes<Ex...>, F&& function)
+	{
+		join_pools(pool<Ts>()..., exclude_pools(pool<Ex>()...), function);
+	}
+
+	//count<A, B, ...>() is the number of entities join<A, B, ...> would visit, without walking the leaves
+	template<typename... Ts>
+	size_t count()
+	{
+		return count_joined(pool<Ts>()...);
+	}
+
+	//calls function(type_id) for every component type the entity has
+	template<typename F>
+	void each_component(uint32_t entity, F&& function)
+	{
+		for (uint32_t id = 0; id < pools.size(); id++)
+		{
+			if (pools[id].pool && pools[id].contains(pools[id].pool, entity))
+			{
+				function(id);
+			}
+		}
+	}
+};
+
+World create_world()
+{
+	World world;
+	world.registry = create_registry();
+	return world;
+}
+
+void destroy_world(World* world)
+{
+	for (WorldPool& slot : world->pools)
+	{
+		if (slot.pool)
+		{
+			slot.release(slot.pool);
+		}
+	}
+	world->pools.clear();
+	destroy_registry(&world->registry);
+}
@@ -1,5 +1,17 @@
 #include "BitTree.h"
+#include "ParallelJoin.h"
+#include "EntityRegistry.h"
+#include "World.h"
+#include "SoaPool.h"
+#include "JoinQuery.h"
+#include "PoolSnapshot.h"
+#include "PoolDelta.h"
+#include "CowPool.h"
+#include "CommandBuffer.h"
 #include <iostream>
+#include <random>
+#include <algorithm>
+#include <filesystem>
 #include <entt.hpp>
 
 #define CATCH_CONFIG_RUNNER
@@ -39,7 +51,6 @@ TEST_CASE("Index Add values", "[bit-tree]") {
 
 
 TEST_CASE("Bitmask operations") {
-	node_pool_index = 0;
 
 	ByteNode* nodeA = allocate_treenode();
 
@@ -91,10 +102,1875 @@ TEST_CASE("Bitmask operations") {
 	//}
 	
 
-	node_pool_index = 0;
+	free_treenode(nodeA);
+	free_treenode(nodeB);
+}
+
+TEST_CASE("Join pools") {
+
+	struct CA { int a; };
+	struct CB { int b; };
+	struct CC { int c; };
+	struct CD { int d; };
+
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	auto poolC = create_pool<CC>();
+	auto poolD = create_pool<CD>();
+
+	int expected = 0;
+	for (uint32_t i = 0; i < 100000; i++) {
+		if (i % 2) add_pool_element(&poolA, i, CA{ int(i) });
+		if (i % 3) add_pool_element(&poolB, i, CB{ int(i) });
+		if (i % 5) add_pool_element(&poolC, i, CC{ int(i) });
+		add_pool_element(&poolD, i, CD{ int(i) });
+
+		if ((i % 2) && (i % 3) && (i % 5)) expected++;
+	}
+
+	int count = 0;
+	bool bmatch = true;
+	join_pools(&poolA, &poolB, &poolC, &poolD, [&](uint32_t entity, CA& a, CB& b, CC& c, CD& d) {
+		bmatch &= (a.a == int(entity)) && (b.b == int(entity)) && (c.c == int(entity)) && (d.d == int(entity));
+		count++;
+		});
+
+	REQUIRE(bmatch);
+	REQUIRE(count == expected);
+}
+
+TEST_CASE("Node arena recycling") {
+
+	NodeArena& arena = node_arenas[node_width_index(sizeof(uint64_t))][node_kind_full];
+	const size_t base_nodes = node_arena_live_nodes();
+
+	std::vector<ByteNode*> nodes;
+	for (uint32_t i = 0; i < arena.nodes_per_chunk * 4; i++) {
+		nodes.push_back(allocate_treenode());
+	}
+	REQUIRE(node_arena_live_nodes() == base_nodes + nodes.size());
+
+	//freed nodes are handed out again before the arena grows
+	const size_t chunks = arena.chunk_count;
+	ByteNode* freed = nodes.back();
+	free_treenode(freed);
+	nodes.back() = allocate_treenode();
+	REQUIRE(nodes.back() == freed);
+	REQUIRE(arena.chunk_count == chunks);
+
+	for (ByteNode* node : nodes) {
+		free_treenode(node);
+	}
+	REQUIRE(node_arena_live_nodes() == base_nodes);
+	REQUIRE(arena.chunk_count < chunks);
+
+	struct CA { int a; };
+	auto poolA = create_pool<CA>();
+	for (uint32_t i = 0; i < 100000; i++) {
+		add_pool_element(&poolA, i * 7, CA{ int(i) });
+	}
+	for (uint32_t i = 0; i < 100000; i += 2) {
+		remove_pool_element(&poolA, i * 7);
+	}
+
+	CA value;
+	REQUIRE(!get_pool_element(&poolA, 14, value));
+	REQUIRE(get_pool_element(&poolA, 21, value));
+	REQUIRE(value.a == 3);
+
+	for (uint32_t i = 1; i < 100000; i += 2) {
+		remove_pool_element(&poolA, i * 7);
+	}
+	//only the root is left
+	REQUIRE(node_arena_live_nodes() == base_nodes + 1);
+
+	destroy_pool(&poolA);
+	REQUIRE(node_arena_live_nodes() == base_nodes);
+}
+
+TEST_CASE("Compact node kinds") {
+
+	ByteTree tree = create_bytetree();
+	REQUIRE(tree.root->kind == 0);
+
+	//fill one leaf in a scattered order, so the node goes through every kind
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t index = (i * 97) & 0xFF;
+		add_tree_val(&tree, index, index + 1000);
+	}
+	REQUIRE(tree.root->kind == 0);
+	REQUIRE(node_child(node_child(tree.root, 0), 0)->kind == node_kind_full);
+
+	uint64_t val;
+	for (uint32_t i = 0; i < 256; i++) {
+		REQUIRE(get_tree_val(&tree, i, val));
+		REQUIRE(val == i + 1000);
+	}
+
+	for (uint32_t i = 0; i < 250; i++) {
+		remove_tree_val(&tree, (i * 97) & 0xFF);
+	}
+	ByteNode* leaf = node_child(node_child(tree.root, 0), 0);
+	REQUIRE(leaf->kind == 1);
+	REQUIRE(node_child_count(leaf) == 6);
+
+	for (uint32_t i = 250; i < 256; i++) {
+		uint32_t index = (i * 97) & 0xFF;
+		REQUIRE(get_tree_val(&tree, index, val));
+		REQUIRE(val == index + 1000);
+	}
+	REQUIRE(!get_tree_val(&tree, 0, val));
+
+	destroy_bytetree(&tree);
+}
+
+TEST_CASE("Bitmask index expansion") {
+
+	std::mt19937_64 rng{ 1234 };
+
+	for (int density = 1; density <= 64; density++) {
+		uint64_t mask = 0;
+		for (int i = 0; i < density; i++) {
+			mask |= uint64_t(1) << (rng() % 64);
+		}
+
+		uint8_t indices[64 + 8];
+		int nindices = expand_bitmask_indices(mask, indices);
+		REQUIRE(nindices == popcount64(mask));
+
+		uint64_t rebuilt = 0;
+		for (int i = 0; i < nindices; i++) {
+			if (i > 0) {
+				REQUIRE(indices[i] > indices[i - 1]);
+			}
+			rebuilt |= uint64_t(1) << indices[i];
+		}
+		REQUIRE(rebuilt == mask);
+	}
+
+	REQUIRE(expand_bitmask_indices(0, nullptr) == 0);
+}
+
+TEST_CASE("Merge bitmask kernels") {
+
+	std::mt19937_64 rng{ 1234 };
+
+	std::vector<ByteNode*> nodes;
+	for (int n = 0; n < 9; n++) {
+		ByteNode* node = allocate_treenode(uint8_t(n % node_kind_count));
+		REQUIRE((uintptr_t(&node->bytemask[0]) % 32) == 0);
+		for (int i = 0; i < 4; i++) {
+			node->bytemask[i] = rng() | rng() | rng();
+		}
+		nodes.push_back(node);
+	}
+
+	const SimdLevel detected = simd_level;
+	for (int nbitmasks = 1; nbitmasks <= 9; nbitmasks++) {
+		uint64_t* bitmasks[9];
+		uint64_t expected[4] = { ~uint64_t(0), ~uint64_t(0), ~uint64_t(0), ~uint64_t(0) };
+		for (int m = 0; m < nbitmasks; m++) {
+			bitmasks[m] = &nodes[m]->bytemask[0];
+			for (int i = 0; i < 4; i++) {
+				expected[i] &= nodes[m]->bytemask[i];
+			}
+		}
+
+		for (int level = SIMD_SCALAR; level <= detected; level++) {
+			simd_level = SimdLevel(level);
+
+			uint64_t out[4];
+			bool bany = merge_bitmasks(bitmasks, out, uint8_t(nbitmasks), 4);
+			REQUIRE(bany == ((expected[0] | expected[1] | expected[2] | expected[3]) != 0));
+			for (int i = 0; i < 4; i++) {
+				REQUIRE(out[i] == expected[i]);
+			}
+		}
+	}
+
+	//an empty mask stops the merge early and reports nothing in common
+	nodes[0]->bytemask[0] = nodes[0]->bytemask[1] = nodes[0]->bytemask[2] = nodes[0]->bytemask[3] = 0;
+	for (int level = SIMD_SCALAR; level <= detected; level++) {
+		simd_level = SimdLevel(level);
+
+		uint64_t out[4];
+		REQUIRE(!merge_node_bitmasks(std::array<ByteNode*, 3>{ nodes[0], nodes[1], nodes[2] }, out));
+	}
+	simd_level = detected;
+
+	for (ByteNode* node : nodes) {
+		free_treenode(node);
+	}
+}
+
+TEST_CASE("Parallel join pools") {
+
+	struct CA { int a; };
+	struct CB { int b; };
+
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+
+	constexpr uint32_t num_entities = 300000;
+	int expected = 0;
+	for (uint32_t i = 0; i < num_entities; i++) {
+		if (i % 2) add_pool_element(&poolA, i, CA{ int(i) });
+		if (i % 3) add_pool_element(&poolB, i, CB{ int(i) });
+		if ((i % 2) && (i % 3)) expected++;
+	}
+
+	TaskPool* taskpool = create_task_pool(4);
+
+	for (JoinGrain grain : { JoinGrain::Root, JoinGrain::Leaf, JoinGrain::Auto }) {
+		std::vector<std::atomic<int>> visits(num_entities);
+		std::atomic<int> count{ 0 };
+		std::atomic<bool> bmatch{ true };
+
+		parallel_join_pools(taskpool, grain, &poolA, &poolB, [&](uint32_t entity, CA& a, CB& b) {
+			if (a.a != int(entity) || b.b != int(entity)) bmatch = false;
+			visits[entity]++;
+			count++;
+			});
+
+		REQUIRE(bmatch);
+		REQUIRE(count == expected);
+
+		bool bonce = true;
+		for (uint32_t i = 0; i < num_entities; i++) {
+			bonce &= visits[i] == (((i % 2) && (i % 3)) ? 1 : 0);
+		}
+		REQUIRE(bonce);
+	}
+
+	destroy_task_pool(taskpool);
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+}
+
+TEST_CASE("Bulk add pool elements") {
+
+	struct CA { int a; };
+
+	auto poolBulk = create_pool<CA>();
+	auto poolSingle = create_pool<CA>();
+
+	std::mt19937 rng{ 1234 };
+
+	//a few entities are already in the pool before the batch
+	for (uint32_t i = 0; i < 1000; i++) {
+		uint32_t entity = rng() & 0xFFFFF;
+		add_pool_element(&poolBulk, entity, CA{ -1 });
+		add_pool_element(&poolSingle, entity, CA{ -1 });
+	}
+
+	std::vector<uint32_t> entities;
+	std::vector<CA> values;
+	for (uint32_t i = 0; i < 50000; i++) {
+		//clustered ids with some duplicates, plus scattered ones
+		uint32_t entity = (i % 4) ? (i * 3) / 2 : rng() & 0xFFFFF;
+		entities.push_back(entity);
+		values.push_back(CA{ int(i) });
+	}
+
+	add_pool_elements(&poolBulk, entities.data(), values.data(), entities.size());
+	for (size_t i = 0; i < entities.size(); i++) {
+		add_pool_element(&poolSingle, entities[i], values[i]);
+	}
+
+	REQUIRE(poolBulk.Dense.size() == poolSingle.Dense.size());
+
+	bool bmatch = true;
+	for (uint32_t entity : poolSingle.Reverse) {
+		CA bulk{}, single{};
+		bmatch &= get_pool_element(&poolBulk, entity, bulk);
+		get_pool_element(&poolSingle, entity, single);
+		bmatch &= bulk.a == single.a;
+	}
+	REQUIRE(bmatch);
+
+	destroy_pool(&poolBulk);
+	destroy_pool(&poolSingle);
+}
+
+TEST_CASE("Bulk remove pool elements") {
+
+	struct CA { int a; };
+
+	auto poolA = create_pool<CA>();
+	const size_t base_nodes = node_arena_live_nodes();
+
+	std::mt19937 rng{ 1234 };
+
+	std::vector<uint32_t> entities;
+	std::vector<CA> values;
+	for (uint32_t i = 0; i < 100000; i++) {
+		entities.push_back(i * 5);
+		values.push_back(CA{ int(i * 5) });
+	}
+	add_pool_elements(&poolA, entities.data(), values.data(), entities.size());
+
+	//remove a random 70%, with a few entities that are not in the pool and a duplicate
+	std::shuffle(entities.begin(), entities.end(), rng);
+	std::vector<uint32_t> removed(entities.begin(), entities.begin() + 70000);
+	std::vector<uint32_t> kept(entities.begin() + 70000, entities.end());
+	removed.push_back(3);
+	removed.push_back(removed[0]);
+
+	remove_pool_elements(&poolA, removed.data(), removed.size());
+
+	REQUIRE(poolA.Dense.size() == kept.size());
+	REQUIRE(poolA.Reverse.size() == kept.size());
+
+	bool bmatch = true;
+	for (uint32_t entity : kept) {
+		CA value;
+		bmatch &= get_pool_element(&poolA, entity, value) && value.a == int(entity);
+	}
+	for (size_t i = 0; i < 70000; i++) {
+		uint64_t val;
+		bmatch &= !get_tree_val(&poolA.tree, removed[i], val);
+	}
+	REQUIRE(bmatch);
+
+	//removing everything prunes the tree down to the root
+	remove_pool_elements(&poolA, kept.data(), kept.size());
+	REQUIRE(poolA.Dense.empty());
+	REQUIRE(node_arena_live_nodes() == base_nodes);
+	REQUIRE(is_node_empty(poolA.tree.root));
+
+	destroy_pool(&poolA);
+}
+
+TEST_CASE("Entity registry") {
+
+	struct CA { int a; };
+	struct CB { float b; };
+
+	auto registry = create_registry();
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	register_pool(&registry, &poolA);
+	register_pool(&registry, &poolB);
+
+	std::vector<uint32_t> entities(1000);
+	create_entities(&registry, entities.data(), entities.size());
+	for (uint32_t i = 0; i < entities.size(); i++) {
+		REQUIRE(entity_index(entities[i]) == i);
+		add_pool_element(&poolA, entities[i], CA{ int(i) });
+		if (i % 2) {
+			add_pool_element(&poolB, entities[i], CB{ float(i) });
+		}
+	}
+	REQUIRE(registry_alive_count(&registry) == 1000);
+
+	//destroy removes from every registered pool
+	REQUIRE(destroy_entity(&registry, entities[501]));
+	REQUIRE(destroy_entity(&registry, entities[7]));
+	REQUIRE(!destroy_entity(&registry, entities[7]));
+	REQUIRE(!is_entity_valid(&registry, entities[7]));
+	//the handle create will hand out next is not alive yet
+	REQUIRE(!is_entity_valid(&registry, make_entity(7, 1)));
+	REQUIRE(!destroy_entity(&registry, make_entity(7, 1)));
+	REQUIRE(registry_alive_count(&registry) == 998);
+	REQUIRE(poolA.Dense.size() == 998);
+	REQUIRE(poolB.Dense.size() == 498);
+
+	//lowest index is recycled first, with a new generation
+	uint32_t recycled = create_entity(&registry);
+	REQUIRE(entity_index(recycled) == 7);
+	REQUIRE(entity_generation(recycled) == 1);
+	REQUIRE(is_entity_valid(&registry, recycled));
+	REQUIRE(!is_entity_valid(&registry, entities[7]));
+
+	//the stale handle does not see the component added to the new one
+	add_pool_element(&poolA, recycled, CA{ -1 });
+	uint64_t val;
+	REQUIRE(get_tree_val(&poolA.tree, 7, val));
+	REQUIRE(poolA.Reverse[val] == recycled);
+	REQUIRE(poolA.Reverse[val] != entities[7]);
+	REQUIRE(!destroy_entity(&registry, entities[7]));
+	REQUIRE(poolA.Dense.size() == 999);
+	CA stale_value;
+	REQUIRE(!get_pool_element(&poolA, entities[7], stale_value));
+	REQUIRE(get_pool_element(&poolA, recycled, stale_value));
+	REQUIRE(stale_value.a == -1);
+
+	REQUIRE(entity_index(create_entity(&registry)) == 501);
+	REQUIRE(entity_index(create_entity(&registry)) == 1000);
+	REQUIRE(registry_alive_count(&registry) == 1001);
+
+	destroy_registry(&registry);
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+}
+
+TEST_CASE("Leaf value widths") {
+
+	struct CA { int a; };
+	struct CB { int b; };
+
+	reset_node_arena();
+
+	//a single full leaf per pool
+	auto pool16 = create_pool<CA, uint16_t>();
+	auto pool32 = create_pool<CB, uint32_t>();
+	auto pool64 = create_pool<CB, uint64_t>();
+	for (uint32_t i = 0; i < 256; i++) {
+		add_pool_element(&pool16, i, CA{ int(i) });
+		add_pool_element(&pool32, i, CB{ int(i) * 2 });
+		add_pool_element(&pool64, i, CB{ int(i) * 2 });
+	}
+
+	ByteNode* leaf16 = *find_tree_leaf(&pool16.tree, 0);
+	ByteNode* leaf32 = *find_tree_leaf(&pool32.tree, 0);
+	ByteNode* leaf64 = *find_tree_leaf(&pool64.tree, 0);
+	REQUIRE(leaf16->slot_bytes == 2);
+	REQUIRE(leaf32->slot_bytes == 4);
+	REQUIRE(leaf64->slot_bytes == 8);
+	REQUIRE(leaf16->kind == node_kind_full);
+	REQUIRE(node_bytes(node_kind_full, 4) == node_bytes(node_kind_full, 8) - 256 * 4);
+	REQUIRE(node_bytes(node_kind_full, 2) == node_bytes(node_kind_full, 8) - 256 * 6);
+	//inner nodes always hold pointers
+	REQUIRE(pool16.tree.root->slot_bytes == 8);
+
+	//leaves shrink and grow again through every kind without losing values
+	for (uint32_t i = 0; i < 256; i++) {
+		if (i % 37) {
+			remove_pool_element(&pool16, i);
+		}
+	}
+	REQUIRE((*find_tree_leaf(&pool16.tree, 0))->kind == 1);
+	for (uint32_t i = 0; i < 256; i++) {
+		add_pool_element(&pool16, i, CA{ int(i) });
+	}
+
+	//pools of different widths join together
+	int count = 0;
+	bool bmatch = true;
+	join_pools(&pool16, &pool32, [&](uint32_t entity, CA& a, CB& b) {
+		bmatch &= (a.a == int(entity)) && (b.b == int(entity) * 2);
+		count++;
+		});
+	REQUIRE(bmatch);
+	REQUIRE(count == 256);
+
+	destroy_pool(&pool16);
+	destroy_pool(&pool32);
+	destroy_pool(&pool64);
+	REQUIRE(node_arena_live_nodes() == 0);
+}
+
+TEST_CASE("Sort pool by index") {
+
+	struct CA { int a; };
+
+	std::mt19937 rng{ 1234 };
+
+	std::vector<uint32_t> entities;
+	for (uint32_t i = 0; i < 20000; i++) {
+		entities.push_back(i * 13);
+	}
+	std::shuffle(entities.begin(), entities.end(), rng);
+
+	auto is_sorted = [](ComponentPool<CA>& pool) {
+		bool bsorted = true;
+		for (size_t i = 1; i < pool.Reverse.size(); i++) {
+			bsorted &= (pool.Reverse[i - 1] & 0xFFFFF) < (pool.Reverse[i] & 0xFFFFF);
+		}
+		return bsorted;
+	};
+	auto is_consistent = [](ComponentPool<CA>& pool) {
+		bool bmatch = true;
+		for (size_t i = 0; i < pool.Reverse.size(); i++) {
+			CA value;
+			bmatch &= get_pool_element(&pool, pool.Reverse[i], value) && value.a == int(pool.Reverse[i]) && pool.Dense[i].a == value.a;
+		}
+		return bmatch;
+	};
+
+	auto poolA = create_pool<CA>();
+	for (uint32_t entity : entities) {
+		add_pool_element(&poolA, entity, CA{ int(entity) });
+	}
+	REQUIRE(!is_sorted(poolA));
+
+	sort_pool_by_index(&poolA);
+	REQUIRE(poolA.Dense.size() == entities.size());
+	REQUIRE(is_sorted(poolA));
+	REQUIRE(is_consistent(poolA));
+
+	//incremental, with a budget far smaller than the pool
+	auto poolB = create_pool<CA>();
+	for (uint32_t entity : entities) {
+		add_pool_element(&poolB, entity, CA{ int(entity) });
+	}
+
+	PoolSortCursor cursor;
+	int steps = 0;
+	while (!sort_pool_by_index_step(&poolB, &cursor, 500)) {
+		steps++;
+	}
+	REQUIRE(steps > 10);
+	REQUIRE(is_sorted(poolB));
+	REQUIRE(is_consistent(poolB));
+
+	//removals in the middle of a pass leave the pool valid, and the next pass finishes the sort
+	std::shuffle(poolB.Dense.begin(), poolB.Dense.end(), rng);
+	for (size_t i = 0; i < poolB.Dense.size(); i++) {
+		add_tree_val(&poolB.tree, poolB.Dense[i].a, i);
+		poolB.Reverse[i] = poolB.Dense[i].a;
+	}
+	for (int i = 0; i < 5; i++) {
+		sort_pool_by_index_step(&poolB, &cursor, 500);
+	}
+	for (uint32_t i = 0; i < 1000; i++) {
+		remove_pool_element(&poolB, entities[i]);
+	}
+	REQUIRE(is_consistent(poolB));
+	while (!sort_pool_by_index_step(&poolB, &cursor, 500)) {}
+	while (!sort_pool_by_index_step(&poolB, &cursor, 500)) {}
+	REQUIRE(poolB.Dense.size() == entities.size() - 1000);
+	REQUIRE(is_sorted(poolB));
+	REQUIRE(is_consistent(poolB));
+
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+}
+
+TEST_CASE("World") {
+
+	struct CA { int a; };
+	struct CB { float b; };
+	struct CC { int c; };
+
+	World world = create_world();
+
+	std::vector<uint32_t> entities;
+	for (int i = 0; i < 1000; i++) {
+		uint32_t et = world.create();
+		entities.push_back(et);
+		world.add<CA>(et, i);
+		if (i % 2) {
+			world.add<CB>(et, float(i));
+		}
+	}
+
+	REQUIRE(component_type_id<CA> != component_type_id<CB>);
+	REQUIRE(world.pool<CA>() == world.pool<CA>());
+	REQUIRE(world.get<CA>(entities[10])->a == 10);
+	REQUIRE(world.get<CB>(entities[10]) == nullptr);
+	REQUIRE(world.has<CB>(entities[11]));
+	REQUIRE(!world.has<CC>(entities[11]));
+
+	int count = 0;
+	bool bmatch = true;
+	world.join<CA, CB>([&](uint32_t entity, CA& a, CB& b) {
+		bmatch &= (b.b == float(a.a)) && (entity == entities[a.a]);
+		count++;
+		});
+	REQUIRE(bmatch);
+	REQUIRE(count == 500);
+
+	std::vector<uint32_t> types;
+	world.each_component(entities[11], [&](uint32_t type_id) {
+		types.push_back(type_id);
+		});
+	REQUIRE(types.size() == 2);
+
+	//destroying an entity removes it from every pool
+	REQUIRE(world.destroy(entities[11]));
+	REQUIRE(!world.valid(entities[11]));
+	REQUIRE(world.pool<CA>()->Dense.size() == 999);
+	REQUIRE(world.pool<CB>()->Dense.size() == 499);
+	REQUIRE(world.get<CA>(entities[11]) == nullptr);
+
+	world.remove<CB>(entities[13]);
+	REQUIRE(!world.has<CB>(entities[13]));
+	REQUIRE(world.has<CA>(entities[13]));
+
+	destroy_world(&world);
+	REQUIRE(world.pools.empty());
+}
+
+TEST_CASE("Join pools with exclusions") {
+
+	struct CA { int a; };
+	struct CB { int b; };
+	struct CC { int c; };
+	struct CD { int d; };
+
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	auto poolC = create_pool<CC, uint16_t>();
+	auto poolD = create_pool<CD>();
+
+	for (uint32_t i = 0; i < 200000; i++) {
+		add_pool_element(&poolA, i, CA{ int(i) });
+		if (i % 2) add_pool_element(&poolB, i, CB{ int(i) });
+		//a whole subtree of C, plus scattered entities
+		if (i < 65536 || i % 7 == 0) add_pool_element(&poolC, i / 4, CC{ int(i / 4) });
+		if (i % 5 == 0) add_pool_element(&poolD, i, CD{ int(i) });
+	}
+
+	auto excluded = [&](uint32_t entity, bool bwithD) {
+		CC c;
+		CD d;
+		return get_pool_element(&poolC, entity, c) || (bwithD && get_pool_element(&poolD, entity, d));
+	};
+
+	int expected = 0;
+	for (uint32_t i = 1; i < 200000; i += 2) {
+		expected += excluded(i, false) ? 0 : 1;
+	}
+
+	int count = 0;
+	bool bmatch = true;
+	join_pools(&poolA, &poolB, exclude_pools(&poolC), [&](uint32_t entity, CA& a, CB& b) {
+		bmatch &= (a.a == int(entity)) && (b.b == int(entity)) && !excluded(entity, false);
+		count++;
+		});
+	REQUIRE(bmatch);
+	REQUIRE(count == expected);
+
+	expected = 0;
+	for (uint32_t i = 1; i < 200000; i += 2) {
+		expected += excluded(i, true) ? 0 : 1;
+	}
+
+	count = 0;
+	join_pools(&poolA, &poolB, exclude_pools(&poolC, &poolD), [&](uint32_t entity, CA& a, CB& b) {
+		bmatch &= !excluded(entity, true);
+		count++;
+		});
+	REQUIRE(bmatch);
+	REQUIRE(count == expected);
+
+	//an empty exclude pool excludes nothing
+	auto poolE = create_pool<CD>();
+	count = 0;
+	join_pools(&poolA, exclude_pools(&poolE), [&](uint32_t entity, CA& a) {
+		count++;
+		});
+	REQUIRE(count == 200000);
+
+	World world = create_world();
+	for (int i = 0; i < 100; i++) {
+		uint32_t et = world.create();
+		world.add<CA>(et, i);
+		world.add<CB>(et, i);
+		if (i % 3 == 0) world.add<CC>(et, i);
+	}
+	count = 0;
+	world.join<CA, CB>(exclude<CC>, [&](uint32_t entity, CA& a, CB& b) {
+		bmatch &= (a.a % 3) != 0;
+		count++;
+		});
+	REQUIRE(bmatch);
+	REQUIRE(count == 66);
+
+	destroy_world(&world);
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+	destroy_pool(&poolC);
+	destroy_pool(&poolD);
+	destroy_pool(&poolE);
+}
+
+TEST_CASE("Change tracking") {
+
+	struct CA { int a; };
+	struct CB { int b; };
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	for (uint32_t i = 0; i < 100000; i++) {
+		add_pool_element(&poolA, i, CA{ int(i) });
+		add_pool_element(&poolB, i, CB{ int(i) });
+	}
+	REQUIRE(!is_tracking_changes(&poolA));
+	REQUIRE(!is_changed(&poolA, 5));
+
+	enable_change_tracking(&poolA);
+
+	//mutable accesses mark, reads dont
+	find_pool_element(&poolA, 10)->a = -10;
+	get_pool_element_raw(&poolA, 70000).a = -70000;
+	add_pool_element(&poolA, 99999, CA{ -99999 });
+	add_pool_element(&poolA, 150000, CA{ -150000 });
+	CA value;
+	REQUIRE(get_pool_element(&poolA, 20, value));
+	REQUIRE(has_pool_element(&poolA, 30));
+
+	std::vector<uint32_t> batch = { 500, 40000, 40001 };
+	std::vector<CA> batch_values = { CA{ -500 }, CA{ -40000 }, CA{ -40001 } };
+	add_pool_elements(&poolA, batch.data(), batch_values.data(), batch.size());
+
+	std::vector<uint32_t> changed;
+	bool bmatch = true;
+	iterate_changed(&poolA, [&](uint32_t entity, CA& a) {
+		bmatch &= a.a == -int(entity);
+		changed.push_back(entity);
+		});
+	REQUIRE(bmatch);
+	REQUIRE(changed == std::vector<uint32_t>{ 10, 500, 40000, 40001, 70000, 99999, 150000 });
+	REQUIRE(is_changed(&poolA, 40001));
+	REQUIRE(!is_changed(&poolA, 20));
+
+	//a join restricted to the changed elements of A, minus the ones in an excluded pool
+	auto poolC = create_pool<CB>();
+	add_pool_element(&poolC, 500, CB{ 0 });
+	changed.clear();
+	join_pools(&poolA, &poolB, changed_pools(&poolA), exclude_pools(&poolC), [&](uint32_t entity, CA& a, CB& b) {
+		bmatch &= b.b == int(entity);
+		changed.push_back(entity);
+		});
+	REQUIRE(bmatch);
+	REQUIRE(changed == std::vector<uint32_t>{ 10, 40000, 40001, 70000, 99999 });
+
+	//removed elements dont show up even if they were marked
+	remove_pool_element(&poolA, 70000);
+	changed.clear();
+	iterate_changed(&poolA, [&](uint32_t entity, CA& a) {
+		changed.push_back(entity);
+		});
+	REQUIRE(changed.size() == 6);
+
+	clear_changed(&poolA);
+	changed.clear();
+	iterate_changed(&poolA, [&](uint32_t entity, CA& a) {
+		changed.push_back(entity);
+		});
+	REQUIRE(changed.empty());
+	REQUIRE(is_tracking_changes(&poolA));
+
+	//joins mark the pools their callback takes as T&, const T& and generic callbacks only read
+	join_pools(&poolA, &poolB, [&](uint32_t entity, const CA& a, CB& b) {
+		bmatch &= a.a == b.b || a.a == -b.b;
+		});
+	join_pools(&poolA, [&](uint32_t entity, const auto& a) {
+		bmatch &= a.a == int(entity) || a.a == -int(entity);
+		});
+	REQUIRE(bmatch);
+	REQUIRE(tree_size(&poolA.changed) == 0);
+	join_pools_range(1000, 1300, &poolA, &poolB, [&](uint32_t entity, CA& a, const CB& b) {
+		a.a = b.b + 1;
+		});
+	REQUIRE(tree_size(&poolA.changed) == 300);
+	REQUIRE(is_changed(&poolA, 1000));
+	REQUIRE(is_changed(&poolA, 1299));
+	REQUIRE(!is_changed(&poolA, 1300));
+
+	//chunked joins mark the pools whose chunk type is not const
+	clear_changed(&poolA);
+	join_pools_chunked(&poolA, &poolB, [&](JoinChunk<const CA, CB>& chunk) {
+		bmatch &= chunk.count > 0 && join_chunk_component<1>(chunk, 0).b == int(chunk.entities[0]);
+		});
+	REQUIRE(bmatch);
+	REQUIRE(tree_size(&poolA.changed) == 0);
+	join_pools_chunked(&poolA, [&](JoinChunk<CA>& chunk) {
+		join_chunk_component<0>(chunk, 0).a++;
+		});
+	REQUIRE(tree_size(&poolA.changed) == poolA.Dense.size());
+
+	//a stale handle stores nothing, so it marks nothing
+	clear_changed(&poolA);
+	add_pool_element(&poolA, make_entity(5, 1), CA{ 5 });
+	const uint32_t stale_batch[] = { make_entity(6, 1) };
+	add_pool_elements(&poolA, stale_batch, batch_values.data(), 1);
+	REQUIRE(tree_size(&poolA.changed) == 0);
+	REQUIRE(find_pool_element(&poolA, 5)->a == 5);
+
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+	destroy_pool(&poolC);
+	REQUIRE(node_arena_live_nodes() == 0);
+}
+
+TEST_CASE("Chunked join") {
+
+	struct CA { int a; };
+	struct CB { int b; };
+
+	std::mt19937 rng{ 1234 };
+
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB, uint16_t>();
+
+	std::vector<uint32_t> entities;
+	for (uint32_t i = 0; i < 60000; i++) {
+		entities.push_back(i * 3);
+	}
+	std::shuffle(entities.begin(), entities.end(), rng);
+	for (uint32_t entity : entities) {
+		add_pool_element(&poolA, entity, CA{ int(entity) });
+		if (entity % 4) {
+			add_pool_element(&poolB, entity, CB{ int(entity) * 2 });
+		}
+	}
+
+	auto check = [&](int& contiguous) {
+		std::vector<uint32_t> expected;
+		join_pools(&poolA, &poolB, [&](uint32_t entity, CA& a, CB& b) {
+			expected.push_back(entity);
+			});
+
+		std::vector<uint32_t> found;
+		bool bmatch = true;
+		join_pools_chunked(&poolA, &poolB, [&](JoinChunk<CA, CB>& chunk) {
+			bmatch &= chunk.count > 0 && chunk.count <= 64;
+			contiguous += chunk.bcontiguous;
+			for (int i = 0; i < chunk.count; i++) {
+				const uint32_t entity = chunk.entities[i];
+				bmatch &= join_chunk_component<0>(chunk, i).a == int(entity);
+				bmatch &= join_chunk_component<1>(chunk, i).b == int(entity) * 2;
+				found.push_back(entity);
+			}
+			});
+		return bmatch && found == expected;
+	};
+
+	int contiguous = 0;
+	REQUIRE(check(contiguous));
+	REQUIRE(contiguous == 0);
+
+	//in tree order, every chunk is a span of both dense arrays
+	sort_pool_by_index(&poolA);
+	sort_pool_by_index(&poolB);
+	for (uint32_t i = 0; i < 60000; i++) {
+		if ((i * 3) % 4 == 0) {
+			remove_pool_element(&poolA, i * 3);
+		}
+	}
+	sort_pool_by_index(&poolA);
+
+	int chunks = 0;
+	join_pools_chunked(&poolA, &poolB, [&](JoinChunk<CA, CB>& chunk) {
+		chunks++;
+		});
+	contiguous = 0;
+	REQUIRE(check(contiguous));
+	REQUIRE(contiguous == chunks);
+
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+}
+
+struct SoaPosition
+{
+	float x, y, z;
+};
+template<>
+struct SoaFields<SoaPosition>
+{
+	static constexpr auto members = std::make_tuple(&SoaPosition::x, &SoaPosition::y, &SoaPosition::z);
+};
+
+TEST_CASE("SoA pool") {
+
+	struct CB
+	{
+		int b;
+	};
+
+	reset_node_arena();
+	auto soa = create_soa_pool<SoaPosition>();
+	auto poolB = create_pool<CB>();
+
+	for (uint32_t i = 0; i < 20000; i++) {
+		add_pool_element(&soa, i, SoaPosition{ float(i), float(i) * 2.f, float(i) * 3.f });
+		if (i % 3 == 0) {
+			add_pool_element(&poolB, i, CB{ int(i) });
+		}
+	}
+	for (uint32_t i = 0; i < 20000; i += 7) {
+		remove_pool_element(&soa, i);
+	}
+
+	bool bmatch = true;
+	for (uint32_t i = 0; i < 20000; i++) {
+		SoaPosition p;
+		const bool found = get_pool_element(&soa, i, p);
+		bmatch &= found == (i % 7 != 0) && has_pool_element(&soa, i) == found;
+		if (found) {
+			bmatch &= p.x == float(i) && p.y == float(i) * 2.f && p.z == float(i) * 3.f;
+		}
+	}
+	REQUIRE(bmatch);
+
+	//every column has one entry per element, on its own cache line
+	REQUIRE(std::get<0>(soa.Columns).size() == soa.Reverse.size());
+	REQUIRE(std::get<2>(soa.Columns).size() == soa.Reverse.size());
+	REQUIRE(reinterpret_cast<uintptr_t>(soa_column<1>(&soa)) % soa_column_alignment == 0);
+
+	//single field update over the column, then read back through the tree
+	float* ys = soa_column<1>(&soa);
+	for (size_t i = 0; i < soa.Reverse.size(); i++) {
+		ys[i] += 1.f;
+	}
+
+	int count = 0;
+	join_pools(&soa, &poolB, [&](uint32_t entity, SoaRef<SoaPosition> p, CB& b) {
+		auto& [x, y, z] = p;
+		bmatch &= x == float(entity) && y == float(entity) * 2.f + 1.f && b.b == int(entity);
+		z = 0.f;
+		count++;
+		});
+	REQUIRE(bmatch);
+	REQUIRE(count == 20000 / 3 - 20000 / 21);
+
+	join_pools(&soa, exclude_pools(&poolB), [&](uint32_t entity, SoaRef<SoaPosition> p) {
+		bmatch &= entity % 3 != 0 && std::get<2>(p) == float(entity) * 3.f;
+		});
+	REQUIRE(bmatch);
+
+	destroy_pool(&soa);
+	destroy_pool(&poolB);
+}
+
+TEST_CASE("Tag pools") {
+
+	struct CA { int a; };
+	struct Tag {};
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	auto tags = create_pool<Tag>();
+	static_assert(std::is_same_v<decltype(tags), TagPool<Tag>>, "empty types get a tag pool");
+
+	for (uint32_t i = 0; i < 100000; i++) {
+		add_pool_element(&poolA, i, CA{ int(i) });
+		if (i % 3 == 0) {
+			add_pool_element(&tags, i, Tag{});
+		}
+	}
+	add_pool_element(&tags, 3, Tag{});
+	REQUIRE(tags.count == 33334);
+
+	//the leaves have no slots, only a header and the bitmask
+	ByteNode* leaf = *find_tree_leaf(&tags.tree, 0);
+	REQUIRE(leaf->slot_bytes == 0);
+	REQUIRE(leaf->kind == node_kind_full);
+	REQUIRE(node_arenas[node_width_index(0)][node_kind_full].node_bytes == node_bytes(node_kind_full, 0));
+	REQUIRE(node_bytes(node_kind_full, 0) <= 64);
+
+	for (uint32_t i = 0; i < 100000; i += 6) {
+		remove_pool_element(&tags, i);
+	}
+	REQUIRE(tags.count == 33334 - 16667);
+
+	bool bmatch = true;
+	for (uint32_t i = 0; i < 100000; i++) {
+		bmatch &= has_pool_element(&tags, i) == (i % 6 == 3);
+		bmatch &= (find_pool_element(&tags, i) != nullptr) == (i % 6 == 3);
+	}
+	REQUIRE(bmatch);
+
+	int count = 0;
+	join_pools(&poolA, &tags, [&](uint32_t entity, CA& a, Tag&) {
+		bmatch &= a.a == int(entity) && entity % 6 == 3;
+		count++;
+		});
+	REQUIRE(bmatch);
+	REQUIRE(count == 16667);
+
+	//a tag pool first in the join gives the entity index
+	count = 0;
+	join_pools(&tags, &poolA, [&](uint32_t entity, Tag&, CA& a) {
+		bmatch &= a.a == int(entity);
+		count++;
+		});
+	REQUIRE(bmatch);
+	REQUIRE(count == 16667);
+
+	count = 0;
+	join_pools(&poolA, exclude_pools(&tags), [&](uint32_t entity, CA& a) {
+		bmatch &= entity % 6 != 3;
+		count++;
+		});
+	REQUIRE(bmatch);
+	REQUIRE(count == 100000 - 16667);
+
+	//removing every tag frees every node below the root
+	for (uint32_t i = 3; i < 100000; i += 6) {
+		remove_pool_element(&tags, i);
+	}
+	REQUIRE(tags.count == 0);
+	REQUIRE(is_node_empty(tags.tree.root));
+
+	destroy_pool(&poolA);
+	destroy_pool(&tags);
+
+	World world = create_world();
+	const uint32_t et = world.create();
+	world.add<CA>(et, 1);
+	world.add<Tag>(et);
+	REQUIRE(world.has<Tag>(et));
+	count = 0;
+	world.join<CA, Tag>([&](uint32_t entity, CA& a, Tag&) {
+		count++;
+		});
+	REQUIRE(count == 1);
+	world.destroy(et);
+	REQUIRE(world.pool<Tag>()->count == 0);
+
+	//a tag pool first still hands out the full handle, taken from the first pool with values
+	const uint32_t reused = world.create();
+	REQUIRE(entity_index(reused) == entity_index(et));
+	REQUIRE(reused != et);
+	world.add<CA>(reused, 2);
+	world.add<Tag>(reused);
+	std::vector<uint32_t> joined;
+	world.join<Tag, CA>([&](uint32_t entity, Tag&, CA&) {
+		joined.push_back(entity);
+		});
+	join_pools_planned(world.pool<Tag>(), world.pool<CA>(), [&](uint32_t entity, Tag&, CA&) {
+		joined.push_back(entity);
+		});
+	auto* query = create_query(world.pool<Tag>(), world.pool<CA>());
+	iterate_query(query, [&](uint32_t entity, Tag&, CA&) {
+		joined.push_back(entity);
+		});
+	destroy_query(query);
+	REQUIRE(joined == std::vector<uint32_t>{ reused, reused, reused });
+	REQUIRE(world.get<CA>(joined[0])->a == 2);
+	destroy_world(&world);
+}
+
+TEST_CASE("Range queries") {
+
+	struct CA { int a; };
+	struct CB { int b; };
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+
+	std::mt19937 rng{ 1234 };
+	std::vector<uint32_t> keys;
+	for (int i = 0; i < 60000; i++) {
+		//clusters and gaps, so whole leaves and inner nodes are missing
+		const uint32_t et = (rng() % 2) ? rng() % 0x100000 : (rng() % 16) * 0x10000 + rng() % 3000;
+		if (!has_pool_element(&poolA, et)) {
+			add_pool_element(&poolA, et, CA{ int(et) });
+			keys.push_back(et);
+		}
+		if (et % 3 == 0) {
+			add_pool_element(&poolB, et, CB{ int(et) });
+		}
+	}
+	add_pool_element(&poolA, 0xFFFFF, CA{ 0xFFFFF });
+	keys.push_back(0xFFFFF);
+	std::sort(keys.begin(), keys.end());
+
+	//walking the whole tree with a cursor
+	std::vector<uint32_t> walked;
+	for (TreeCursor<uint32_t> cursor = tree_lower_bound(&poolA.tree, 0); !cursor.bend; tree_cursor_next(&cursor)) {
+		walked.push_back(cursor.index);
+	}
+	REQUIRE(walked == keys);
+
+	bool bmatch = true;
+	for (int i = 0; i < 300; i++) {
+		uint32_t first = rng() % 0x100000;
+		uint32_t last = first + ((i % 3 == 0) ? rng() % 300 : rng() % 70000);
+		if (i == 0) {
+			first = 0;
+			last = 0x100000;
+		}
+
+		const auto lo = std::lower_bound(keys.begin(), keys.end(), first);
+		const auto hi = std::lower_bound(keys.begin(), keys.end(), last);
+		std::vector<uint32_t> expected(lo, hi);
+
+		TreeCursor<uint32_t> cursor = tree_lower_bound(&poolA.tree, first);
+		bmatch &= (lo == keys.end()) ? cursor.bend : (!cursor.bend && cursor.index == *lo);
+
+		std::vector<uint32_t> ranged;
+		iterate_range(&poolA.tree, first, last, [&](uint32_t index, uint32_t value) {
+			bmatch &= poolA.Dense[value].a == int(index);
+			ranged.push_back(index);
+			});
+		bmatch &= ranged == expected;
+
+		std::vector<uint32_t> looped;
+		for (const TreeCursor<uint32_t>& c : tree_range(&poolA.tree, first, last)) {
+			bmatch &= poolA.Dense[tree_cursor_value(c)].a == int(c.index);
+			looped.push_back(c.index);
+		}
+		bmatch &= looped == expected;
+
+		std::vector<uint32_t> joined;
+		join_pools_range(first, last, &poolA, &poolB, [&](uint32_t entity, CA& a, CB& b) {
+			bmatch &= a.a == int(entity) && b.b == int(entity);
+			joined.push_back(entity);
+			});
+		std::vector<uint32_t> joined_expected;
+		for (uint32_t et : expected) {
+			if (has_pool_element(&poolB, et)) {
+				joined_expected.push_back(et);
+			}
+		}
+		bmatch &= joined == joined_expected;
+	}
+	REQUIRE(bmatch);
+
+	//valueless trees
+	auto tags = create_bytetree<void>();
+	for (uint32_t i = 1000; i < 5000; i += 7) {
+		add_tree_key(&tags, i);
+	}
+	int count = 0;
+	iterate_range(&tags, 1001, 1100, [&](uint32_t index) {
+		bmatch &= index % 7 == 1000 % 7;
+		count++;
+		});
+	REQUIRE(bmatch);
+	REQUIRE(count == 14);
+	REQUIRE(tree_lower_bound(&tags, 4999).bend);
+
+	destroy_bytetree(&tags);
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+}
+
+TEST_CASE("Join planner") {
+
+	struct CA { int a; };
+	struct CB { int b; };
+	struct Tag {};
+
+	reset_node_arena();
+	auto big = create_pool<CA>();
+	auto scattered = create_pool<CB>();
+	auto clustered = create_pool<CB>();
+	auto similar = create_pool<CB>();
+	auto mixed = create_pool<CB>();
+	auto tags = create_pool<Tag>();
+
+	for (uint32_t i = 0; i < 200000; i++) {
+		if (i % 5) add_pool_element(&big, i, CA{ int(i) });
+		if (i % 2000 == 1) add_pool_element(&scattered, i, CB{ int(i) });
+		if (i >= 50000 && i < 52000) add_pool_element(&clustered, i, CB{ int(i) });
+		if (i % 3) add_pool_element(&similar, i, CB{ int(i) });
+		if ((i < 0x10000 && i % 2000 == 1) || (i >= 0x20000 && i < 0x20000 + 2000)) add_pool_element(&mixed, i, CB{ int(i) });
+		if (i % 997 == 0) add_pool_element(&tags, i, Tag{});
+	}
+
+	auto check = [&](auto* poolB, JoinStrategy expected) {
+		std::vector<uint32_t> reference;
+		join_pools(&big, poolB, [&](uint32_t entity, CA& a, CB& b) {
+			reference.push_back(entity);
+			});
+
+		bool bmatch = true;
+		std::vector<uint32_t> found;
+		const JoinPlan plan = join_pools_planned(&big, poolB, [&](uint32_t entity, CA& a, CB& b) {
+			bmatch &= a.a == int(entity) && b.b == int(entity);
+			found.push_back(entity);
+			});
+		std::sort(found.begin(), found.end());
+		return bmatch && found == reference && plan.strategy == expected;
+	};
+
+	REQUIRE(check(&scattered, JoinStrategy::Probe));
+	//dense drivers gain nothing over the intersection
+	REQUIRE(check(&clustered, JoinStrategy::Intersect));
+	REQUIRE(check(&similar, JoinStrategy::Intersect));
+	//sparse in one subtree and dense in another, each subtree gets its own strategy
+	REQUIRE(check(&mixed, JoinStrategy::Hybrid));
+	const JoinPlan mixedplan = plan_join(&big, &mixed);
+	REQUIRE(mixedplan.driven_subtrees[0] == 0x1);
+
+	const JoinPlan plan = plan_join(&big, &scattered);
+	REQUIRE(plan.driver == 1);
+	REQUIRE(plan.driver_size == 100);
+	REQUIRE(plan.driver_leaves == 100);
+	REQUIRE(plan.others_size == 160000);
+	REQUIRE(std::string(join_strategy_name(plan.strategy)) == "probe");
 
+	//a tag pool has no Reverse to probe from, it drives leaf by leaf
+	int count = 0;
+	const JoinPlan tagplan = join_pools_planned(&tags, &big, [&](uint32_t entity, Tag&, CA& a) {
+		count += a.a == int(entity) && entity % 997 == 0;
+		});
+	REQUIRE(tagplan.strategy == JoinStrategy::Hybrid);
+	REQUIRE(tagplan.driver == 0);
+	int expected = 0;
+	join_pools(&tags, &big, [&](uint32_t entity, Tag&, CA& a) {
+		expected++;
+		});
+	REQUIRE(count == expected);
+
+	//every strategy marks the pools the callback writes
+	enable_change_tracking(&big);
+	REQUIRE(join_pools_planned(&big, &scattered, [&](uint32_t, CA&, const CB&) {}).strategy == JoinStrategy::Probe);
+	REQUIRE(tree_size(&big.changed) == 100);
+	clear_changed(&big);
+	REQUIRE(join_pools_planned(&tags, &big, [&](uint32_t, const Tag&, CA&) {}).strategy == JoinStrategy::Hybrid);
+	REQUIRE(tree_size(&big.changed) == size_t(expected));
+	clear_changed(&big);
+	size_t nmixed = 0;
+	join_pools(&big, &mixed, [&](uint32_t, const CA&, const CB&) { nmixed++; });
+	REQUIRE(tree_size(&big.changed) == 0);
+	join_pools_planned(&big, &mixed, [&](uint32_t, CA&, const CB&) {});
+	REQUIRE(tree_size(&big.changed) == nmixed);
+	clear_changed(&big);
+	join_pools_planned(&big, &mixed, [&](uint32_t, const CA&, CB&) {});
+	REQUIRE(tree_size(&big.changed) == 0);
+
+	destroy_pool(&big);
+	destroy_pool(&scattered);
+	destroy_pool(&clustered);
+	destroy_pool(&similar);
+	destroy_pool(&mixed);
+	destroy_pool(&tags);
 }
 
+TEST_CASE("Query groups") {
+
+	struct CA { int a; };
+	struct CB { int b; };
+	struct Tag {};
+
+	reset_node_arena();
+	EntityRegistry registry = create_registry();
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	auto tags = create_pool<Tag>();
+	register_pool(&registry, &poolA);
+	register_pool(&registry, &poolB);
+	register_pool(&registry, &tags);
+
+	std::vector<uint32_t> entities;
+	for (uint32_t i = 0; i < 50000; i++) {
+		entities.push_back(create_entity(&registry));
+	}
+	for (uint32_t i = 0; i < 50000; i += 2) {
+		add_pool_element(&poolA, entities[i], CA{ int(entities[i]) });
+	}
+
+	//filled from the join at creation, then kept up to date by the pools
+	auto* query = create_query(&poolA, &poolB, &tags);
+	auto* pair = create_query(&poolA, &poolB);
+	REQUIRE(query_size(query) == 0);
+
+	auto check = [&](auto* q, auto... pools) {
+		std::vector<uint32_t> reference;
+		join_pools(pools..., [&](uint32_t entity, auto&&...) {
+			reference.push_back(entity);
+			});
+
+		bool bmatch = true;
+		std::vector<uint32_t> found;
+		iterate_query(q, [&](uint32_t entity, CA& a, CB& b, auto&&...) {
+			bmatch &= a.a == int(entity) && b.b == int(entity);
+			found.push_back(entity);
+			});
+		return bmatch && found == reference && query_size(q) == reference.size();
+	};
+
+	std::vector<uint32_t> batch;
+	std::vector<CB> values;
+	for (uint32_t i = 0; i < 50000; i += 3) {
+		batch.push_back(entities[i]);
+		values.push_back(CB{ int(entities[i]) });
+	}
+	add_pool_elements(&poolB, batch.data(), values.data(), batch.size());
+	for (uint32_t i = 0; i < 50000; i += 5) {
+		add_pool_element(&tags, entities[i]);
+	}
+	REQUIRE(check(query, &poolA, &poolB, &tags));
+	REQUIRE(check(pair, &poolA, &poolB));
+	REQUIRE(query_size(pair) == 50000 / 6 + 1);
+
+	std::mt19937 rng(7);
+	for (int i = 0; i < 20000; i++) {
+		const uint32_t entity = entities[rng() % entities.size()];
+		switch (rng() % 6) {
+		case 0: add_pool_element(&poolA, entity, CA{ int(entity) }); break;
+		case 1: remove_pool_element(&poolA, entity); break;
+		case 2: add_pool_element(&poolB, entity, CB{ int(entity) }); break;
+		case 3: remove_pool_element(&poolB, entity); break;
+		case 4: add_pool_element(&tags, entity); break;
+		case 5: remove_pool_element(&tags, entity); break;
+		}
+	}
+	REQUIRE(check(query, &poolA, &poolB, &tags));
+	REQUIRE(check(pair, &poolA, &poolB));
+
+	batch.clear();
+	for (uint32_t i = 0; i < 50000; i += 7) {
+		batch.push_back(entities[i]);
+	}
+	remove_pool_elements(&poolB, batch.data(), batch.size());
+	for (uint32_t i = 0; i < 50000; i += 11) {
+		destroy_entity(&registry, entities[i]);
+	}
+	REQUIRE(check(query, &poolA, &poolB, &tags));
+	REQUIRE(check(pair, &poolA, &poolB));
+
+	//a reused index with a new generation is not a member until it is in every pool again
+	const uint32_t reused = create_entity(&registry);
+	add_pool_element(&poolA, reused, CA{ int(reused) });
+	add_pool_element(&poolB, reused, CB{ int(reused) });
+	REQUIRE(check(pair, &poolA, &poolB));
+
+	//members are marked in the tracked pools the callback writes
+	enable_change_tracking(&poolB);
+	iterate_query(pair, [&](uint32_t, const CA&, const CB&) {});
+	REQUIRE(tree_size(&poolB.changed) == 0);
+	iterate_query(pair, [&](uint32_t, const CA&, CB&) {});
+	REQUIRE(tree_size(&poolB.changed) == query_size(pair));
+
+	destroy_query(query);
+	REQUIRE(poolA.listeners.size() == 1);
+	REQUIRE(tags.listeners.empty());
+	destroy_query(pair);
+	REQUIRE(poolA.listeners.empty());
+	REQUIRE(poolB.listeners.empty());
+
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+	destroy_pool(&tags);
+	destroy_registry(&registry);
+}
+
+TEST_CASE("Population counts") {
+
+	struct CA { int a; };
+	struct CB { int b; };
+	struct Tag {};
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	auto tags = create_pool<Tag>();
+	enable_change_tracking(&poolA);
+
+	std::mt19937 rng{ 1234 };
+	for (int i = 0; i < 40000; i++) {
+		const uint32_t et = (rng() % 2) ? rng() % 0x100000 : (rng() % 16) * 0x10000 + rng() % 3000;
+		add_pool_element(&poolA, et, CA{ int(et) });
+		if (et % 3 == 0) add_pool_element(&poolB, et, CB{ int(et) });
+		if (et % 5 == 0) add_pool_element(&tags, et);
+	}
+
+	std::vector<uint32_t> batch;
+	std::vector<CA> values;
+	for (int i = 0; i < 20000; i++) {
+		batch.push_back(rng() % 0x100000);
+		values.push_back(CA{ int(batch.back()) });
+	}
+	add_pool_elements(&poolA, batch.data(), values.data(), batch.size());
+	for (int i = 0; i < 20000; i++) {
+		remove_pool_element(&poolA, rng() % 0x100000);
+		remove_pool_element(&tags, rng() % 0x100000);
+	}
+	batch.resize(10000);
+	remove_pool_elements(&poolA, batch.data(), batch.size());
+
+	REQUIRE(tree_size(&poolA.tree) == poolA.Reverse.size());
+	REQUIRE(tree_size(&poolB.tree) == poolB.Reverse.size());
+	REQUIRE(tree_size(&tags.tree) == tags.count);
+
+	//the changed tree keeps the marks of removed elements too
+	size_t changed = 0;
+	iterate_range(&poolA.changed, 0, 0x100000, [&](uint32_t) { changed++; });
+	REQUIRE(tree_size(&poolA.changed) == changed);
+
+	std::vector<uint32_t> keys = poolA.Reverse;
+	for (uint32_t& key : keys) {
+		key &= 0xFFFFF;
+	}
+	std::sort(keys.begin(), keys.end());
+
+	bool bmatch = true;
+	for (int i = 0; i < 1000; i++) {
+		uint32_t first = rng() % 0x100000;
+		uint32_t last = (i % 2) ? first + rng() % 2000 : rng() % 0x100000;
+		if (last < first) std::swap(first, last);
+
+		const size_t expected = std::lower_bound(keys.begin(), keys.end(), last) - std::lower_bound(keys.begin(), keys.end(), first);
+		bmatch &= count_range(&poolA.tree, first, last) == expected;
+	}
+	REQUIRE(bmatch);
+	REQUIRE(count_range(&poolA.tree, 0, 0x100000) == keys.size());
+	REQUIRE(count_range(&poolA.tree, 10, 10) == 0);
+
+	for (size_t k = 0; k < keys.size(); k += 97) {
+		uint32_t index;
+		bmatch &= tree_select(&poolA.tree, k, index) && index == keys[k];
+	}
+	REQUIRE(bmatch);
+	uint32_t index;
+	REQUIRE(tree_select(&poolA.tree, keys.size() - 1, index));
+	REQUIRE(index == keys.back());
+	REQUIRE(!tree_select(&poolA.tree, keys.size(), index));
+
+	auto join_count = [](auto... pools) {
+		size_t count = 0;
+		join_pools(pools..., [&](uint32_t, auto&&...) { count++; });
+		return count;
+	};
+	REQUIRE(count_joined(&poolA, &poolB) == join_count(&poolA, &poolB));
+	REQUIRE(count_joined(&poolA, &poolB, &tags) == join_count(&poolA, &poolB, &tags));
+	REQUIRE(count_joined(&tags) == tags.count);
+
+	//full subtrees are counted from the populations
+	auto denseA = create_pool<CA>();
+	auto denseB = create_pool<CB>();
+	for (uint32_t i = 0; i < 0x30000; i++) {
+		add_pool_element(&denseA, i, CA{ int(i) });
+		if (i < 0x20000 || i % 2) add_pool_element(&denseB, i, CB{ int(i) });
+	}
+	REQUIRE(count_joined(&denseA, &denseB) == 0x20000 + 0x8000);
+	REQUIRE(count_joined(&denseA, &denseB, &poolB) == join_count(&denseA, &denseB, &poolB));
+
+	World world = create_world();
+	for (int i = 0; i < 1000; i++) {
+		const uint32_t entity = world.create();
+		world.add<CA>(entity, i);
+		if (i % 4 == 0) world.add<CB>(entity, i);
+	}
+	REQUIRE(world.count<CA>() == 1000);
+	REQUIRE(world.count<CA, CB>() == 250);
+	destroy_world(&world);
+
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+	destroy_pool(&tags);
+	destroy_pool(&denseA);
+	destroy_pool(&denseB);
+}
+
+TEST_CASE("Pool snapshots") {
+
+	struct CA { int a; float b; };
+	struct CB { int b; };
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+
+	std::mt19937 rng{ 1234 };
+	for (int i = 0; i < 50000; i++) {
+		const uint32_t et = (rng() % 2) ? rng() % 0x100000 : (rng() % 16) * 0x10000 + rng() % 3000;
+		add_pool_element(&poolA, et, CA{ int(et), 0.5f });
+		if (et % 3 == 0) add_pool_element(&poolB, et, CB{ int(et) });
+	}
+	for (int i = 0; i < 10000; i++) {
+		remove_pool_element(&poolA, rng() % 0x100000);
+	}
+
+	const std::string path = (std::filesystem::temp_directory_path() / "bytecs_test_snapshot.bin").string();
+	REQUIRE(save_pool_snapshot(&poolA, path.c_str()));
+
+	MappedPool<CA> mapped;
+	REQUIRE(load_pool_snapshot(path.c_str(), &mapped));
+	REQUIRE(pool_size(&mapped) == poolA.Dense.size());
+	REQUIRE(tree_size(&mapped.tree) == tree_size(&poolA.tree));
+
+	bool bmatch = true;
+	for (uint32_t et : poolA.Reverse) {
+		CA value;
+		bmatch &= get_pool_element(&mapped, et, value) && value.a == int(et);
+	}
+	REQUIRE(bmatch);
+	REQUIRE(has_pool_element(&mapped, 0xFFFFF) == has_pool_element(&poolA, 0xFFFFF));
+
+	//the mapped pool joins like any other
+	std::vector<uint32_t> reference;
+	join_pools(&poolA, &poolB, [&](uint32_t entity, CA&, CB&) { reference.push_back(entity); });
+	std::vector<uint32_t> found;
+	join_pools(&mapped, &poolB, [&](uint32_t entity, CA& a, CB& b) {
+		bmatch &= a.a == b.b;
+		found.push_back(entity);
+		});
+	REQUIRE(bmatch);
+	REQUIRE(found == reference);
+
+	//writes stay in the process
+	const uint32_t first = poolA.Reverse[0];
+	find_pool_element(&mapped, first)->a = -1;
+	MappedPool<CA> reloaded;
+	REQUIRE(load_pool_snapshot(path.c_str(), &reloaded));
+	REQUIRE(find_pool_element(&reloaded, first)->a == int(first));
+	destroy_pool(&reloaded);
+
+	//a copy can change its elements
+	auto copy = copy_mapped_pool(&mapped);
+	destroy_pool(&mapped);
+	REQUIRE(find_pool_element(&copy, first)->a == -1);
+	remove_pool_element(&copy, first);
+	add_pool_element(&copy, 0xFFFF0, CA{ 7, 0.f });
+	REQUIRE(!has_pool_element(&copy, first));
+	REQUIRE(has_pool_element(&copy, 0xFFFF0));
+	REQUIRE(tree_size(&copy.tree) == copy.Dense.size());
+
+	//other element types and missing files are rejected
+	MappedPool<CB> wrong;
+	REQUIRE(!load_pool_snapshot(path.c_str(), &wrong));
+	REQUIRE(!load_pool_snapshot((path + ".missing").c_str(), &wrong));
+
+	//so are corrupt files
+	std::vector<uint8_t> file(std::filesystem::file_size(path));
+	FILE* in = fopen(path.c_str(), "rb");
+	REQUIRE(fread(file.data(), 1, file.size(), in) == file.size());
+	fclose(in);
+	SnapshotHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	const std::string bad_path = path + ".bad";
+	auto load_patched = [&](auto&& patch, bool bcheck_leaves) {
+		std::vector<uint8_t> bad = file;
+		patch(bad);
+		FILE* out = fopen(bad_path.c_str(), "wb");
+		fwrite(bad.data(), 1, bad.size(), out);
+		fclose(out);
+		MappedPool<CA> corrupt;
+		const bool bloaded = load_pool_snapshot(bad_path.c_str(), &corrupt, bcheck_leaves);
+		if (bloaded) destroy_pool(&corrupt);
+		return bloaded;
+	};
+	const size_t root = header.nodes_offset + header.root_offset;
+	REQUIRE(load_patched([](std::vector<uint8_t>&) {}, false));
+	REQUIRE(load_patched([](std::vector<uint8_t>&) {}, true));
+	//unknown node kind
+	REQUIRE(!load_patched([&](std::vector<uint8_t>& bad) { bad[root + offsetof(ByteNode, kind)] = 200; }, false));
+	//inner slots narrower than a pointer
+	REQUIRE(!load_patched([&](std::vector<uint8_t>& bad) { bad[root + offsetof(ByteNode, slot_bytes)] = 4; }, false));
+	//a child that points back at the root
+	REQUIRE(!load_patched([&](std::vector<uint8_t>& bad) { memset(&bad[root + node_header_bytes], 0, sizeof(uint64_t)); }, false));
+	//trees that are not three levels deep, the joins would read leaves as inner nodes
+	REQUIRE(!load_patched([&](std::vector<uint8_t>& bad) { ((SnapshotHeader*)bad.data())->depth = 1; }, false));
+	REQUIRE(!load_patched([&](std::vector<uint8_t>& bad) { ((SnapshotHeader*)bad.data())->capacity = 0; }, false));
+	//count * sizeof(CA) wraps around
+	REQUIRE(!load_patched([&](std::vector<uint8_t>& bad) { ((SnapshotHeader*)bad.data())->count = (uint64_t(1) << 61) + 1; }, false));
+	//the leaves are only read when asked to: leaf values past the elements and a last leaf cut off
+	REQUIRE(!load_patched([&](std::vector<uint8_t>& bad) { ((SnapshotHeader*)bad.data())->count = 1; }, true));
+	REQUIRE(!load_patched([&](std::vector<uint8_t>& bad) { bad.resize(header.nodes_offset + header.nodes_bytes - 1); }, true));
+	std::filesystem::remove(bad_path);
+
+	std::filesystem::remove(path);
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+	destroy_pool(&copy);
+}
+
+TEST_CASE("Pool deltas") {
+
+	struct CA { int a; float b; };
+
+	reset_node_arena();
+	EntityRegistry registry = create_registry();
+	auto pool = create_pool<CA>();
+	register_pool(&registry, &pool);
+
+	std::vector<uint32_t> entities;
+	for (int i = 0; i < 30000; i++) {
+		entities.push_back(create_entity(&registry));
+		if (i % 4 != 3) add_pool_element(&pool, entities.back(), CA{ i, 0.f });
+	}
+	ComponentPool<CA> before = copy_pool(&pool);
+
+	std::vector<uint8_t> delta;
+	diff_pools(&before, &pool, delta);
+	REQUIRE(read_delta_header(delta.data()).removed == 0);
+	REQUIRE(read_delta_header(delta.data()).added == 0);
+	REQUIRE(read_delta_header(delta.data()).changed == 0);
+
+	//changes, removals, additions and reused indices with a new generation
+	std::mt19937 rng{ 1234 };
+	for (int i = 0; i < 3000; i++) {
+		const uint32_t entity = entities[rng() % entities.size()];
+		switch (rng() % 4) {
+		case 0:
+			if (CA* value = find_pool_element(&pool, entity)) { value->b += 1.f; }
+			break;
+		case 1: remove_pool_element(&pool, entity); break;
+		case 2: add_pool_element(&pool, entity, CA{ -1, 2.f }); break;
+		case 3:
+			if (is_entity_valid(&registry, entity)) {
+				destroy_entity(&registry, entity);
+				add_pool_element(&pool, create_entity(&registry), CA{ -2, 3.f });
+			}
+			break;
+		}
+	}
+	ComponentPool<CA> after = copy_pool(&pool);
+
+	auto same_elements = [](ComponentPool<CA>* a, ComponentPool<CA>* b) {
+		bool bsame = a->Dense.size() == b->Dense.size();
+		for (size_t i = 0; i < a->Reverse.size() && bsame; i++) {
+			const CA* value = find_pool_element(b, a->Reverse[i]);
+			bsame = value && value->a == a->Dense[i].a && value->b == a->Dense[i].b;
+		}
+		return bsame;
+	};
+
+	diff_pools(&before, &after, delta);
+	const DeltaHeader header = read_delta_header(delta.data());
+	REQUIRE(header.removed > 0);
+	REQUIRE(header.added > 0);
+	REQUIRE(header.changed > 0);
+
+	//replaying the delta on the old state gives the new one, the reverse delta rolls it back
+	ComponentPool<CA> replica = copy_pool(&before);
+	REQUIRE(apply_delta(&replica, delta.data(), delta.size()));
+	REQUIRE(same_elements(&replica, &after));
+	REQUIRE(tree_size(&replica.tree) == replica.Dense.size());
+
+	std::vector<uint8_t> rollback;
+	diff_pools(&after, &before, rollback);
+	REQUIRE(apply_delta(&replica, rollback.data(), rollback.size()));
+	REQUIRE(same_elements(&replica, &before));
+
+	diff_pools(&replica, &before, delta);
+	REQUIRE(delta.size() == sizeof(DeltaHeader));
+
+	REQUIRE(!apply_delta(&replica, rollback.data(), sizeof(DeltaHeader) - 1));
+	REQUIRE(!apply_delta(&replica, rollback.data(), rollback.size() - 1));
+
+	//between a CowPool and its snapshot only the leaves written since are visited
+	auto cow = create_cow_pool<CA>();
+	auto mirror = create_pool<CA>();
+	for (uint32_t i = 0; i < 30000; i++) {
+		add_pool_element(&cow, i * 31, CA{ int(i), 0.f });
+		add_pool_element(&mirror, i * 31, CA{ int(i), 0.f });
+	}
+	auto cow_before = snapshot_pool(&cow);
+	auto visited_leaves = [&]() {
+		int nvisited = 0;
+		diff_trees(&cow_before.tree, &cow.tree, [&](uint32_t, ByteNode*, ByteNode*) { nvisited++; });
+		return nvisited;
+	};
+	REQUIRE(visited_leaves() == 0);
+	find_pool_element(&cow, 31 * 100)->b = 1.f;
+	REQUIRE(visited_leaves() == 0);
+	add_pool_element(&cow, 0xFFFF0, CA{ -1, 0.f });
+	REQUIRE(visited_leaves() == 1);
+	//the last element moves into the hole, which writes its leaf too
+	remove_pool_element(&cow, 31 * 5);
+	REQUIRE(visited_leaves() == 2);
+
+	diff_pools(&cow_before, &cow, delta);
+	const DeltaHeader cow_header = read_delta_header(delta.data());
+	REQUIRE(cow_header.removed == 1);
+	REQUIRE(cow_header.added == 1);
+	REQUIRE(cow_header.changed == 1);
+
+	REQUIRE(apply_delta(&mirror, delta.data(), delta.size()));
+	bool bmirrored = pool_size(&mirror) == pool_size(&cow);
+	for (size_t i = 0; i < mirror.Reverse.size() && bmirrored; i++) {
+		CA value;
+		bmirrored = get_pool_element(&cow, mirror.Reverse[i], value) && value.a == mirror.Dense[i].a && value.b == mirror.Dense[i].b;
+	}
+	REQUIRE(bmirrored);
+
+	destroy_pool(&cow_before);
+	destroy_pool(&cow);
+	destroy_pool(&mirror);
+	destroy_pool(&pool);
+	destroy_pool(&before);
+	destroy_pool(&after);
+	destroy_pool(&replica);
+	destroy_registry(&registry);
+}
+
+TEST_CASE("Copy-on-write pools") {
+
+	struct CA { int a; float b; };
+
+	reset_node_arena();
+	auto pool = create_cow_pool<CA>();
+	auto reference = create_pool<CA>();
+
+	auto same_elements = [](CowPool<CA>* a, ComponentPool<CA>* b) {
+		bool bsame = pool_size(a) == b->Dense.size() && tree_size(&a->tree) == b->Dense.size();
+		for (size_t i = 0; i < b->Reverse.size() && bsame; i++) {
+			CA value;
+			bsame = get_pool_element(a, b->Reverse[i], value) && value.a == b->Dense[i].a && value.b == b->Dense[i].b;
+		}
+		return bsame;
+	};
+
+	for (int i = 0; i < 20000; i++) {
+		add_pool_element(&pool, i * 3, CA{ i, 0.f });
+		add_pool_element(&reference, i * 3, CA{ i, 0.f });
+	}
+	REQUIRE(same_elements(&pool, &reference));
+
+	//one write after a snapshot copies the path to its leaf and one page
+	CowPool<CA> first = snapshot_pool(&pool);
+	size_t copied = shared_copied_bytes;
+	find_pool_element(&pool, 300)->b = 1.f;
+	find_pool_element(&reference, 300)->b = 1.f;
+	REQUIRE(shared_copied_bytes - copied <= 3 * node_bytes(node_kind_full) + sizeof(CowPage<CA>) + pool.table->pages.size() * sizeof(void*));
+	copied = shared_copied_bytes;
+	find_pool_element(&pool, 303)->b = 1.f;
+	find_pool_element(&reference, 303)->b = 1.f;
+	REQUIRE(shared_copied_bytes == copied);
+
+	CA value;
+	REQUIRE(get_pool_element(&first, 300, value));
+	REQUIRE(value.b == 0.f);
+
+	//snapshots taken along random changes keep the state they were taken in
+	std::vector<CowPool<CA>> snapshots;
+	std::vector<ComponentPool<CA>> expected;
+	std::mt19937 rng{ 1234 };
+	for (int i = 0; i < 20000; i++) {
+		if (i % 2000 == 0) {
+			snapshots.push_back(snapshot_pool(&pool));
+			expected.push_back(copy_pool(&reference));
+		}
+		const uint32_t entity = rng() % 70000;
+		switch (rng() % 3) {
+		case 0:
+			if (CA* written = find_pool_element(&pool, entity)) { written->b += 1.f; find_pool_element(&reference, entity)->b += 1.f; }
+			break;
+		case 1: remove_pool_element(&pool, entity); remove_pool_element(&reference, entity); break;
+		case 2: add_pool_element(&pool, entity, CA{ -1, 2.f }); add_pool_element(&reference, entity, CA{ -1, 2.f }); break;
+		}
+	}
+	REQUIRE(same_elements(&pool, &reference));
+	for (size_t i = 0; i < snapshots.size(); i++) {
+		REQUIRE(same_elements(&snapshots[i], &expected[i]));
+	}
+
+	//snapshots join like any other pool
+	size_t joined = 0;
+	join_pools(&snapshots[3], &pool, [&](uint32_t entity, const CA& old_value, const CA& new_value) {
+		joined++;
+	});
+	REQUIRE(joined == count_joined(&snapshots[3], &pool));
+
+	//writing a snapshot leaves the pool alone
+	add_pool_element(&snapshots[0], 1, CA{ 5, 5.f });
+	add_pool_element(&expected[0], 1, CA{ 5, 5.f });
+	REQUIRE(same_elements(&snapshots[0], &expected[0]));
+	REQUIRE(same_elements(&pool, &reference));
+
+	//another thread reads a snapshot while the owner keeps writing the pool
+	bool bfrozen = true;
+	std::thread reader([&]() {
+		for (int i = 0; i < 20; i++) {
+			bfrozen &= same_elements(&snapshots[1], &expected[1]);
+		}
+	});
+	for (int i = 0; i < 20000; i++) {
+		const uint32_t entity = rng() % 70000;
+		switch (rng() % 3) {
+		case 0: if (CA* written = find_pool_element(&pool, entity)) { written->a++; } break;
+		case 1: remove_pool_element(&pool, entity); break;
+		case 2: add_pool_element(&pool, entity, CA{ -3, 3.f }); break;
+		}
+	}
+	reader.join();
+	REQUIRE(bfrozen);
+
+	//every node is freed once the pool and all its snapshots are gone, whatever the order
+	destroy_pool(&reference);
+	for (auto& copy : expected) {
+		destroy_pool(&copy);
+	}
+	const size_t live_nodes = node_arena_live_nodes();
+	destroy_pool(&pool);
+	REQUIRE(get_pool_element(&first, 300, value));
+	REQUIRE(value.b == 0.f);
+	for (size_t i = 0; i < snapshots.size(); i += 2) {
+		destroy_pool(&snapshots[i]);
+	}
+	REQUIRE(node_arena_live_nodes() < live_nodes);
+	for (size_t i = 1; i < snapshots.size(); i += 2) {
+		REQUIRE(get_pool_element(&snapshots[i], snapshots[i].table->pages[0]->Reverse[0], value));
+		destroy_pool(&snapshots[i]);
+	}
+	destroy_pool(&first);
+	REQUIRE(node_arena_live_nodes() == 0);
+}
+
+TEST_CASE("Command buffers") {
+
+	struct CA { int a; };
+	struct CB { int b; };
+	struct Tag {};
+
+	constexpr uint32_t num_entities = 40000;
+
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	auto tags = create_pool<Tag>();
+	for (uint32_t i = 0; i < num_entities; i++) {
+		add_pool_element(&poolA, i, CA{ int(i) });
+	}
+
+	//nothing changes until the flush, and the last command of an entity wins
+	CommandQueue queue = create_command_queue();
+	CommandBuffer* commands = thread_command_buffer(&queue);
+	defer_remove_pool_element(commands, &poolA, 5);
+	defer_add_pool_element(commands, &poolA, 5, CA{ -5 });
+	defer_remove_pool_element(commands, &poolA, 6);
+	defer_add_pool_element(commands, &poolA, 7, CA{ -7 });
+	defer_add_pool_element(commands, &poolA, 7, CA{ -77 });
+	defer_add_pool_element(commands, &poolB, 8, CB{ 8 });
+	defer_remove_pool_element(commands, &poolB, 8);
+	defer_add_pool_element(commands, &tags, 9);
+	//many commands on one index, mixed with a stale handle of it
+	for (int i = 0; i < 1000; i++) {
+		defer_add_pool_element(commands, &poolA, 10, CA{ i });
+		defer_remove_pool_element(commands, &poolA, (1 << 20) | 10);
+	}
+	REQUIRE(pool_size(&poolA) == num_entities);
+	REQUIRE(!has_pool_element(&tags, 9));
+
+	flush_commands(&queue);
+	REQUIRE(pool_size(&poolA) == num_entities - 1);
+	REQUIRE(find_pool_element(&poolA, 5)->a == -5);
+	REQUIRE(!has_pool_element(&poolA, 6));
+	REQUIRE(find_pool_element(&poolA, 7)->a == -77);
+	REQUIRE(find_pool_element(&poolA, 10)->a == 999);
+	REQUIRE(pool_size(&poolB) == 0);
+	REQUIRE(has_pool_element(&tags, 9));
+	add_pool_element(&poolA, 6, CA{ 6 });
+	add_pool_element(&poolA, 5, CA{ 5 });
+	add_pool_element(&poolA, 7, CA{ 7 });
+	destroy_command_queue(&queue);
+
+	//structural changes from inside a parallel join, to the joined pool and to others
+	TaskPool* taskpool = create_task_pool(4);
+	queue = create_command_queue(task_pool_thread_count(taskpool));
+
+	parallel_join_pools(taskpool, JoinGrain::Leaf, &poolA, [&](uint32_t entity, CA& a) {
+		CommandBuffer* thread_commands = thread_command_buffer(&queue);
+		if (entity % 10 == 0) defer_remove_pool_element(thread_commands, &poolA, entity);
+		if (entity % 10 == 1) defer_add_pool_element(thread_commands, &poolA, entity, CA{ -a.a });
+		if (entity % 3 == 0) defer_add_pool_element(thread_commands, &poolB, entity, CB{ a.a });
+		if (entity % 5 == 0) defer_add_pool_element(thread_commands, &tags, entity);
+	});
+	flush_commands(&queue);
+
+	bool bmatch = pool_size(&poolA) == num_entities - num_entities / 10;
+	for (uint32_t i = 0; i < num_entities && bmatch; i++) {
+		const CA* a = find_pool_element(&poolA, i);
+		const CB* b = find_pool_element(&poolB, i);
+		bmatch &= (i % 10 == 0) ? !a : a && a->a == ((i % 10 == 1) ? -int(i) : int(i));
+		bmatch &= (i % 3 == 0) ? b && b->b == int(i) : !b;
+		bmatch &= has_pool_element(&tags, i) == (i % 5 == 0 || i == 9);
+	}
+	REQUIRE(bmatch);
+	REQUIRE(tree_size(&poolA.tree) == pool_size(&poolA));
+
+	//a flush empties the buffers
+	flush_commands(&queue);
+	REQUIRE(pool_size(&poolA) == num_entities - num_entities / 10);
+
+	destroy_command_queue(&queue);
+	destroy_task_pool(taskpool);
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+	destroy_pool(&tags);
+}
 
 int main(int argc, char* argv[])
 {
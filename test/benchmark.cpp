@@ -1,5 +1,13 @@
 #include "BitTree.h"
+#include "World.h"
+#include "SoaPool.h"
+#include "JoinQuery.h"
+#include "PoolSnapshot.h"
+#include "PoolDelta.h"
+#include "CowPool.h"
 #include <iostream>
+#include <chrono>
+#include <filesystem>
 #include <entt.hpp>
 
 #define CATCH_CONFIG_RUNNER
@@ -21,7 +29,7 @@ TEST_CASE("create benchmark", "[bit-tree,!benchmark]") {
 	};
 
 	BENCHMARK("create 10 BTree: contiguous") {
-		node_pool_index = 0;
+		reset_node_arena();
 		auto poolA = create_pool<CA>();
 
 		for (int i = 0; i < 10; i++) {
@@ -30,7 +38,7 @@ TEST_CASE("create benchmark", "[bit-tree,!benchmark]") {
 		return poolA.Dense.size();
 	};
 	BENCHMARK("create 100 BTree: contiguous") {
-		node_pool_index = 0;
+		reset_node_arena();
 		auto poolA = create_pool<CA>();
 
 		for (int i = 0; i < 100; i++) {
@@ -40,7 +48,7 @@ TEST_CASE("create benchmark", "[bit-tree,!benchmark]") {
 	};
 	BENCHMARK("create 10000 BTree: contiguous") {
 
-		node_pool_index = 0;
+		reset_node_arena();
 		auto poolA = create_pool<CA>();
 		for (int i = 0; i < 10000; i++) {
 			add_pool_element(&poolA,i, CA{ i / 100000.f,0.f,0.f });
@@ -52,18 +60,16 @@ TEST_CASE("create benchmark", "[bit-tree,!benchmark]") {
 
 	BENCHMARK("create 1.000.000 BTree, 3 pools: contiguous") {
 
-		node_pool_index = 0;
+		reset_node_arena();
 		auto poolA = create_pool<CA>();
 		auto poolB = create_pool<CB>();
 		auto poolC = create_pool<CC>();
 
 		poolA.Dense.reserve(1000000);
 		poolB.Dense.reserve(1000000);
-		poolC.Dense.reserve(1000000);
 
 		poolA.Reverse.reserve(1000000);
 		poolB.Reverse.reserve(1000000);
-		poolC.Reverse.reserve(1000000);
 
 		for (int i = 0; i < 1000000; i++) {
 			add_pool_element(&poolA, i, CA{ i / 100000.f,0.f,0.f });
@@ -72,8 +78,1262 @@ TEST_CASE("create benchmark", "[bit-tree,!benchmark]") {
 		}
 		return poolA.Dense.size();
 	};
+
+	std::vector<uint32_t> entities(1000000);
+	std::vector<CA> valuesA(1000000);
+	std::vector<CB> valuesB(1000000);
+	std::vector<CC> valuesC(1000000);
+	for (int i = 0; i < 1000000; i++) {
+		entities[i] = i;
+		valuesA[i] = CA{ i / 100000.f,0.f,0.f };
+		valuesB[i] = CB{ i / 100000.f,0.f };
+	}
+
+	BENCHMARK("create 1.000.000 BTree, 3 pools: contiguous bulk") {
+
+		reset_node_arena();
+		auto poolA = create_pool<CA>();
+		auto poolB = create_pool<CB>();
+		auto poolC = create_pool<CC>();
+
+		add_pool_elements(&poolA, entities.data(), valuesA.data(), entities.size());
+		add_pool_elements(&poolB, entities.data(), valuesB.data(), entities.size());
+		add_pool_elements(&poolC, entities.data(), valuesC.data(), entities.size());
+
+		return poolA.Dense.size();
+	};
+}
+
+TEST_CASE("churn benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+
+	constexpr uint32_t alive_entities = 200000;
+	constexpr uint32_t churn_per_tick = 20000;
+	constexpr int ticks = 50;
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+
+	std::mt19937 rng{ 1234 };
+	std::uniform_int_distribution<uint32_t> id_distribution{ 0, 0xFFFFF };
+
+	std::vector<uint32_t> alive;
+	alive.reserve(alive_entities);
+
+	auto spawn = [&]() {
+		while (true) {
+			uint32_t id = id_distribution(rng);
+			CA value;
+			if (!get_pool_element(&poolA, id, value)) {
+				add_pool_element(&poolA, id, CA{ id / 100000.f,0.f,0.f });
+				alive.push_back(id);
+				return;
+			}
+		}
+	};
+	auto despawn = [&]() {
+		size_t slot = rng() % alive.size();
+		remove_pool_element(&poolA, alive[slot]);
+		alive[slot] = alive.back();
+		alive.pop_back();
+	};
+
+	for (uint32_t i = 0; i < alive_entities; i++) {
+		spawn();
+	}
+
+	std::cout << "churn start: " << node_arena_live_nodes() << " nodes, " << node_arena_chunk_bytes() / 1024 << " kb" << std::endl;
+
+	BENCHMARK("churn 200.000 alive, 1.000.000 spawn/despawn") {
+		for (int t = 0; t < ticks; t++) {
+			for (uint32_t i = 0; i < churn_per_tick; i++) {
+				despawn();
+			}
+			for (uint32_t i = 0; i < churn_per_tick; i++) {
+				spawn();
+			}
+		}
+		return poolA.Dense.size();
+	};
+
+	std::cout << "churn end: " << node_arena_live_nodes() << " nodes, " << node_arena_chunk_bytes() / 1024 << " kb" << std::endl;
+
+	destroy_pool(&poolA);
+}
+
+TEST_CASE("node layout benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+	struct CB
+	{
+		float x, y;
+	};
+
+	std::mt19937 rng{ 1234 };
+	std::uniform_int_distribution<uint32_t> id_distribution{ 0, 0xFFFFF };
+
+	std::vector<uint32_t> dense_ids;
+	for (uint32_t i = 0; i < 50000; i++) {
+		dense_ids.push_back(i);
+	}
+	//clusters of 32 entities every 512 ids
+	std::vector<uint32_t> clustered_ids;
+	for (uint32_t i = 0; i < 50000; i++) {
+		clustered_ids.push_back((i / 32) * 512 + (i % 32));
+	}
+	//random ids, mostly one per leaf
+	std::vector<uint32_t> sparse_ids;
+	for (uint32_t i = 0; i < 4000; i++) {
+		sparse_ids.push_back(id_distribution(rng));
+	}
+
+	auto run_layout = [](const char* name, const std::vector<uint32_t>& ids) {
+
+		reset_node_arena();
+		auto poolA = create_pool<CA>();
+		auto poolB = create_pool<CB>();
+
+		for (uint32_t id : ids) {
+			add_pool_element(&poolA, id, CA{ id / 100000.f,0.f,0.f });
+		}
+		const size_t node_bytes_A = node_arena_live_bytes();
+		const size_t nodes_A = node_arena_live_nodes();
+
+		for (uint32_t id : ids) {
+			add_pool_element(&poolB, id, CB{ id / 100000.f,0.f });
+		}
+
+		std::cout << name << ": " << double(node_bytes_A) / poolA.Dense.size() << " tree bytes per entity, "
+			<< double(nodes_A * node_bytes(node_kind_full)) / poolA.Dense.size() << " with only full nodes" << std::endl;
+
+		BENCHMARK(std::string("join AB: ") + name) {
+			int iterations = 0;
+			float maxval = 0;
+
+			join_pools(&poolA, &poolB, [&iterations, &maxval](auto index, CA& a, CB& b) {
+				maxval += a.x - b.x;
+				iterations++;
+				});
+
+			return maxval * iterations;
+		};
+
+		destroy_pool(&poolA);
+		destroy_pool(&poolB);
+	};
+
+	run_layout("dense", dense_ids);
+	run_layout("clustered", clustered_ids);
+	run_layout("sparse", sparse_ids);
+}
+
+TEST_CASE("bitmask iterate benchmark", "[bit-tree,!benchmark]") {
+
+	constexpr int num_words = 4096;
+
+	auto make_bitmask = [](int percent) {
+		std::mt19937 rng{ 1234 };
+		std::vector<uint64_t> bitmask(num_words, 0);
+		for (int i = 0; i < num_words * 64; i++) {
+			if (int(rng() % 100) < percent) {
+				bitmask[i / 64] |= uint64_t(1) << (i % 64);
+			}
+		}
+		return bitmask;
+	};
+
+	for (int percent : { 1, 10, 50, 100 }) {
+		std::vector<uint64_t> bitmask = make_bitmask(percent);
+
+		BENCHMARK("iterate bitmask: " + std::to_string(percent) + "%") {
+			uint64_t sum = 0;
+			bitmask_optimal_iterate(bitmask.data(), num_words, [&sum](uint32_t index) {
+				sum += index;
+				});
+			return sum;
+		};
+	}
+}
+
+TEST_CASE("remove benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+
+	constexpr int num_entities = 1000000;
+
+	std::vector<uint32_t> entities(num_entities);
+	std::vector<CA> values(num_entities);
+	for (int i = 0; i < num_entities; i++) {
+		entities[i] = i;
+		values[i] = CA{ i / 100000.f,0.f,0.f };
+	}
+
+	std::vector<uint32_t> shuffled = entities;
+	std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937{ 1234 });
+
+	//removal cant be repeated on the same pool, so every run rebuilds it. The rebuild alone is measured first
+	BENCHMARK("remove from 1.000.000: rebuild only") {
+		reset_node_arena();
+		auto poolA = create_pool<CA>();
+		add_pool_elements(&poolA, entities.data(), values.data(), entities.size());
+		return poolA.Dense.size();
+	};
+
+	for (int percent : { 10, 50, 90 }) {
+		const size_t nremove = size_t(num_entities) * percent / 100;
+
+		BENCHMARK("remove " + std::to_string(percent) + "% from 1.000.000: remove_pool_element") {
+			reset_node_arena();
+			auto poolA = create_pool<CA>();
+			add_pool_elements(&poolA, entities.data(), values.data(), entities.size());
+
+			for (size_t i = 0; i < nremove; i++) {
+				remove_pool_element(&poolA, shuffled[i]);
+			}
+			return poolA.Dense.size();
+		};
+		BENCHMARK("remove " + std::to_string(percent) + "% from 1.000.000: remove_pool_elements") {
+			reset_node_arena();
+			auto poolA = create_pool<CA>();
+			add_pool_elements(&poolA, entities.data(), values.data(), entities.size());
+
+			remove_pool_elements(&poolA, shuffled.data(), nremove);
+			return poolA.Dense.size();
+		};
+	}
+}
+
+template<typename V>
+void run_leaf_width_benchmark(const char* name, const std::vector<uint32_t>& ids)
+{
+	struct CA
+	{
+		float x, y, z;
+	};
+	struct CB
+	{
+		float x, y;
+	};
+
+	reset_node_arena();
+	auto poolA = create_pool<CA, V>();
+	auto poolB = create_pool<CB, V>();
+
+	for (uint32_t id : ids) {
+		add_pool_element(&poolA, id, CA{ id / 100000.f,0.f,0.f });
+		add_pool_element(&poolB, id, CB{ id / 100000.f,0.f });
+	}
+
+	std::cout << name << ": " << double(node_arena_live_bytes()) / (poolA.Dense.size() + poolB.Dense.size()) << " tree bytes per entity" << std::endl;
+
+	BENCHMARK(std::string("join AB: ") + name) {
+		int iterations = 0;
+		float maxval = 0;
+
+		join_pools(&poolA, &poolB, [&iterations, &maxval](auto index, CA& a, CB& b) {
+			maxval += a.x - b.x;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+}
+
+TEST_CASE("leaf width benchmark", "[bit-tree,!benchmark]") {
+
+	//the most a 16 bit pool can hold, spread over the whole id range so the leaves dont fit in cache
+	std::vector<uint32_t> ids;
+	for (uint32_t i = 0; i < 65536; i++) {
+		ids.push_back(i * 16);
+	}
+
+	run_leaf_width_benchmark<uint64_t>("64 bit leaves, 65536 spread", ids);
+	run_leaf_width_benchmark<uint32_t>("32 bit leaves, 65536 spread", ids);
+	run_leaf_width_benchmark<uint16_t>("16 bit leaves, 65536 spread", ids);
+
+	//every leaf full, too big for 16 bits
+	std::vector<uint32_t> dense_ids;
+	for (uint32_t i = 0; i < 1000000; i++) {
+		dense_ids.push_back(i);
+	}
+
+	run_leaf_width_benchmark<uint64_t>("64 bit leaves, 1.000.000 dense", dense_ids);
+	run_leaf_width_benchmark<uint32_t>("32 bit leaves, 1.000.000 dense", dense_ids);
+}
+
+TEST_CASE("sort by index benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+	struct CB
+	{
+		float x, y;
+	};
+
+	constexpr int num_entities = 1000000;
+
+	//inserted in random order, so dense order has nothing to do with tree order
+	std::vector<uint32_t> entities(num_entities);
+	for (int i = 0; i < num_entities; i++) {
+		entities[i] = i;
+	}
+	std::shuffle(entities.begin(), entities.end(), std::mt19937{ 1234 });
+
+	//add_pool_elements would sort the batch, one at a time keeps the random order
+	auto fill_pool = [&](auto* pool, auto value) {
+		for (uint32_t et : entities) {
+			value.x = et / 100000.f;
+			add_pool_element(pool, et, value);
+		}
+	};
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	fill_pool(&poolA, CA{});
+	fill_pool(&poolB, CB{});
+
+	auto join = [&]() {
+		int iterations = 0;
+		float maxval = 0;
+
+		join_pools(&poolA, &poolB, [&iterations, &maxval](auto index, CA& a, CB& b) {
+			maxval += a.x - b.x;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+
+	BENCHMARK("join AB 1.000.000: insertion order") {
+		return join();
+	};
+
+	sort_pool_by_index(&poolA);
+	sort_pool_by_index(&poolB);
+
+	BENCHMARK("join AB 1.000.000: tree order") {
+		return join();
+	};
+
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+
+	BENCHMARK_ADVANCED("sort_pool_by_index 1.000.000")(Catch::Benchmark::Chronometer meter) {
+		auto poolC = create_pool<CA>();
+		fill_pool(&poolC, CA{});
+
+		meter.measure([&] { sort_pool_by_index(&poolC); });
+		destroy_pool(&poolC);
+	};
+
+	//the same sort spread over many calls, as a game loop would do once per frame
+	int steps = 0;
+	BENCHMARK_ADVANCED("sort_pool_by_index_step 1.000.000, budget 10000")(Catch::Benchmark::Chronometer meter) {
+		auto poolC = create_pool<CA>();
+		fill_pool(&poolC, CA{});
+
+		PoolSortCursor cursor;
+		meter.measure([&] { return sort_pool_by_index_step(&poolC, &cursor, 10000); });
+
+		steps = 1;
+		while (!sort_pool_by_index_step(&poolC, &cursor, 10000)) {
+			steps++;
+		}
+		destroy_pool(&poolC);
+	};
+	std::cout << "incremental sort: " << steps << " steps to finish a pass" << std::endl;
+}
+TEST_CASE("world join benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+	struct CB
+	{
+		float x, y;
+	};
+	struct CC
+	{
+		float x;
+	};
+
+	reset_node_arena();
+	World world = create_world();
+	for (int i = 0; i < 1000000; i++) {
+		uint32_t et = world.create();
+		world.add<CA>(et, i / 100000.f, 0.f, 0.f);
+		if (i % 2) {
+			world.add<CB>(et, i / 100000.f, 0.f);
+		}
+		if (i % 3) {
+			world.add<CC>(et, i / 100000.f);
+		}
+	}
+
+	//the same pools, joined through the world and directly
+	BENCHMARK("join ABC 1.000.000: world.join") {
+		int iterations = 0;
+		float maxval = 0;
+
+		world.join<CA, CB, CC>([&iterations, &maxval](auto index, CA& a, CB& b, CC& c) {
+			maxval += a.x - b.x + c.x;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join ABC 1.000.000: join_pools") {
+		int iterations = 0;
+		float maxval = 0;
+
+		join_pools(world.pool<CA>(), world.pool<CB>(), world.pool<CC>(), [&iterations, &maxval](auto index, CA& a, CB& b, CC& c) {
+			maxval += a.x - b.x + c.x;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+
+	destroy_world(&world);
+}
+
+TEST_CASE("exclude join benchmark", "[bit-tree,!benchmark]") {
+
+	struct Transform
+	{
+		float x, y, z;
+	};
+	struct Velocity
+	{
+		float x, y, z;
+	};
+	struct Frozen
+	{
+		int frames;
+	};
+
+	constexpr int num_entities = 1000000;
+
+	std::mt19937 rng{ 1234 };
+
+	for (int percent : { 10, 50, 90 }) {
+
+		reset_node_arena();
+		auto poolA = create_pool<Transform>();
+		auto poolB = create_pool<Velocity>();
+		auto poolC = create_pool<Frozen>();
+		for (int i = 0; i < num_entities; i++) {
+			add_pool_element(&poolA, i, Transform{ i / 100000.f,0.f,0.f });
+			add_pool_element(&poolB, i, Velocity{ i / 100000.f,0.f,0.f });
+			if (int(rng() % 100) < percent) {
+				add_pool_element(&poolC, i, Frozen{ 1 });
+			}
+		}
+
+		BENCHMARK("join AB without C, " + std::to_string(percent) + "% frozen: check in callback") {
+			int iterations = 0;
+			float maxval = 0;
+
+			join_pools(&poolA, &poolB, [&](auto index, Transform& a, Velocity& b) {
+				uint64_t val;
+				if (!get_tree_val(&poolC.tree, index & 0xFFFFF, val)) {
+					maxval += a.x - b.x;
+					iterations++;
+				}
+				});
+
+			return maxval * iterations;
+		};
+		BENCHMARK("join AB without C, " + std::to_string(percent) + "% frozen: exclude_pools") {
+			int iterations = 0;
+			float maxval = 0;
+
+			join_pools(&poolA, &poolB, exclude_pools(&poolC), [&](auto index, Transform& a, Velocity& b) {
+				maxval += a.x - b.x;
+				iterations++;
+				});
+
+			return maxval * iterations;
+		};
+
+		destroy_pool(&poolA);
+		destroy_pool(&poolB);
+		destroy_pool(&poolC);
+	}
+}
+
+TEST_CASE("change tracking benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+
+	constexpr int num_entities = 1000000;
+
+	for (int permille : { 1, 10, 100 }) {
+
+		reset_node_arena();
+		auto poolA = create_pool<CA>();
+		for (int i = 0; i < num_entities; i++) {
+			add_pool_element(&poolA, i, CA{ i / 100000.f,0.f,0.f });
+		}
+		enable_change_tracking(&poolA);
+
+		//what replication does without tracking: a shadow copy to compare against
+		std::vector<CA> shadow(num_entities);
+		join_pools(&poolA, [&](uint32_t entity, CA& a) {
+			shadow[entity] = a;
+			});
+
+		std::mt19937 rng{ 1234 };
+		auto modify = [&]() {
+			for (int i = 0; i < num_entities / 1000 * permille; i++) {
+				find_pool_element(&poolA, rng() % num_entities)->y += 1.f;
+			}
+		};
+		modify();
+
+		const std::string name = (permille == 1 ? std::string("0.1") : std::to_string(permille / 10)) + "% changed";
+
+		BENCHMARK("find changed 1.000.000, " + name + ": join and compare") {
+			int changes = 0;
+			join_pools(&poolA, [&](uint32_t entity, CA& a) {
+				if (memcmp(&shadow[entity], &a, sizeof(CA)) != 0) {
+					changes++;
+				}
+				});
+			return changes;
+		};
+		BENCHMARK("find changed 1.000.000, " + name + ": iterate_changed") {
+			int changes = 0;
+			iterate_changed(&poolA, [&](uint32_t entity, CA& a) {
+				changes++;
+				});
+			return changes;
+		};
+
+		//clearing can only be done once per round of changes
+		const size_t dirty_nodes = node_arena_live_nodes();
+		auto start = std::chrono::high_resolution_clock::now();
+		clear_changed(&poolA);
+		auto end = std::chrono::high_resolution_clock::now();
+		std::cout << "clear_changed, " << name << ": " << std::chrono::duration<double, std::micro>(end - start).count() << " us, "
+			<< dirty_nodes - node_arena_live_nodes() << " nodes freed" << std::endl;
+
+		destroy_pool(&poolA);
+	}
+}
+
+TEST_CASE("chunked join benchmark", "[bit-tree,!benchmark]") {
+
+	struct Position
+	{
+		float x, y, z;
+	};
+	struct Velocity
+	{
+		float x, y, z;
+	};
+
+	constexpr int num_entities = 1000000;
+	constexpr float dt = 1.f / 60.f;
+
+	std::vector<uint32_t> entities(num_entities);
+	for (int i = 0; i < num_entities; i++) {
+		entities[i] = i;
+	}
+	std::shuffle(entities.begin(), entities.end(), std::mt19937{ 1234 });
+
+	reset_node_arena();
+	auto poolP = create_pool<Position>();
+	auto poolV = create_pool<Velocity>();
+	for (uint32_t et : entities) {
+		add_pool_element(&poolP, et, Position{ 0.f,0.f,0.f });
+		if (et % 8) {
+			add_pool_element(&poolV, et, Velocity{ et / 1000000.f,1.f,0.f });
+		}
+	}
+
+	auto run = [&](const std::string& order) {
+
+		BENCHMARK("integrate 1.000.000, " + order + ": per entity") {
+			join_pools(&poolP, &poolV, [](uint32_t entity, Position& p, Velocity& v) {
+				p.x += v.x * dt;
+				p.y += v.y * dt;
+				p.z += v.z * dt;
+				});
+			return poolP.Dense[0].x;
+		};
+		BENCHMARK("integrate 1.000.000, " + order + ": chunked") {
+			join_pools_chunked(&poolP, &poolV, [](JoinChunk<Position, Velocity>& chunk) {
+				if (chunk.bcontiguous) {
+					Position* p = std::get<0>(chunk.dense);
+					Velocity* v = std::get<1>(chunk.dense);
+					for (int i = 0; i < chunk.count; i++) {
+						p[i].x += v[i].x * dt;
+						p[i].y += v[i].y * dt;
+						p[i].z += v[i].z * dt;
+					}
+				}
+				else {
+					for (int i = 0; i < chunk.count; i++) {
+						Position& p = join_chunk_component<0>(chunk, i);
+						Velocity& v = join_chunk_component<1>(chunk, i);
+						p.x += v.x * dt;
+						p.y += v.y * dt;
+						p.z += v.z * dt;
+					}
+				}
+				});
+			return poolP.Dense[0].x;
+		};
+	};
+
+	run("insertion order");
+
+	sort_pool_by_index(&poolP);
+	sort_pool_by_index(&poolV);
+	run("tree order");
+
+	destroy_pool(&poolP);
+	destroy_pool(&poolV);
 }
 
+struct SoaCA
+{
+	float x, y, z;
+};
+template<>
+struct SoaFields<SoaCA>
+{
+	static constexpr auto members = std::make_tuple(&SoaCA::x, &SoaCA::y, &SoaCA::z);
+};
+
+TEST_CASE("soa pool benchmark", "[bit-tree,!benchmark]") {
+
+	constexpr int num_entities = 1000000;
+
+	reset_node_arena();
+	auto aos = create_pool<SoaCA>();
+	auto soa = create_soa_pool<SoaCA>();
+	for (int i = 0; i < num_entities; i++) {
+		add_pool_element(&aos, i, SoaCA{ 0.f,i / 100000.f,0.f });
+		add_pool_element(&soa, i, SoaCA{ 0.f,i / 100000.f,0.f });
+	}
+
+	BENCHMARK("update y 1.000.000: aos dense loop") {
+		SoaCA* values = aos.Dense.data();
+		for (size_t i = 0; i < aos.Dense.size(); i++) {
+			values[i].y *= 0.5f;
+		}
+		return values[0].y;
+	};
+	BENCHMARK("update y 1.000.000: soa column loop") {
+		float* ys = soa_column<1>(&soa);
+		for (size_t i = 0; i < soa.Reverse.size(); i++) {
+			ys[i] *= 0.5f;
+		}
+		return ys[0];
+	};
+	BENCHMARK("update y 1.000.000: aos join") {
+		join_pools(&aos, [](uint32_t entity, SoaCA& a) {
+			a.y *= 0.5f;
+			});
+		return aos.Dense[0].y;
+	};
+	BENCHMARK("update y 1.000.000: soa join") {
+		join_pools(&soa, [](uint32_t entity, SoaRef<SoaCA> a) {
+			std::get<1>(a) *= 0.5f;
+			});
+		return soa_column<1>(&soa)[0];
+	};
+
+	destroy_pool(&aos);
+	destroy_pool(&soa);
+}
+
+TEST_CASE("tag pool benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+	struct CB
+	{
+		float x, y;
+	};
+	struct Tag
+	{
+	};
+
+	constexpr int num_entities = 1000000;
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	for (int i = 0; i < num_entities; i++) {
+		add_pool_element(&poolA, i, CA{ i / 100000.f,0.f,0.f });
+		add_pool_element(&poolB, i, CB{ i / 100000.f,0.f });
+	}
+
+	//half the entities tagged, once as a tag pool and once stored like any other component
+	size_t bytes = node_arena_live_bytes();
+	auto tags = create_pool<Tag>();
+	for (int i = 0; i < num_entities; i += 2) {
+		add_pool_element(&tags, i, Tag{});
+	}
+	const size_t tag_bytes = node_arena_live_bytes() - bytes;
+
+	bytes = node_arena_live_bytes();
+	ComponentPool<Tag> stored;
+	stored.tree = create_bytetree<uint32_t>();
+	stored.changed.root = nullptr;
+	for (int i = 0; i < num_entities; i += 2) {
+		add_pool_element(&stored, i, Tag{});
+	}
+	const size_t stored_bytes = node_arena_live_bytes() - bytes + stored.Dense.capacity() * sizeof(Tag) + stored.Reverse.capacity() * sizeof(uint32_t);
+
+	std::cout << "500.000 tags: tag pool " << tag_bytes << " bytes, stored pool " << stored_bytes << " bytes" << std::endl;
+
+	BENCHMARK("join 1.000.000: 2 pools") {
+		float sum = 0.f;
+		join_pools(&poolA, &poolB, [&](uint32_t entity, CA& a, CB& b) {
+			sum += a.x + b.x;
+			});
+		return sum;
+	};
+	BENCHMARK("join 1.000.000: 2 pools + tag pool") {
+		float sum = 0.f;
+		join_pools(&poolA, &poolB, &tags, [&](uint32_t entity, CA& a, CB& b, Tag&) {
+			sum += a.x + b.x;
+			});
+		return sum;
+	};
+	BENCHMARK("join 1.000.000: 2 pools + stored tag") {
+		float sum = 0.f;
+		join_pools(&poolA, &poolB, &stored, [&](uint32_t entity, CA& a, CB& b, Tag&) {
+			sum += a.x + b.x;
+			});
+		return sum;
+	};
+
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+	destroy_pool(&tags);
+	destroy_pool(&stored);
+}
+
+TEST_CASE("range query benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+	struct CB
+	{
+		float x, y;
+	};
+
+	constexpr int num_entities = 1000000;
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	for (int i = 0; i < num_entities; i++) {
+		add_pool_element(&poolA, i, CA{ i / 100000.f,0.f,0.f });
+		if (i % 2) {
+			add_pool_element(&poolB, i, CB{ i / 100000.f,0.f });
+		}
+	}
+
+	std::mt19937 rng{ 1234 };
+	std::vector<uint32_t> starts(1000);
+	for (uint32_t& start : starts) {
+		start = rng() % num_entities;
+	}
+
+	for (uint32_t window : { 64, 4096 }) {
+
+		const std::string name = std::to_string(window) + " wide windows";
+
+		//a full scan per window is too slow for all 1000 of them
+		BENCHMARK("10 " + name + ": full join, filtered") {
+			float sum = 0.f;
+			for (int i = 0; i < 10; i++) {
+				const uint32_t first = starts[i];
+				join_pools(&poolA, [&](uint32_t entity, CA& a) {
+					if (entity >= first && entity < first + window) {
+						sum += a.x;
+					}
+					});
+			}
+			return sum;
+		};
+		BENCHMARK("1000 " + name + ": iterate_range") {
+			float sum = 0.f;
+			for (uint32_t first : starts) {
+				iterate_range(&poolA.tree, first, first + window, [&](uint32_t index, uint32_t value) {
+					sum += poolA.Dense[value].x;
+					});
+			}
+			return sum;
+		};
+		BENCHMARK("1000 " + name + ": cursor") {
+			float sum = 0.f;
+			for (uint32_t first : starts) {
+				for (const TreeCursor<uint32_t>& cursor : tree_range(&poolA.tree, first, first + window)) {
+					sum += poolA.Dense[tree_cursor_value(cursor)].x;
+				}
+			}
+			return sum;
+		};
+		BENCHMARK("1000 " + name + ": join_pools_range, 2 pools") {
+			float sum = 0.f;
+			for (uint32_t first : starts) {
+				join_pools_range(first, first + window, &poolA, &poolB, [&](uint32_t entity, CA& a, CB& b) {
+					sum += a.x + b.x;
+					});
+			}
+			return sum;
+		};
+	}
+
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+}
+
+TEST_CASE("query group benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+	struct CB
+	{
+		float x, y;
+	};
+	struct CC
+	{
+		float x;
+	};
+
+	constexpr int num_entities = 1000000;
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	auto poolC = create_pool<CC>();
+	std::vector<uint32_t> churned;
+	for (int i = 0; i < num_entities; i++) {
+		add_pool_element(&poolA, i, CA{ i / 100000.f,0.f,0.f });
+		//B and C are large, but only a block of 10.000 entities is in both
+		const bool bmatch = i >= 500000 && i < 510000;
+		if (i % 2 == 0 || bmatch) {
+			add_pool_element(&poolB, i, CB{ i / 100000.f,0.f });
+		}
+		if (i % 2 == 1 || bmatch) {
+			add_pool_element(&poolC, i, CC{ i / 100000.f });
+		}
+		if (bmatch) {
+			churned.push_back(i);
+		}
+	}
+
+	//every churned entity leaves and enters all the queries
+	auto churn = [&]() {
+		for (uint32_t entity : churned) {
+			remove_pool_element(&poolC, entity);
+		}
+		for (uint32_t entity : churned) {
+			add_pool_element(&poolC, entity, CC{ 1.f });
+		}
+		return poolC.Reverse.size();
+	};
+
+	std::vector<JoinQuery<ComponentPool<CA>, ComponentPool<CB>, ComponentPool<CC>>*> queries;
+	for (int nqueries : { 0, 1, 5 }) {
+		while (queries.size() < size_t(nqueries)) {
+			queries.push_back(create_query(&poolA, &poolB, &poolC));
+		}
+		BENCHMARK("remove + add 10.000: " + std::to_string(nqueries) + " queries") {
+			return churn();
+		};
+	}
+
+	BENCHMARK("join 10.000 of 1.000.000: join_pools") {
+		float sum = 0.f;
+		join_pools(&poolA, &poolB, &poolC, [&](uint32_t entity, CA& a, CB& b, CC& c) {
+			sum += a.x + b.x + c.x;
+			});
+		return sum;
+	};
+	BENCHMARK("join 10.000 of 1.000.000: iterate_query") {
+		float sum = 0.f;
+		iterate_query(queries[0], [&](uint32_t entity, CA& a, CB& b, CC& c) {
+			sum += a.x + b.x + c.x;
+			});
+		return sum;
+	};
+
+	for (auto* query : queries) {
+		destroy_query(query);
+	}
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+	destroy_pool(&poolC);
+}
+
+
+TEST_CASE("population count benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+	struct CB
+	{
+		float x, y;
+	};
+
+	constexpr int num_entities = 1000000;
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	auto sparseB = create_pool<CB>();
+	for (int i = 0; i < num_entities; i++) {
+		add_pool_element(&poolA, i, CA{ i / 100000.f,0.f,0.f });
+		add_pool_element(&poolB, i, CB{ i / 100000.f,0.f });
+		if (i % 3 == 0) {
+			add_pool_element(&sparseB, i, CB{ i / 100000.f,0.f });
+		}
+	}
+
+	BENCHMARK("count 1.000.000: join_pools") {
+		size_t count = 0;
+		join_pools(&poolA, &poolB, [&](uint32_t entity, CA& a, CB& b) {
+			count++;
+			});
+		return count;
+	};
+	BENCHMARK("count 1.000.000: count_joined") {
+		return count_joined(&poolA, &poolB);
+	};
+	BENCHMARK("count 333.334 of 1.000.000: join_pools") {
+		size_t count = 0;
+		join_pools(&poolA, &sparseB, [&](uint32_t entity, CA& a, CB& b) {
+			count++;
+			});
+		return count;
+	};
+	BENCHMARK("count 333.334 of 1.000.000: count_joined") {
+		return count_joined(&poolA, &sparseB);
+	};
+
+	std::mt19937 rng{ 1234 };
+	std::vector<uint32_t> starts(1000);
+	for (uint32_t& start : starts) {
+		start = rng() % num_entities;
+	}
+
+	BENCHMARK("1000 100.000 wide ranges: iterate_range") {
+		size_t count = 0;
+		for (uint32_t first : starts) {
+			iterate_range(&sparseB.tree, first, first + 100000, [&](uint32_t index, uint32_t value) {
+				count++;
+				});
+		}
+		return count;
+	};
+	BENCHMARK("1000 100.000 wide ranges: count_range") {
+		size_t count = 0;
+		for (uint32_t first : starts) {
+			count += count_range(&sparseB.tree, first, first + 100000);
+		}
+		return count;
+	};
+
+	//split points for 64 tasks of the same size
+	BENCHMARK("64 split points: tree_select") {
+		uint32_t sum = 0;
+		const size_t size = tree_size(&sparseB.tree);
+		for (size_t i = 0; i < 64; i++) {
+			uint32_t index = 0;
+			if (tree_select(&sparseB.tree, size * i / 64, index)) {
+				sum += index;
+			}
+		}
+		return sum;
+	};
+
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+	destroy_pool(&sparseB);
+}
+
+
+TEST_CASE("snapshot benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+
+	//indices are 20 bits, so a pool holds at most 1.048.576 entities
+	constexpr int num_entities = 1000000;
+
+	std::vector<uint32_t> entities(num_entities);
+	std::vector<CA> values(num_entities);
+	for (int i = 0; i < num_entities; i++) {
+		entities[i] = i;
+		values[i] = CA{ i / 100000.f,0.f,0.f };
+	}
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	add_pool_elements(&poolA, entities.data(), values.data(), entities.size());
+
+	const std::string path = (std::filesystem::temp_directory_path() / "bytecs_benchmark_snapshot.bin").string();
+	BENCHMARK("save 1.000.000") {
+		return save_pool_snapshot(&poolA, path.c_str());
+	};
+
+	BENCHMARK("start 1.000.000: add_pool_element") {
+		auto pool = create_pool<CA>();
+		for (int i = 0; i < num_entities; i++) {
+			add_pool_element(&pool, entities[i], values[i]);
+		}
+		const size_t size = pool.Dense.size();
+		destroy_pool(&pool);
+		return size;
+	};
+	BENCHMARK("start 1.000.000: add_pool_elements") {
+		auto pool = create_pool<CA>();
+		add_pool_elements(&pool, entities.data(), values.data(), entities.size());
+		const size_t size = pool.Dense.size();
+		destroy_pool(&pool);
+		return size;
+	};
+	BENCHMARK("start 1.000.000: load_pool_snapshot") {
+		MappedPool<CA> mapped;
+		load_pool_snapshot(path.c_str(), &mapped);
+		const size_t size = pool_size(&mapped);
+		destroy_pool(&mapped);
+		return size;
+	};
+	BENCHMARK("start 1.000.000: load_pool_snapshot, leaves checked") {
+		MappedPool<CA> mapped;
+		load_pool_snapshot(path.c_str(), &mapped, true);
+		const size_t size = pool_size(&mapped);
+		destroy_pool(&mapped);
+		return size;
+	};
+	//the pages are only read from the file when touched
+	BENCHMARK("start 1.000.000: load_pool_snapshot + join") {
+		MappedPool<CA> mapped;
+		load_pool_snapshot(path.c_str(), &mapped);
+		float sum = 0.f;
+		join_pools(&mapped, [&](uint32_t entity, CA& a) {
+			sum += a.x;
+			});
+		destroy_pool(&mapped);
+		return sum;
+	};
+	BENCHMARK("start 1.000.000: load_pool_snapshot + copy_mapped_pool") {
+		MappedPool<CA> mapped;
+		load_pool_snapshot(path.c_str(), &mapped);
+		auto pool = copy_mapped_pool(&mapped);
+		destroy_pool(&mapped);
+		const size_t size = pool.Dense.size();
+		destroy_pool(&pool);
+		return size;
+	};
+
+	std::filesystem::remove(path);
+	destroy_pool(&poolA);
+}
+
+
+TEST_CASE("delta benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+
+	//500.000 entities on the even indices, additions take odd ones
+	constexpr int num_entities = 500000;
+
+	reset_node_arena();
+	auto before = create_pool<CA>();
+	for (int i = 0; i < num_entities; i++) {
+		add_pool_element(&before, i * 2, CA{ i / 100000.f,0.f,0.f });
+	}
+
+	for (int percent : { 1, 10, 50 }) {
+
+		//half of the touched entities change value, a quarter is removed and a quarter added
+		auto after = copy_pool(&before);
+		std::mt19937 rng{ 1234 };
+		const int touched = num_entities / 100 * percent;
+		for (int i = 0; i < touched; i++) {
+			const uint32_t entity = (rng() % num_entities) * 2;
+			switch (i % 4) {
+			case 0: remove_pool_element(&after, entity); break;
+			case 1: add_pool_element(&after, entity + 1, CA{ 1.f,1.f,1.f }); break;
+			default:
+				if (CA* value = find_pool_element(&after, entity)) { value->y += 1.f; }
+				break;
+			}
+		}
+
+		std::vector<uint8_t> delta;
+		std::vector<uint8_t> rollback;
+		diff_pools(&before, &after, delta);
+		diff_pools(&after, &before, rollback);
+		const DeltaHeader header = read_delta_header(delta.data());
+		std::cout << percent << "% churn: " << header.removed << " removed, " << header.added << " added, " << header.changed
+			<< " changed, delta " << delta.size() << " bytes, full pool " << after.Dense.size() * (sizeof(CA) + sizeof(uint32_t)) << " bytes" << std::endl;
+
+		const std::string name = std::to_string(percent) + "% churn of 500.000: ";
+		BENCHMARK(name + "compare entity by entity") {
+			size_t differences = 0;
+			for (size_t i = 0; i < before.Reverse.size(); i++) {
+				CA value;
+				differences += !get_pool_element(&after, before.Reverse[i], value) || memcmp(&value, &before.Dense[i], sizeof(CA)) != 0;
+			}
+			for (uint32_t entity : after.Reverse) {
+				differences += !has_pool_element(&before, entity);
+			}
+			return differences;
+		};
+		BENCHMARK(name + "diff_pools") {
+			diff_pools(&before, &after, delta);
+			return delta.size();
+		};
+		auto replica = copy_pool(&before);
+		BENCHMARK(name + "apply_delta + rollback") {
+			apply_delta(&replica, delta.data(), delta.size());
+			apply_delta(&replica, rollback.data(), rollback.size());
+			return replica.Dense.size();
+		};
+
+		destroy_pool(&after);
+		destroy_pool(&replica);
+	}
+
+	destroy_pool(&before);
+}
+
+TEST_CASE("cow snapshot benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+
+	constexpr int num_entities = 500000;
+
+	reset_node_arena();
+	auto pool = create_pool<CA>();
+	auto cow = create_cow_pool<CA>();
+	for (int i = 0; i < num_entities; i++) {
+		add_pool_element(&pool, i * 2, CA{ i / 100000.f,0.f,0.f });
+		add_pool_element(&cow, i * 2, CA{ i / 100000.f,0.f,0.f });
+	}
+
+	BENCHMARK("snapshot of 500.000: copy_pool") {
+		auto copy = copy_pool(&pool);
+		const size_t size = copy.Dense.size();
+		destroy_pool(&copy);
+		return size;
+	};
+	BENCHMARK("snapshot of 500.000: snapshot_pool") {
+		auto snapshot = snapshot_pool(&cow);
+		const size_t size = pool_size(&snapshot);
+		destroy_pool(&snapshot);
+		return size;
+	};
+
+	//a frame writes the values of some random entities, one in ten is removed and added again so the dense order moves too
+	auto run_frame = [](auto* target, std::mt19937& rng, int writes) {
+		for (int i = 0; i < writes; i++) {
+			const uint32_t entity = (rng() % num_entities) * 2;
+			if (i % 10 == 0) {
+				remove_pool_element(target, entity);
+				add_pool_element(target, entity, CA{ 1.f,1.f,1.f });
+			}
+			else if (CA* value = find_pool_element(target, entity)) {
+				value->y += 1.f;
+			}
+		}
+	};
+
+	for (int permille : { 1, 10, 100 }) {
+
+		const int writes = num_entities / 1000 * permille;
+		std::mt19937 rng{ 1234 };
+
+		//copied bytes per frame once the pool is in a steady state
+		size_t copied = 0;
+		constexpr int frames = 20;
+		for (int frame = 0; frame < frames * 2; frame++) {
+			auto snapshot = snapshot_pool(&cow);
+			const size_t before = shared_copied_bytes;
+			run_frame(&cow, rng, writes);
+			copied += (frame >= frames) ? shared_copied_bytes - before : 0;
+			destroy_pool(&snapshot);
+		}
+		const size_t pool_bytes = num_entities * (sizeof(CA) + sizeof(uint32_t)) + node_arena_live_bytes();
+		std::cout << permille / 10.f << "% written per frame: " << copied / frames << " bytes copied, "
+			<< copied / frames / writes << " per write, full snapshot " << pool_bytes << " bytes" << std::endl;
+
+		const std::string name = std::to_string(writes) + " writes of 500.000: ";
+		BENCHMARK(name + "ComponentPool, no snapshot") {
+			run_frame(&pool, rng, writes);
+			return pool.Dense.size();
+		};
+		BENCHMARK(name + "copy_pool + writes") {
+			auto copy = copy_pool(&pool);
+			run_frame(&pool, rng, writes);
+			destroy_pool(&copy);
+			return pool.Dense.size();
+		};
+		BENCHMARK(name + "CowPool, no snapshot") {
+			run_frame(&cow, rng, writes);
+			return pool_size(&cow);
+		};
+		BENCHMARK(name + "snapshot_pool + writes") {
+			auto snapshot = snapshot_pool(&cow);
+			run_frame(&cow, rng, writes);
+			destroy_pool(&snapshot);
+			return pool_size(&cow);
+		};
+	}
+
+	destroy_pool(&pool);
+	destroy_pool(&cow);
+}
+
+
 int main(int argc, char* argv[])
 {
 	Catch::Session session; // There must be exactly one instance
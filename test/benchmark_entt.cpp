@@ -1,4 +1,5 @@
 #include "BitTree.h"
+#include "EntityRegistry.h"
 #include <iostream>
 #include <entt.hpp>
 
@@ -333,6 +334,387 @@ TEST_CASE("join 50.000 benchmark", "[bit-tree,!benchmark]") {
 	};
 }
 
+template<int N>
+struct CN
+{
+	float v;
+};
+
+TEST_CASE("join N components benchmark", "[bit-tree,!benchmark]") {
+
+	constexpr int num_entities = 50000;
+
+	auto pool1 = create_pool<CN<1>>();
+	auto pool2 = create_pool<CN<2>>();
+	auto pool3 = create_pool<CN<3>>();
+	auto pool4 = create_pool<CN<4>>();
+	auto pool5 = create_pool<CN<5>>();
+	auto pool6 = create_pool<CN<6>>();
+	auto pool7 = create_pool<CN<7>>();
+	auto pool8 = create_pool<CN<8>>();
+
+	entt::registry test_reg;
+	for (int i = 0; i <= num_entities; i += 1)
+	{
+		auto et = test_reg.create();
+		uint32_t itg = to_integer(et) & 0xFFFFF;
+
+		//every pool skips a different stride of entities, so the joins get sparser as more pools are added
+		if (itg % 2) { add_pool_element(&pool1, to_integer(et), CN<1>{ i / 100000.f }); test_reg.assign<CN<1>>(et, CN<1>{ i / 100000.f }); }
+		if (itg % 3) { add_pool_element(&pool2, to_integer(et), CN<2>{ i / 100000.f }); test_reg.assign<CN<2>>(et, CN<2>{ i / 100000.f }); }
+		if (itg % 4) { add_pool_element(&pool3, to_integer(et), CN<3>{ i / 100000.f }); test_reg.assign<CN<3>>(et, CN<3>{ i / 100000.f }); }
+		if (itg % 5) { add_pool_element(&pool4, to_integer(et), CN<4>{ i / 100000.f }); test_reg.assign<CN<4>>(et, CN<4>{ i / 100000.f }); }
+		if (itg % 6) { add_pool_element(&pool5, to_integer(et), CN<5>{ i / 100000.f }); test_reg.assign<CN<5>>(et, CN<5>{ i / 100000.f }); }
+		if (itg % 7) { add_pool_element(&pool6, to_integer(et), CN<6>{ i / 100000.f }); test_reg.assign<CN<6>>(et, CN<6>{ i / 100000.f }); }
+		if (itg % 8) { add_pool_element(&pool7, to_integer(et), CN<7>{ i / 100000.f }); test_reg.assign<CN<7>>(et, CN<7>{ i / 100000.f }); }
+		if (itg % 9) { add_pool_element(&pool8, to_integer(et), CN<8>{ i / 100000.f }); test_reg.assign<CN<8>>(et, CN<8>{ i / 100000.f }); }
+	}
+
+	BENCHMARK("join 2 components - BTree") {
+		int iterations = 0;
+		float maxval = 0;
+
+		join_pools(&pool1, &pool2, [&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2) {
+			maxval += c1.v + c2.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 2 components - Entt") {
+		int iterations = 0;
+		float maxval = 0;
+
+		test_reg.view<CN<1>, CN<2>>().each([&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2) {
+			maxval += c1.v + c2.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 3 components - BTree") {
+		int iterations = 0;
+		float maxval = 0;
+
+		join_pools(&pool1, &pool2, &pool3, [&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3) {
+			maxval += c1.v + c2.v + c3.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 3 components - Entt") {
+		int iterations = 0;
+		float maxval = 0;
+
+		test_reg.view<CN<1>, CN<2>, CN<3>>().each([&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3) {
+			maxval += c1.v + c2.v + c3.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 4 components - BTree") {
+		int iterations = 0;
+		float maxval = 0;
+
+		join_pools(&pool1, &pool2, &pool3, &pool4, [&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3, CN<4>& c4) {
+			maxval += c1.v + c2.v + c3.v + c4.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 4 components - Entt") {
+		int iterations = 0;
+		float maxval = 0;
+
+		test_reg.view<CN<1>, CN<2>, CN<3>, CN<4>>().each([&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3, CN<4>& c4) {
+			maxval += c1.v + c2.v + c3.v + c4.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 5 components - BTree") {
+		int iterations = 0;
+		float maxval = 0;
+
+		join_pools(&pool1, &pool2, &pool3, &pool4, &pool5, [&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3, CN<4>& c4, CN<5>& c5) {
+			maxval += c1.v + c2.v + c3.v + c4.v + c5.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 5 components - Entt") {
+		int iterations = 0;
+		float maxval = 0;
+
+		test_reg.view<CN<1>, CN<2>, CN<3>, CN<4>, CN<5>>().each([&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3, CN<4>& c4, CN<5>& c5) {
+			maxval += c1.v + c2.v + c3.v + c4.v + c5.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 6 components - BTree") {
+		int iterations = 0;
+		float maxval = 0;
+
+		join_pools(&pool1, &pool2, &pool3, &pool4, &pool5, &pool6, [&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3, CN<4>& c4, CN<5>& c5, CN<6>& c6) {
+			maxval += c1.v + c2.v + c3.v + c4.v + c5.v + c6.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 6 components - Entt") {
+		int iterations = 0;
+		float maxval = 0;
+
+		test_reg.view<CN<1>, CN<2>, CN<3>, CN<4>, CN<5>, CN<6>>().each([&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3, CN<4>& c4, CN<5>& c5, CN<6>& c6) {
+			maxval += c1.v + c2.v + c3.v + c4.v + c5.v + c6.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 7 components - BTree") {
+		int iterations = 0;
+		float maxval = 0;
+
+		join_pools(&pool1, &pool2, &pool3, &pool4, &pool5, &pool6, &pool7, [&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3, CN<4>& c4, CN<5>& c5, CN<6>& c6, CN<7>& c7) {
+			maxval += c1.v + c2.v + c3.v + c4.v + c5.v + c6.v + c7.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 7 components - Entt") {
+		int iterations = 0;
+		float maxval = 0;
+
+		test_reg.view<CN<1>, CN<2>, CN<3>, CN<4>, CN<5>, CN<6>, CN<7>>().each([&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3, CN<4>& c4, CN<5>& c5, CN<6>& c6, CN<7>& c7) {
+			maxval += c1.v + c2.v + c3.v + c4.v + c5.v + c6.v + c7.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 8 components - BTree") {
+		int iterations = 0;
+		float maxval = 0;
+
+		join_pools(&pool1, &pool2, &pool3, &pool4, &pool5, &pool6, &pool7, &pool8, [&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3, CN<4>& c4, CN<5>& c5, CN<6>& c6, CN<7>& c7, CN<8>& c8) {
+			maxval += c1.v + c2.v + c3.v + c4.v + c5.v + c6.v + c7.v + c8.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+	BENCHMARK("join 8 components - Entt") {
+		int iterations = 0;
+		float maxval = 0;
+
+		test_reg.view<CN<1>, CN<2>, CN<3>, CN<4>, CN<5>, CN<6>, CN<7>, CN<8>>().each([&iterations, &maxval](auto index, CN<1>& c1, CN<2>& c2, CN<3>& c3, CN<4>& c4, CN<5>& c5, CN<6>& c6, CN<7>& c7, CN<8>& c8) {
+			maxval += c1.v + c2.v + c3.v + c4.v + c5.v + c6.v + c7.v + c8.v;
+			iterations++;
+			});
+
+		return maxval * iterations;
+	};
+}
+TEST_CASE("entity registry benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+
+	constexpr int num_entities = 1000000;
+
+	BENCHMARK("create 1.000.000 entities - BTree") {
+		auto registry = create_registry();
+		for (int i = 0; i < num_entities; i++) {
+			create_entity(&registry);
+		}
+		return registry_alive_count(&registry);
+	};
+	BENCHMARK("create 1.000.000 entities - Entt") {
+		entt::registry test_reg;
+		for (int i = 0; i < num_entities; i++) {
+			test_reg.create();
+		}
+		return test_reg.alive();
+	};
+
+	//destroy half of the entities, with a component each, and create them again from the recycled ids
+	std::vector<uint32_t> order(num_entities);
+	for (int i = 0; i < num_entities; i++) {
+		order[i] = i;
+	}
+	std::shuffle(order.begin(), order.end(), std::mt19937{ 1234 });
+
+	BENCHMARK("destroy and recycle 500.000 entities, no components - BTree") {
+		auto registry = create_registry();
+
+		std::vector<uint32_t> entities(num_entities);
+		create_entities(&registry, entities.data(), entities.size());
+
+		for (int i = 0; i < num_entities / 2; i++) {
+			destroy_entity(&registry, entities[order[i]]);
+		}
+		for (int i = 0; i < num_entities / 2; i++) {
+			create_entity(&registry);
+		}
+		return registry_alive_count(&registry);
+	};
+	BENCHMARK("destroy and recycle 500.000 entities, no components - Entt") {
+		entt::registry test_reg;
+
+		std::vector<entt::entity> entities(num_entities);
+		test_reg.create(entities.begin(), entities.end());
+
+		for (int i = 0; i < num_entities / 2; i++) {
+			test_reg.destroy(entities[order[i]]);
+		}
+		for (int i = 0; i < num_entities / 2; i++) {
+			test_reg.create();
+		}
+		return test_reg.alive();
+	};
+	BENCHMARK("destroy and recycle 500.000 entities - BTree") {
+		reset_node_arena();
+		auto registry = create_registry();
+		auto poolA = create_pool<CA>();
+		register_pool(&registry, &poolA);
+
+		std::vector<uint32_t> entities(num_entities);
+		create_entities(&registry, entities.data(), entities.size());
+		for (uint32_t et : entities) {
+			add_pool_element(&poolA, et, CA{ 0.f,0.f,0.f });
+		}
+
+		for (int i = 0; i < num_entities / 2; i++) {
+			destroy_entity(&registry, entities[order[i]]);
+		}
+		for (int i = 0; i < num_entities / 2; i++) {
+			create_entity(&registry);
+		}
+		return registry_alive_count(&registry);
+	};
+	BENCHMARK("destroy and recycle 500.000 entities - Entt") {
+		entt::registry test_reg;
+
+		std::vector<entt::entity> entities(num_entities);
+		test_reg.create(entities.begin(), entities.end());
+		for (auto et : entities) {
+			test_reg.assign<CA>(et, CA{ 0.f,0.f,0.f });
+		}
+
+		for (int i = 0; i < num_entities / 2; i++) {
+			test_reg.destroy(entities[order[i]]);
+		}
+		for (int i = 0; i < num_entities / 2; i++) {
+			test_reg.create();
+		}
+		return test_reg.alive();
+	};
+}
+
+TEST_CASE("skewed join benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+	struct CB
+	{
+		float r;
+	};
+
+	constexpr int num_entities = 1000000;
+
+	reset_node_arena();
+	auto poolA = create_pool<CA>();
+	entt::registry test_reg;
+	std::vector<entt::entity> all_entities(num_entities);
+	test_reg.create(all_entities.begin(), all_entities.end());
+	for (int i = 0; i < num_entities; i++) {
+		add_pool_element(&poolA, to_integer(all_entities[i]) & 0xFFFFF, CA{ i / 100000.f,0.f,0.f });
+		test_reg.assign<CA>(all_entities[i], CA{ i / 100000.f,0.f,0.f });
+	}
+
+	std::mt19937 rng{ 1234 };
+	struct Case
+	{
+		const char* name;
+		int count;
+		bool bclustered;
+	};
+	for (const Case& c : { Case{ "100 scattered", 100, false }, Case{ "10.000 scattered", 10000, false },
+		Case{ "10.000 clustered", 10000, true }, Case{ "100.000 scattered", 100000, false } }) {
+
+		auto poolB = create_pool<CB>();
+		const uint32_t cluster_start = rng() % (num_entities - c.count);
+		for (int i = 0; i < c.count; i++) {
+			const entt::entity et = all_entities[c.bclustered ? cluster_start + i : rng() % num_entities];
+			add_pool_element(&poolB, to_integer(et) & 0xFFFFF, CB{ 1.f });
+			test_reg.assign_or_replace<CB>(et, CB{ 1.f });
+		}
+
+		const JoinPlan plan = plan_join(&poolA, &poolB);
+		std::cout << "1.000.000 x " << c.name << ": plan " << join_strategy_name(plan.strategy)
+			<< ", driver " << plan.driver_size << " elements in " << plan.driver_leaves << " leaves" << std::endl;
+		//hybrid with the driver walking every subtree alone
+		JoinPlan driven = plan;
+		memset(driven.driven_subtrees, 0xFF, sizeof(driven.driven_subtrees));
+
+		const std::string name = std::string("join 1.000.000 x ") + c.name;
+		auto body = [](float& sum) {
+			return [&sum](uint32_t entity, CA& a, CB& b) {
+				sum += a.x * b.r;
+			};
+		};
+
+		BENCHMARK(name + ": intersect - BTree") {
+			float sum = 0.f;
+			auto f = body(sum);
+			join_pools(&poolA, &poolB, f);
+			return sum;
+		};
+		BENCHMARK(name + ": probe - BTree") {
+			float sum = 0.f;
+			auto f = body(sum);
+			join_pools_probe<1>(f, std::make_index_sequence<2>{}, &poolA, &poolB);
+			return sum;
+		};
+		BENCHMARK(name + ": hybrid - BTree") {
+			float sum = 0.f;
+			auto f = body(sum);
+			join_pools_hybrid<1>(f, driven, std::make_index_sequence<2>{}, &poolA, &poolB);
+			return sum;
+		};
+		BENCHMARK(name + ": planned - BTree") {
+			float sum = 0.f;
+			join_pools_planned(&poolA, &poolB, body(sum));
+			return sum;
+		};
+		BENCHMARK(name + " - Entt") {
+			float sum = 0.f;
+			test_reg.view<CA, CB>().each([&sum](entt::entity et, CA& a, CB& b) {
+				sum += a.x * b.r;
+				});
+			return sum;
+		};
+
+		destroy_pool(&poolB);
+		test_reg.reset<CB>();
+	}
+	destroy_pool(&poolA);
+}
+
 
 int main(int argc, char* argv[])
 {
@@ -0,0 +1,163 @@
+#include "BitTree.h"
+#include "ParallelJoin.h"
+#include "CommandBuffer.h"
+#include <iostream>
+
+#define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "catch.hpp"
+
+TEST_CASE("parallel join 1.000.000 benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+	struct CB
+	{
+		float vx, vy, vz;
+	};
+	struct CC
+	{
+		float r, g, b;
+	};
+
+	constexpr int num_entities = 1000000;
+
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	auto poolC = create_pool<CC>();
+
+	for (int i = 0; i < num_entities; i++)
+	{
+		add_pool_element(&poolA, i, CA{ i / 100000.f,0.f,0.f });
+		if (i % 2) {
+			add_pool_element(&poolB, i, CB{ 1.f,2.f,3.f });
+		}
+		if (i % 3) {
+			add_pool_element(&poolC, i, CC{ i / 100000.f,0.f,0.f });
+		}
+	}
+
+	auto integrate = [](auto index, CA& a, CB& b, CC& c) {
+		for (int step = 0; step < 8; step++) {
+			a.x += b.vx * 0.016f;
+			a.y += b.vy * 0.016f;
+			a.z += b.vz * 0.016f;
+			c.r = a.x * a.y - c.g;
+		}
+	};
+
+	BENCHMARK("join ABC - single thread join_pools") {
+		join_pools(&poolA, &poolB, &poolC, integrate);
+		return poolA.Dense[0].x;
+	};
+
+	const int max_threads = std::max(1, int(std::thread::hardware_concurrency()));
+	std::vector<int> thread_counts;
+	for (int nthreads = 1; nthreads < max_threads; nthreads *= 2) {
+		thread_counts.push_back(nthreads);
+	}
+	thread_counts.push_back(max_threads);
+
+	for (int nthreads : thread_counts) {
+
+		TaskPool* taskpool = create_task_pool(nthreads);
+
+		BENCHMARK("join ABC - " + std::to_string(nthreads) + " threads, root tasks") {
+			parallel_join_pools(taskpool, JoinGrain::Root, &poolA, &poolB, &poolC, integrate);
+			return poolA.Dense[0].x;
+		};
+		BENCHMARK("join ABC - " + std::to_string(nthreads) + " threads, leaf tasks") {
+			parallel_join_pools(taskpool, JoinGrain::Leaf, &poolA, &poolB, &poolC, integrate);
+			return poolA.Dense[0].x;
+		};
+
+		destroy_task_pool(taskpool);
+	}
+}
+
+TEST_CASE("command buffer benchmark", "[bit-tree,!benchmark]") {
+
+	struct CA
+	{
+		float x, y, z;
+	};
+	struct CB
+	{
+		float vx, vy, vz;
+	};
+
+	constexpr int num_entities = 1000000;
+
+	auto poolA = create_pool<CA>();
+	auto poolB = create_pool<CB>();
+	for (int i = 0; i < num_entities; i++)
+	{
+		add_pool_element(&poolA, i, CA{ i / 100000.f,0.f,0.f });
+		add_pool_element(&poolB, i, CB{ 1.f,2.f,3.f });
+	}
+
+	const int max_threads = std::max(1, int(std::thread::hardware_concurrency()));
+	TaskPool* taskpool = create_task_pool(max_threads);
+	CommandQueue queue = create_command_queue(task_pool_thread_count(taskpool));
+
+	for (uint32_t percent : { 1, 5, 10 }) {
+
+		//the same entities toggle their B every frame, so the pools stay the same size
+		auto bchurn = [percent](uint32_t entity) {
+			return (entity * 2654435761u) % 100 < percent;
+		};
+
+		const std::string name = std::to_string(percent) + "% of 1.000.000 toggle B - ";
+		BENCHMARK(name + "immediate, join_pools") {
+			join_pools(&poolA, [&](uint32_t entity, CA& a) {
+				if (bchurn(entity)) {
+					if (has_pool_element(&poolB, entity)) remove_pool_element(&poolB, entity);
+					else add_pool_element(&poolB, entity, CB{ a.x,0.f,0.f });
+				}
+			});
+			return poolB.Dense.size();
+		};
+		BENCHMARK(name + "deferred, join_pools") {
+			CommandBuffer* commands = thread_command_buffer(&queue);
+			join_pools(&poolA, [&](uint32_t entity, CA& a) {
+				if (bchurn(entity)) {
+					if (has_pool_element(&poolB, entity)) defer_remove_pool_element(commands, &poolB, entity);
+					else defer_add_pool_element(commands, &poolB, entity, CB{ a.x,0.f,0.f });
+				}
+			});
+			flush_commands(&queue);
+			return poolB.Dense.size();
+		};
+		BENCHMARK(name + "deferred, " + std::to_string(max_threads) + " threads") {
+			parallel_join_pools(taskpool, JoinGrain::Auto, &poolA, [&](uint32_t entity, CA& a) {
+				if (bchurn(entity)) {
+					CommandBuffer* commands = thread_command_buffer(&queue);
+					if (has_pool_element(&poolB, entity)) defer_remove_pool_element(commands, &poolB, entity);
+					else defer_add_pool_element(commands, &poolB, entity, CB{ a.x,0.f,0.f });
+				}
+			});
+			flush_commands(&queue);
+			return poolB.Dense.size();
+		};
+	}
+
+	destroy_command_queue(&queue);
+	destroy_task_pool(taskpool);
+	destroy_pool(&poolA);
+	destroy_pool(&poolB);
+}
+
+int main(int argc, char* argv[])
+{
+	Catch::Session session; // There must be exactly one instance
+
+	int returnCode = session.applyCommandLine(argc, argv);
+	if (returnCode != 0) // Indicates a command line error
+		return returnCode;
+
+	int numFailed = session.run();
+
+	return numFailed;
+}